@@ -15,7 +15,9 @@ color ray_color(const ray& r, const hittable_list& world, int depth)
     if (world.hit(r, 0.001, INF, rec)) {
         ray scattered;
         color attenuation;
-        if (rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
+        double pdf;
+        const material* mat = world.materials().get(rec.mat_id);
+        if (mat && mat->scatter(r, rec, attenuation, scattered, pdf)) {
             return attenuation * ray_color(scattered, world, depth - 1);
         }
         return color(0,0,0);
@@ -131,13 +133,15 @@ hittable_list teapot_scene() {
     color marble(0.949f, 0.941f, 0.902f);
     auto lambertian_material = std::make_shared<lambertian>(color(0.0,1.0,0.0));
 
+    // one copy of the geometry and its BVH, shared by every teapot
+    auto mesh = get_triangle_mesh_cached("../../objs/teapot.obj");
     for (int i = 0; i <= 4; i++) {
-        auto mesh = get_triangle_mesh_from_file("../../objs/teapot.obj");
         auto material = std::make_shared<glossy>(marble, marble, 0.8, i / 4.0f);
-        mesh->set_material(material);
-        mesh->push_transform(std::make_shared<scale>(0.5f, 0.5f, 0.5f));
-        mesh->push_transform(std::make_shared<translation>(3.0f * (i-2), 0, 0));
-        world.add(mesh);
+        std::vector<std::shared_ptr<transform>> transforms = {
+            std::make_shared<scale>(0.5f, 0.5f, 0.5f),
+            std::make_shared<translation>(3.0f * (i-2), 0, 0)
+        };
+        world.add(std::make_shared<mesh_instance>(mesh, transforms, material));
     }
 
     auto ground_material = std::make_shared<lambertian>(color(0.5, 0.25, 0.25));
@@ -157,6 +161,43 @@ hittable_list teapot_scene() {
     return world;
 }
 
+/* two triangles spanning corner + a * u + b * v for a, b in [0, 1]; cross(u, v) is the front */
+std::shared_ptr<triangle_mesh> quad(const point3& corner, const vec3& u, const vec3& v, std::shared_ptr<material> m) {
+    std::vector<point3> vertices = { corner, corner + u, corner + u + v, corner + v };
+    std::vector<vec3> texture_coords = { vec3(0, 0, 0), vec3(1, 0, 0), vec3(1, 1, 0), vec3(0, 1, 0) };
+    std::vector<face> faces(2);
+    faces[0].vertex_indices = faces[0].texture_indices = { 0, 1, 2 };
+    faces[1].vertex_indices = faces[1].texture_indices = { 0, 2, 3 };
+    return std::make_shared<triangle_mesh>(vertices, std::vector<vec3>(), texture_coords, faces, m);
+}
+
+// A room open towards the camera and lit only by a ceiling panel and a small
+// glowing sphere; render it with r.background(color(0,0,0))
+hittable_list light_scene() {
+    hittable_list world;
+
+    auto white = std::make_shared<lambertian>(color(0.73, 0.73, 0.73));
+    auto red = std::make_shared<lambertian>(color(0.65, 0.05, 0.05));
+    auto green = std::make_shared<lambertian>(color(0.12, 0.45, 0.15));
+
+    world.add(quad(point3(-5, -0.5, 5), vec3(10, 0, 0), vec3(0, 0, -10), white));     // floor
+    world.add(quad(point3(-5, 8, -5), vec3(10, 0, 0), vec3(0, 0, 10), white));       // ceiling
+    world.add(quad(point3(-5, -0.5, -5), vec3(10, 0, 0), vec3(0, 8.5, 0), white));   // back
+    world.add(quad(point3(-5, -0.5, 5), vec3(0, 0, -10), vec3(0, 8.5, 0), red));     // left
+    world.add(quad(point3(5, -0.5, -5), vec3(0, 0, 10), vec3(0, 8.5, 0), green));    // right
+
+    // panel facing down, just below the ceiling
+    auto panel = std::make_shared<diffuse_light>(color(12, 12, 12));
+    world.add(quad(point3(-1, 7.99, -1), vec3(2, 0, 0), vec3(0, 0, 2), panel));
+    world.add(std::make_shared<sphere>(point3(3, 0.2, 2), 0.2, std::make_shared<diffuse_light>(color(20, 12, 4))));
+
+    world.add(std::make_shared<sphere>(point3(-1.8, 1.5, -1), 2.0, std::make_shared<lambertian>(color(0.8, 0.8, 0.8))));
+    world.add(std::make_shared<sphere>(point3(2, 1, 0.5), 1.5, std::make_shared<dielectric>(1.5)));
+
+    world.commit();
+    return world;
+}
+
 void compute_pixel_color(const std::vector<std::pair<int,int>>& pixelBuffer, 
                          std::vector<std::vector<color>>& frameBuffer, 
                          const int image_width, const int image_height,
@@ -200,7 +241,10 @@ int main()
     camera cam(lookfrom, lookat, vup, 20, aspect_ratio, aperture, dist_to_focus, 0.0, 1.0);
 
     // world
+    // set_random_seed(41);   // uncomment for reproducible scenes and renders
     hittable_list world = teapot_scene();
+    // hittable_list world = light_scene();   // an interior lit by area lights, see r.background below
+    // world.add_light(std::make_shared<environment_light>("sky.pfm")); world.commit();   // light with an HDR probe
 
     renderer r;
     r.set_scene(world);
@@ -209,6 +253,12 @@ int main()
     r.max_depth(max_depth);
     r.image_dims(image_width, image_height);
     r.num_threads(-1);  // choose for me
+    // r.adaptive_sampling(32, 256, 0.02);    // uncomment to spend samples where the image is noisy
+    // r.set_sampler(std::make_shared<sobol_sampler>());     // uncomment for less noise at the same sample count
+    // r.background(color(0,0,0));      // no sky, for scenes lit by their own lights
+    // r.output_file("render.exr");      // linear HDR output instead of render.png
+    // r.tone_map(tone_operator::aces, 1.5);    // filmic PNG with a brighter exposure
+    // r.streaming_window(8);   // keep only 8 rows of tiles in memory, for renders too big to hold
 
     r.render_scene();
     /*
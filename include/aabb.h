@@ -4,6 +4,7 @@
 #include "rtweekend.h"
 #include "vec3.h"
 #include "ray.h"
+#include "ray_query.h"
 
 class aabb {
 
@@ -22,7 +23,19 @@ class aabb {
         point3 min() const { return minimum; }
         point3 max() const { return maximum; }
 
-        bool hit(const ray& r, double t_min, double t_max) const;
+        point3 center() const { return 0.5 * (minimum + maximum); }
+        vec3 diagonal() const { return maximum - minimum; }
+
+        bool hit(const ray_query& q, double t_min, double t_max) const;
+
+        /* cosine of the half-angle of the cone from p that holds the box's bounding sphere;
+           -1 (every direction) if p is inside the sphere */
+        double subtended_cos(const point3& p) const;
+
+        double surface_area() const {
+            vec3 d = maximum - minimum;
+            return 2.0 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+        }
 
     private:
         point3 minimum, maximum;
@@ -0,0 +1,78 @@
+#ifndef AFFINE_H
+#define AFFINE_H
+
+#include <memory>
+#include <vector>
+
+#include "vec3.h"
+#include "transform.h"
+
+// 3x4 affine matrix; the bottom row of the homogeneous 4x4 matrix is implicitly (0, 0, 0, 1)
+class affine {
+    public:
+        affine() : m{{1,0,0,0}, {0,1,0,0}, {0,0,1,0}} {}
+
+        /* collapse a transform chain into one matrix by pushing the origin and basis vectors through it */
+        static affine from_transforms(const std::vector<std::shared_ptr<transform>>& transforms) {
+            affine out;
+            point3 origin = transform::apply_transforms(point3(0,0,0), transforms);
+            for (int col = 0; col < 3; col++) {
+                vec3 axis(col == 0, col == 1, col == 2);
+                vec3 image = transform::apply_transforms(axis, transforms) - origin;
+                for (int row = 0; row < 3; row++) {
+                    out.m[row][col] = image[row];
+                }
+            }
+            for (int row = 0; row < 3; row++) {
+                out.m[row][3] = origin[row];
+            }
+            return out;
+        }
+
+        point3 apply_point(const point3& p) const {
+            return apply_vector(p) + point3(m[0][3], m[1][3], m[2][3]);
+        }
+
+        vec3 apply_vector(const vec3& v) const {
+            return vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+                        m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+                        m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+        }
+
+        /* multiply by the transpose of the linear part; with the inverse matrix this maps normals */
+        vec3 apply_transpose(const vec3& v) const {
+            return vec3(m[0][0] * v[0] + m[1][0] * v[1] + m[2][0] * v[2],
+                        m[0][1] * v[0] + m[1][1] * v[1] + m[2][1] * v[2],
+                        m[0][2] * v[0] + m[1][2] * v[1] + m[2][2] * v[2]);
+        }
+
+        affine inverse() const {
+            // inverse of the linear part via cofactors, then undo the translation
+            double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+                       - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+                       + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+            double inv_det = 1.0 / det;
+
+            affine out;
+            out.m[0][0] =  (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * inv_det;
+            out.m[0][1] = -(m[0][1] * m[2][2] - m[0][2] * m[2][1]) * inv_det;
+            out.m[0][2] =  (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+            out.m[1][0] = -(m[1][0] * m[2][2] - m[1][2] * m[2][0]) * inv_det;
+            out.m[1][1] =  (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+            out.m[1][2] = -(m[0][0] * m[1][2] - m[0][2] * m[1][0]) * inv_det;
+            out.m[2][0] =  (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * inv_det;
+            out.m[2][1] = -(m[0][0] * m[2][1] - m[0][1] * m[2][0]) * inv_det;
+            out.m[2][2] =  (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+
+            vec3 t = out.apply_vector(point3(m[0][3], m[1][3], m[2][3]));
+            out.m[0][3] = -t[0];
+            out.m[1][3] = -t[1];
+            out.m[2][3] = -t[2];
+            return out;
+        }
+
+    private:
+        double m[3][4];
+};
+
+#endif // AFFINE_H
@@ -0,0 +1,39 @@
+#ifndef ALIAS_TABLE_H
+#define ALIAS_TABLE_H
+
+#include <cstdint>
+#include <vector>
+
+// Discrete distribution sampled in constant time (Walker's alias method, built
+// with Vose's algorithm). Each of the n slots holds one outcome with probability
+// q and an alias for the rest, so one uniform number picks a slot and decides
+// between the two.
+class alias_table {
+    public:
+        alias_table() {}
+
+        /* weights need not be normalized; all zero (or none) gives an empty table */
+        alias_table(const std::vector<double>& weights);
+
+        /* outcome for u in [0, 1), its probability, and u's leftover randomness
+           rescaled to [0, 1) for continuous use within the outcome */
+        uint32_t sample(const double u, double& pmf, double& remapped) const;
+
+        double pmf(const uint32_t i) const {
+            return _slots[i].pmf;
+        }
+
+        size_t size() const { return _slots.size(); }
+        bool empty() const { return _slots.empty(); }
+
+    private:
+        struct slot {
+            double q;       // probability of keeping this slot's own outcome
+            double pmf;     // of this slot's own outcome
+            uint32_t alias;
+        };
+
+        std::vector<slot> _slots;
+};
+
+#endif // ALIAS_TABLE_H
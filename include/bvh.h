@@ -2,20 +2,45 @@
 #define BVH_H
 
 #include <memory>
+#include <vector>
 
 #include "hittable.h"
 #include "aabb.h"
 #include "vec3.h"
 #include "ray.h"
 
+// cost of one traversal step relative to one primitive intersection
+const double BVH_TRAVERSAL_COST = 0.125;
+
+// flattened trees store leaf sizes in 16 bits, larger max_leaf_size settings are clamped to this
+const size_t BVH_MAX_LEAF_SIZE = 0xffff;
+
+typedef enum split_method {
+    SPLIT_SAH = 0,      // binned surface area heuristic, axis chosen per node
+    SPLIT_MEDIAN        // object median along the axis of largest centroid extent
+} split_method;
+
+struct bvh_build_options {
+    split_method method = SPLIT_SAH;
+    size_t max_leaf_size = 4;       // leaves never hold more primitives than this
+    int num_bins = 16;              // centroid bins per axis for SAH
+    size_t leaf_batch_size = 1;     // primitives a leaf tests at once, e.g. 4 for triangle4 packets
+    unsigned int num_threads = 0;   // builder threads, 0 uses all hardware threads
+    size_t parallel_min_primitives = 16384;     // smaller ranges are built on a single thread
+};
+
 class bvh_node : public hittable {
     public:
         bvh_node() {}
-        
-        bvh_node(const std::vector<std::shared_ptr<hittable>>& src_objects,
-                 size_t start, size_t end);
 
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        /* builds over objects[start, end), reordering that range in place; large
+           ranges are binned and split on several threads */
+        bvh_node(std::vector<std::shared_ptr<hittable>>& objects,
+                 size_t start, size_t end,
+                 const bvh_build_options& options = bvh_build_options());
+
+        virtual bool hit(const ray_query& q, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray_query& q, double t_min, double t_max) const override;
         virtual bool create_bounding_box() override;
         virtual point3 centroid() const override;
         virtual bool commit() override { return true; }
@@ -23,13 +48,33 @@ class bvh_node : public hittable {
             return box;
         }
 
+        /* tree quality: expected cost of a random ray under the SAH, relative to this node */
+        double sah_cost() const;
+        size_t node_count() const;
+
+        /* bytes held by the nodes and leaf primitive lists, excluding allocator overhead */
+        size_t memory_bytes() const;
+
+        /* number of nodes a closest-hit query for r touches in this tree */
+        size_t nodes_visited(const ray& r, double t_min, double t_max) const;
+
         bool is_leaf;
+        int axis = 0;   // split axis of interior nodes
 
     private:
-        std::shared_ptr<hittable> left = nullptr;
-        std::shared_ptr<hittable> right = nullptr;
+        void build(std::vector<std::shared_ptr<hittable>>& objects, size_t start, size_t end,
+                   const bvh_build_options& options, const unsigned int threads);
+        double sah_cost(const double root_area) const;
+        bool count_visits(const ray_query& q, double t_min, double& t_max, hit_record& rec, size_t& visited) const;
+
+    private:
+        std::shared_ptr<bvh_node> left = nullptr;
+        std::shared_ptr<bvh_node> right = nullptr;
+        std::vector<std::shared_ptr<hittable>> primitives;     // only filled in leaves
         aabb box;
+
+    friend class linear_bvh;
 };
 
 
-#endif // BVH_H
\ No newline at end of file
+#endif // BVH_H
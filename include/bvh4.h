@@ -0,0 +1,75 @@
+#ifndef BVH4_H
+#define BVH4_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "aabb.h"
+#include "ray.h"
+
+// Up to four children per node, their bounds stored per axis so a single SIMD
+// slab test checks all of them. Children are either interior nodes or leaves;
+// leaves live inline in their parent as a range of the primitive list.
+struct alignas(64) bvh4_node {
+    float bounds_min[3][4];         // [axis][child]
+    float bounds_max[3][4];
+    uint32_t child[4];              // interior children: node index, leaves: first primitive
+    uint16_t num_primitives[4];     // 0 for interior children and empty slots
+    uint8_t num_children;
+    uint8_t pad[7];
+};
+
+static_assert(sizeof(bvh4_node) == 128, "bvh4_node should fill two cache lines");
+
+// A four-wide BVH collapsed from the binary tree bvh_node builds, taken in its
+// flattened linear_bvh form so cached trees collapse too. Children are visited
+// nearest first using the entry distances of the slab test, and subtrees that
+// start beyond the closest hit so far are skipped. Occlusion queries skip the
+// ordering and stop at the first hit.
+class bvh4 : public hittable {
+    public:
+        bvh4() {}
+        bvh4(const linear_bvh& tree);
+
+        virtual bool hit(const ray_query& q, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray_query& q, double t_min, double t_max) const override;
+        virtual bool create_bounding_box() override;
+        virtual point3 centroid() const override;
+        virtual bool commit() override { return true; }
+        virtual aabb get_bounding_box() const override {
+            return box;
+        }
+
+        size_t node_count() const { return _nodes.size(); }
+
+        /* edges from the root to the deepest four-wide node */
+        size_t depth() const { return _depth; }
+        size_t memory_bytes() const;
+        size_t nodes_visited(const ray& r, double t_min, double t_max) const;
+
+        /* leaves are handed to leaf_hits when set, nullptr restores per-primitive hit() calls */
+        void set_leaf_intersector(const leaf_intersector* leaf_hits) {
+            _leaf_intersector = leaf_hits;
+        }
+
+    private:
+        uint32_t collapse(const std::vector<linear_bvh_node>& binary, const uint32_t index, const uint32_t depth);
+        bool leaf_occluded(const uint32_t first, const uint32_t num_primitives,
+                           const ray_query& q, double t_min, double t_max) const;
+
+        /* closest hit, or with any_hit the first hit found (rec is then left untouched) */
+        template<bool any_hit>
+        bool traverse(const ray_query& q, double t_min, double t_max, hit_record& rec, size_t& visited) const;
+
+    private:
+        std::vector<bvh4_node> _nodes;
+        std::vector<std::shared_ptr<hittable>> _primitives;    // same order as the binary tree's
+        const leaf_intersector* _leaf_intersector = nullptr;
+        uint32_t _depth = 0;    // sizes the traversal stack
+        aabb box;
+};
+
+#endif // BVH4_H
@@ -18,7 +18,7 @@ class camera {
                double _time0 = 0.0,
                double _time1 = 0.0) {
 
-            auto viewport_height = 2.0 * tan(degrees_to_radians(vfov/2));
+            viewport_height = 2.0 * tan(degrees_to_radians(vfov/2));
             auto viewport_width = viewport_height * aspect_ratio;
             auto focal_length = 1.0;
 
@@ -37,6 +37,11 @@ class camera {
             time1 = _time1;
         }
 
+        /* angle between the rays through neighbouring pixels at the center of an image this many pixels high */
+        double pixel_spread_angle(const unsigned int image_height) const {
+            return std::atan(viewport_height / image_height);
+        }
+
         ray ray_at(const double s, const double t) const {
             vec3 rd = lens_radius * vec3::random_in_unit_disk();
             vec3 offset = u * rd.x() + v * rd.y();
@@ -54,6 +59,7 @@ class camera {
 
         vec3 u, v, w;
         double lens_radius;
+        double viewport_height = 0.0;     // at unit distance
 
         double time0, time1;
 };
@@ -1,11 +1,32 @@
 #ifndef COLOR_H
 #define COLOR_H
 
+#include <cstddef>
+#include <cstdint>
+
 #include "vec3.h"
 #include "rtweekend.h"
 #include <iostream>
 
-// void write_color(std::ostream &os, color pixel_color, const int samples_per_pixel);
+/* relative luminance of a linear Rec. 709 color */
+inline double luminance(const color& c) {
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
+// How linear radiance is squeezed into [0, 1] before 8-bit output. Every
+// operator works on each channel on its own, after scaling by the exposure.
+enum class tone_operator {
+    clamp,          // cut off at 1, the default
+    reinhard,       // x / (1 + x), never saturates
+    aces            // Narkowicz's fit of the ACES filmic curve
+};
+
+struct tone_mapping {
+    tone_operator op = tone_operator::clamp;
+    float exposure = 1.0f;
+};
 
+/* convert linear values to gamma 2 encoded bytes, four at a time where SSE2 is available */
+void encode_8bit(const float* linear, uint8_t* out, const size_t count, const tone_mapping& t);
 
-#endif // COLOR_H
\ No newline at end of file
+#endif // COLOR_H
@@ -0,0 +1,76 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+
+// Linear (not gamma corrected) pixel estimate and the samples behind it
+struct framebuffer_pixel {
+    float rgb[3];
+    uint32_t samples;
+};
+
+static_assert(sizeof(framebuffer_pixel) == 16, "four framebuffer pixels should fill a cache line");
+
+// Float pixels in one 64-byte aligned allocation, stored tile by tile in the
+// tile_scheduler's grid. Each tile starts on its own cache line, so threads
+// rendering neighbouring tiles never write to the same line. Rows are counted
+// from the bottom, like the camera's v coordinate.
+//
+// A framebuffer can also hold just a window of rows of tiles for renders that
+// stream their output: row of tiles k then shares its memory with rows
+// k + resident_rows, k + 2 * resident_rows and so on, and the caller makes sure
+// only one of them is in use at a time.
+class framebuffer {
+    public:
+        framebuffer() {}
+
+        /* resident_rows rows of tiles at a time, or the whole image for 0 */
+        framebuffer(const unsigned int width, const unsigned int height, const unsigned int tile_size,
+                    const unsigned int resident_rows = 0);
+
+        framebuffer(framebuffer&&) = default;
+        framebuffer& operator=(framebuffer&&) = default;
+
+        framebuffer_pixel& at(const unsigned int x, const unsigned int y) {
+            return _pixels.get()[index(x, y)];
+        }
+
+        const framebuffer_pixel& at(const unsigned int x, const unsigned int y) const {
+            return _pixels.get()[index(x, y)];
+        }
+
+        unsigned int width() const { return _width; }
+        unsigned int height() const { return _height; }
+
+        /* copy out top row first as RGB (channels == 3) or RGBA with alpha 1 (channels == 4);
+           row_stride is in floats and must hold at least width * channels */
+        bool copy_to(float* pixels, const size_t row_stride, const unsigned int channels) const;
+
+        /* the same for rows [row, row + rows) only, counted from the top */
+        bool copy_rows(const unsigned int row, const unsigned int rows, float* pixels, const size_t row_stride,
+                       const unsigned int channels) const;
+
+    private:
+        size_t index(const unsigned int x, const unsigned int y) const {
+            const size_t tile = size_t((y / _tile_size) % _resident_rows) * _tiles_x + x / _tile_size;
+            return tile * _tile_stride + (y % _tile_size) * _tile_size + x % _tile_size;
+        }
+
+        struct free_deleter {
+            void operator()(framebuffer_pixel* p) const { std::free(p); }
+        };
+
+    private:
+        unsigned int _width = 0;
+        unsigned int _height = 0;
+        unsigned int _tile_size = 1;
+        unsigned int _tiles_x = 0;
+        unsigned int _resident_rows = 1;    // rows of tiles in memory
+        size_t _tile_stride = 0;        // pixels per tile, rounded up to whole cache lines
+        std::unique_ptr<framebuffer_pixel, free_deleter> _pixels;
+};
+
+#endif // FRAMEBUFFER_H
@@ -3,17 +3,30 @@
 
 #include "vec3.h"
 #include "ray.h"
+#include "ray_query.h"
 #include "aabb.h"
 #include "rtweekend.h"
+#include "material_table.h"
+#include "light.h"
 
-class material;
+class light_list;
 
 struct hit_record {
     point3 p;
     vec3 n;
     double t = INF;
     bool front_face;    // is ray hitting outer side of surface?
-    std::shared_ptr<material> mat_ptr;
+    material_id mat_id = NO_MATERIAL;  // index into the scene's material_table
+    light_id emitter = NO_LIGHT;        // index into the scene's light_list if the surface is a sampled light
+
+    double u = 0, v = 0;        // texture coordinates
+    double uv_scale = 0;        // texture coordinate units per world unit around p, 0 without texture coordinates
+    double footprint = 0;       // width of the ray cone that hit p, in world units, set by the renderer
+
+    /* width of the footprint in texture coordinates, for choosing a texture's mip level */
+    double uv_width() const {
+        return footprint * uv_scale;
+    }
 
     inline void set_face_normal(const ray& r, const vec3& outward_normal) {
         front_face = dot(r.direction(), outward_normal) < 0;
@@ -26,7 +39,13 @@ class hittable {
     public:
 
         /* compute ray-hittable intersection */
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0; 
+        virtual bool hit(const ray_query& q, double t_min, double t_max, hit_record& rec) const = 0; 
+
+        /* is anything hit in (t_min, t_max)? stops at the first intersection found */
+        virtual bool occluded(const ray_query& q, double t_min, double t_max) const {
+            hit_record rec;
+            return hit(q, t_min, t_max, rec);
+        }
 
         /* compute bounding box */
         virtual bool create_bounding_box() = 0;
@@ -39,6 +58,13 @@ class hittable {
 
         virtual aabb get_bounding_box() const = 0;
 
+        /* register materials with the scene's table and remember their IDs */
+        virtual void bind_materials(material_table& /* table */) {}
+
+        /* add a light for every emissive surface to the scene's list and remember their IDs;
+           called after bind_materials */
+        virtual void bind_lights(light_list& /* lights */) {}
+
     private:
         aabb box;
 };
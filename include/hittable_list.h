@@ -5,6 +5,9 @@
 #include <memory>
 #include "hittable.h"
 #include "bvh.h"
+#include "linear_bvh.h"
+#include "bvh4.h"
+#include "light_list.h"
 
 class hittable_list : public hittable {
     public:
@@ -13,18 +16,32 @@ class hittable_list : public hittable {
             add(object);
         }
 
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool hit(const ray_query& q, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray_query& q, double t_min, double t_max) const override;
         void add(std::shared_ptr<hittable> object) {
             objects.push_back(object);
         }
 
-        virtual bool commit() override {
+        /* a light that is not part of any surface, such as a point_light or directional_light */
+        void add_light(std::shared_ptr<light> l) {
+            added_lights.push_back(l);
+        }
+
+        virtual bool commit() override;
+
+        virtual void bind_materials(material_table& table) override {
             for (auto& object : objects) {
-                if (!object->commit()) {
-                    return false;
-                }
+                object->bind_materials(table);
+            }
+        }
+
+        virtual void bind_lights(light_list& lights) override {
+            for (auto& l : added_lights) {
+                lights.add(l);
+            }
+            for (auto& object : objects) {
+                object->bind_lights(lights);
             }
-            return create_bounding_box() && construct_bvh();
         }
         virtual bool create_bounding_box() override;
         virtual point3 centroid() const override;
@@ -32,10 +49,38 @@ class hittable_list : public hittable {
             return box;
         }
 
+        void set_bvh_options(const bvh_build_options& options) {
+            bvh_options = options;
+        }
+
+        std::shared_ptr<linear_bvh> bvh() const {
+            return node;
+        }
+
+        /* four-wide tree collapsed from bvh(), used for tracing */
+        std::shared_ptr<bvh4> wide_bvh() const {
+            return wide;
+        }
+
+        /* materials referenced by hit_record::mat_id, filled in by commit() */
+        const material_table& materials() const {
+            return _materials;
+        }
+
+        /* lights referenced by hit_record::emitter, filled in by commit() */
+        const light_list& lights() const {
+            return _lights;
+        }
+
     private:
         aabb box;
         std::vector<std::shared_ptr<hittable>> objects;
-        std::shared_ptr<bvh_node> node = nullptr;
+        std::vector<std::shared_ptr<light>> added_lights;
+        std::shared_ptr<linear_bvh> node = nullptr;
+        std::shared_ptr<bvh4> wide = nullptr;
+        bvh_build_options bvh_options;
+        material_table _materials;
+        light_list _lights;
 
         bool construct_bvh();
 };
@@ -0,0 +1,56 @@
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "color.h"
+
+// Linear RGB floats, top row first
+struct float_image {
+    unsigned int width = 0;
+    unsigned int height = 0;
+    std::vector<float> rgb;
+
+    const float* at(const unsigned int x, const unsigned int y) const {
+        return &rgb[(size_t(y) * width + x) * 3];
+    }
+};
+
+/* Portable Float Map, color ("PF") or grayscale ("Pf"), either byte order;
+   throws std::runtime_error if the file cannot be read */
+float_image read_pfm(const std::string& filename);
+
+enum class image_format {
+    png,        // 8-bit, tone mapped and gamma encoded
+    pfm,        // linear 32-bit floats
+    exr         // linear 32-bit floats, uncompressed scanlines, readable by any OpenEXR reader
+};
+
+/* .pfm and .exr files by their extension, PNG for everything else */
+image_format image_format_for(const std::string& filename);
+
+// Writes an image a band of rows at a time, top row first, so it can be
+// encoded and written out while the rows below are still being rendered
+class image_writer {
+    public:
+        virtual ~image_writer() {}
+
+        /* the next rows of the image, width * 3 linear floats each */
+        virtual bool write_rows(const float* rgb, const unsigned int rows) = 0;
+
+        /* close the file once every row is written; false if anything failed */
+        virtual bool finish() = 0;
+};
+
+/* writer for a width x height image; PNGs go through tone, floats are written as they are.
+   nullptr if the file cannot be created */
+std::unique_ptr<image_writer> open_image_writer(const std::string& filename, const image_format format,
+                                                const unsigned int width, const unsigned int height,
+                                                const tone_mapping& tone = tone_mapping());
+
+/* the whole image at once, in the format of the file's extension */
+bool write_image(const std::string& filename, const float_image& image, const tone_mapping& tone = tone_mapping());
+
+#endif // IMAGE_IO_H
@@ -0,0 +1,182 @@
+#ifndef LIGHT_H
+#define LIGHT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "vec3.h"
+#include "aabb.h"
+#include "alias_table.h"
+#include "image_io.h"
+
+struct light_bounds;
+
+typedef uint32_t light_id;
+const light_id NO_LIGHT = 0xffffffff;
+
+/* a point on a light chosen by light::sample, as seen from the shading point */
+struct light_sample {
+    vec3 wi;            // unit direction from the shading point towards the light
+    double distance;    // to the sampled point, INF for directional lights
+    color radiance;     // arriving along -wi
+    double pdf;         // solid angle density of wi, 1 for delta lights
+};
+
+// Something next-event estimation can aim shadow rays at. Area lights are
+// created by emissive geometry when the scene is committed (see
+// hittable::bind_lights); point and directional lights are added to the scene
+// directly with hittable_list::add_light.
+class light {
+    public:
+        virtual ~light() {}
+
+        /* pick a point on the light from two uniform numbers; false if none can light p */
+        virtual bool sample(const point3& p, const double u, const double v, light_sample& s) const = 0;
+
+        /* solid angle density of sample() choosing the direction from p to point y (normal n)
+           on the light; only meaningful for lights a ray can hit */
+        virtual double pdf(const point3& /* p */, const point3& /* y */, const vec3& /* n */) const {
+            return 0.0;
+        }
+
+        /* points and directions cannot be hit by rays, only sampled */
+        virtual bool is_delta() const {
+            return false;
+        }
+
+        /* total emitted power (luminance), for choosing lights in proportion to it */
+        virtual double power() const = 0;
+
+        /* called once the scene bounds are known, before rendering */
+        virtual void preprocess(const aabb& /* scene_bounds */) {}
+
+        /* position, orientation and power for the light_bvh; false for lights without a
+           position (directional and environment lights), which are chosen beside the tree */
+        virtual bool bounds(light_bounds& /* b */) const {
+            return false;
+        }
+
+        /* lights at infinity that rays escaping the scene see, in place of the background */
+        virtual bool is_environment() const {
+            return false;
+        }
+
+        /* radiance arriving along a ray that escapes in unit direction w, for environment lights */
+        virtual color environment(const vec3& /* w */) const {
+            return color(0, 0, 0);
+        }
+};
+
+class point_light : public light {
+    public:
+        point_light(const point3& position, const color& intensity) : _position(position), _intensity(intensity) {}
+
+        virtual bool sample(const point3& p, const double u, const double v, light_sample& s) const override;
+        virtual bool is_delta() const override { return true; }
+        virtual double power() const override;
+        virtual bool bounds(light_bounds& b) const override;
+
+    private:
+        point3 _position;
+        color _intensity;   // radiant intensity, falls off with the squared distance
+};
+
+class directional_light : public light {
+    public:
+        /* light travelling along direction, e.g. (0, -1, 0) shines straight down */
+        directional_light(const vec3& direction, const color& irradiance)
+            : _direction(unit_vector(direction)), _irradiance(irradiance) {}
+
+        virtual bool sample(const point3& p, const double u, const double v, light_sample& s) const override;
+        virtual bool is_delta() const override { return true; }
+        virtual double power() const override;
+        virtual void preprocess(const aabb& scene_bounds) override;
+
+    private:
+        vec3 _direction;
+        color _irradiance;
+        double _scene_radius = 0.0;
+};
+
+// Emitting outside of a sphere, sampled uniformly over the cone of directions
+// it subtends, so every sample lands on the visible cap
+class sphere_light : public light {
+    public:
+        sphere_light(const point3& center, const double radius, const color& radiance)
+            : _center(center), _radius(std::fabs(radius)), _radiance(radiance) {}
+
+        virtual bool sample(const point3& p, const double u, const double v, light_sample& s) const override;
+        virtual double pdf(const point3& p, const point3& y, const vec3& n) const override;
+        virtual double power() const override;
+        virtual bool bounds(light_bounds& b) const override;
+
+    private:
+        point3 _center;
+        double _radius;
+        color _radiance;
+};
+
+// Emitting from the side its normal points to, sampled uniformly by area
+class triangle_light : public light {
+    public:
+        /* n picks the emitting side, the geometric normal is used by default */
+        triangle_light(const point3& v0, const point3& v1, const point3& v2, const color& radiance,
+                       const vec3& n = vec3(0, 0, 0));
+
+        virtual bool sample(const point3& p, const double u, const double v, light_sample& s) const override;
+        virtual double pdf(const point3& p, const point3& y, const vec3& n) const override;
+        virtual double power() const override;
+        virtual bool bounds(light_bounds& b) const override;
+
+    private:
+        point3 _v0, _v1, _v2;
+        vec3 _normal;       // unit, on the emitting side
+        double _area;
+        color _radiance;
+};
+
+// Radiance arriving from every direction, from an equirectangular (latitude-longitude)
+// HDR image with +y up: columns run around y starting at +x, rows from +y down
+// to -y. Directions are importance sampled from a piecewise-constant density
+// over the texels, luminance weighted by sin(theta) for the area each row covers
+// on the sphere, with alias tables for the rows and for the columns of each row,
+// so a small bright sun costs the same to find as the rest of the sky.
+class environment_light : public light {
+    public:
+        environment_light(const float_image& image, const double scale = 1.0);
+
+        /* from a .pfm file; throws std::runtime_error if it cannot be read */
+        environment_light(const std::string& pfm_file, const double scale = 1.0)
+            : environment_light(read_pfm(pfm_file), scale) {}
+
+        virtual bool sample(const point3& p, const double u, const double v, light_sample& s) const override;
+        virtual double pdf(const point3& p, const point3& y, const vec3& n) const override;
+        virtual double power() const override;
+        virtual void preprocess(const aabb& scene_bounds) override;
+        virtual bool is_environment() const override { return true; }
+        virtual color environment(const vec3& w) const override;
+
+    private:
+        /* texel a direction falls in; w need not be unit length */
+        void texel(const vec3& w, unsigned int& x, unsigned int& y) const;
+
+        /* solid angle density of sampling direction w, of any length */
+        double direction_pdf(const vec3& w) const;
+
+    private:
+        unsigned int _width, _height;
+        std::vector<color> _radiance;           // scaled texels, top row first
+        alias_table _rows;                      // marginal over rows
+        std::vector<alias_table> _columns;      // conditional over the columns of each row
+        double _mean_luminance = 0.0;           // over the sphere
+        double _scene_radius = 0.0;
+};
+
+/* MIS weight of a sample drawn with density f_pdf when g_pdf could also have produced it (Veach's power heuristic) */
+inline double power_heuristic(const double f_pdf, const double g_pdf) {
+    const double f = f_pdf * f_pdf, g = g_pdf * g_pdf;
+    return f + g > 0.0 ? f / (f + g) : 0.0;
+}
+
+#endif // LIGHT_H
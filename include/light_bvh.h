@@ -0,0 +1,74 @@
+#ifndef LIGHT_BVH_H
+#define LIGHT_BVH_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "light.h"
+#include "aabb.h"
+
+// Where a group of lights is, which way it faces and how much it emits; enough
+// to bound what the group can contribute to a shading point (Conty Estevez and
+// Kulla, "Importance Sampling of Many Lights with Adaptive Tree Splitting", 2018)
+struct light_bounds {
+    aabb box;
+    vec3 w = vec3(0, 0, 1);         // axis of the emitting normals
+    double cos_theta_o = 1.0;       // every normal lies within theta_o of w
+    double cos_theta_e = 0.0;       // and emits at most theta_e away from itself
+    double phi = 0.0;               // power
+    bool two_sided = false;
+
+    /* conservative estimate of the light arriving at p on a surface facing n; 0 only if
+       none can reach the side n faces, which is the only side any material's eval() lights */
+    double importance(const point3& p, const vec3& n) const;
+};
+
+/* bounds of two groups of lights together */
+light_bounds union_bounds(const light_bounds& a, const light_bounds& b);
+
+// Binary tree over the lights that have bounds, built with the surface area
+// orientation heuristic and stored depth first. A shading point descends it
+// choosing each child in proportion to its importance, so lights that are
+// close, bright and facing the point are picked far more often, and the noise
+// stays flat as their number grows. Lights without bounds (directional lights)
+// are chosen uniformly beside the tree.
+class light_bvh {
+    public:
+        void build(const std::vector<std::shared_ptr<light>>& lights);
+
+        /* light chosen by u in [0, 1) for a point p facing n, with the probability of choosing it */
+        const light* sample(const point3& p, const vec3& n, double u, double& pmf) const;
+
+        /* probability that sample() picks light id from p */
+        double pmf(const point3& p, const vec3& n, const light_id id) const;
+
+        size_t node_count() const { return _nodes.size(); }
+
+    private:
+        struct node {
+            light_bounds bounds;
+            uint32_t offset;    // leaves: light id, interior nodes: index of the second child
+            uint32_t parent;
+            bool leaf;
+        };
+
+        struct build_item {
+            light_id id;
+            light_bounds bounds;
+            point3 centroid;
+        };
+
+        uint32_t build(std::vector<build_item>& items, const size_t begin, const size_t end, const uint32_t parent);
+
+        /* probability of descending from an interior node to its first child */
+        double first_child_probability(const node& n, const point3& p, const vec3& normal) const;
+
+    private:
+        std::vector<node> _nodes;
+        std::vector<const light*> _lights;
+        std::vector<uint32_t> _leaf_of;         // node of each light in the tree, NO_LIGHT for the others
+        std::vector<light_id> _infinite;        // lights without bounds
+};
+
+#endif // LIGHT_BVH_H
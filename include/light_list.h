@@ -0,0 +1,72 @@
+#ifndef LIGHT_LIST_H
+#define LIGHT_LIST_H
+
+#include <memory>
+#include <vector>
+
+#include "light.h"
+#include "light_bvh.h"
+
+// Scene-owned list of lights, filled in when the scene is committed. Emissive
+// surfaces keep the ID of their light, so a path that hits one can weigh it
+// against the shadow ray that could have found the same point.
+class light_list {
+    public:
+        light_id add(std::shared_ptr<light> l) {
+            _lights.push_back(l);
+            const light_id id = static_cast<light_id>(_lights.size() - 1);
+            if (l->is_environment() && _environment == NO_LIGHT) {
+                _environment = id;
+            }
+            return id;
+        }
+
+        const light* get(const light_id id) const {
+            return id < _lights.size() ? _lights[id].get() : nullptr;
+        }
+
+        size_t size() const {
+            return _lights.size();
+        }
+
+        bool empty() const {
+            return _lights.empty();
+        }
+
+        void clear() {
+            _lights.clear();
+            _environment = NO_LIGHT;
+            _bvh = light_bvh();
+        }
+
+        /* the environment light escaping rays see, NO_LIGHT if there is none; only the
+           first one added is seen, though all are sampled */
+        light_id environment() const {
+            return _environment;
+        }
+
+        /* preprocess the lights and build the light_bvh, once all are added */
+        void commit(const aabb& scene_bounds);
+
+        /* light for shading point p with normal n, chosen by u in [0, 1) in proportion to
+           the light it can deliver there; pmf is the probability of that choice */
+        const light* sample(const point3& p, const vec3& n, const double u, double& pmf) const {
+            return _bvh.sample(p, n, u, pmf);
+        }
+
+        /* probability that sample() picks light id from p */
+        double pmf(const point3& p, const vec3& n, const light_id id) const {
+            return _bvh.pmf(p, n, id);
+        }
+
+        const light_bvh& bvh() const {
+            return _bvh;
+        }
+
+    private:
+        std::vector<std::shared_ptr<light>> _lights;
+        light_id _environment = NO_LIGHT;
+        light_bvh _bvh;
+};
+
+#endif // LIGHT_LIST_H
@@ -0,0 +1,96 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "hittable.h"
+#include "bvh.h"
+#include "aabb.h"
+#include "ray.h"
+
+struct linear_bvh_node {
+    float bounds_min[3];
+    float bounds_max[3];
+    uint32_t offset;            // leaves: first primitive, interior nodes: index of the second child
+    uint16_t num_primitives;    // 0 for interior nodes
+    uint8_t axis;               // split axis of interior nodes
+    uint8_t pad;
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node should fill half a cache line");
+
+// Intersects all primitives of a leaf in one call, e.g. from a packed copy of
+// the leaf's triangles, instead of one virtual hit() per primitive. Leaves are
+// identified by their range of the tree's primitive list.
+class leaf_intersector {
+    public:
+        virtual bool hit_leaf(const uint32_t first_primitive, const uint32_t num_primitives,
+                              const ray_query& q, double t_min, double t_max, hit_record& rec) const = 0;
+
+        /* any primitive of the leaf hit in (t_min, t_max)? */
+        virtual bool occluded_leaf(const uint32_t first_primitive, const uint32_t num_primitives,
+                                   const ray_query& q, double t_min, double t_max) const = 0;
+};
+
+// A bvh_node tree compacted into one depth-first array. The first child of an
+// interior node directly follows it, so only the second child needs an offset,
+// and the primitives of each leaf form a contiguous index range. A tree built
+// over no primitives has no nodes at all, so every leaf holds at least one.
+class linear_bvh : public hittable {
+    public:
+        linear_bvh() {}
+        linear_bvh(const bvh_node& root);
+
+        /* adopt an already flattened tree, e.g. one read back from a mesh cache */
+        linear_bvh(std::vector<linear_bvh_node>&& nodes, const std::vector<std::shared_ptr<hittable>>& primitives);
+
+        virtual bool hit(const ray_query& q, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray_query& q, double t_min, double t_max) const override;
+        virtual bool create_bounding_box() override;
+        virtual point3 centroid() const override;
+        virtual bool commit() override { return true; }
+        virtual aabb get_bounding_box() const override {
+            return box;
+        }
+
+        double sah_cost() const;
+        size_t node_count() const { return _nodes.size(); }
+
+        /* edges from the root to the deepest leaf */
+        size_t depth() const { return _depth; }
+        size_t memory_bytes() const;
+        size_t nodes_visited(const ray& r, double t_min, double t_max) const;
+
+        const std::vector<std::shared_ptr<hittable>>& primitives() const {
+            return _primitives;
+        }
+
+        const std::vector<linear_bvh_node>& nodes() const {
+            return _nodes;
+        }
+
+        /* leaves are handed to leaf_hits when set, nullptr restores per-primitive hit() calls */
+        void set_leaf_intersector(const leaf_intersector* leaf_hits) {
+            _leaf_intersector = leaf_hits;
+        }
+
+    private:
+        uint32_t flatten(const bvh_node& node);
+        void measure_depth();
+        bool leaf_occluded(const linear_bvh_node& node, const ray_query& q, double t_min, double t_max) const;
+
+        /* closest hit, or with any_hit the first hit found (rec is then left untouched) */
+        template<bool any_hit>
+        bool traverse(const ray_query& q, double t_min, double t_max, hit_record& rec, size_t& visited) const;
+
+    private:
+        std::vector<linear_bvh_node> _nodes;
+        std::vector<std::shared_ptr<hittable>> _primitives;
+        const leaf_intersector* _leaf_intersector = nullptr;
+        uint32_t _depth = 0;    // sizes the traversal stack, nothing bounds the depth of a SAH tree
+        aabb box;
+};
+
+#endif // LINEAR_BVH_H
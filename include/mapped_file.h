@@ -0,0 +1,26 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file. The mapping is released when the
+// object is destroyed; an unreadable or empty file maps to a null range.
+class mapped_file {
+    public:
+        mapped_file(const std::string& filename);
+        ~mapped_file();
+
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+        const char* data() const { return _data; }
+        size_t size() const { return _size; }
+        bool is_open() const { return _data != nullptr; }
+
+    private:
+        const char* _data = nullptr;
+        size_t _size = 0;
+};
+
+#endif // MAPPED_FILE_H
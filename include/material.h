@@ -1,15 +1,63 @@
 #ifndef MATERIAL_H
 #define MATERIAL_H
 
+#include <memory>
+
 #include "rtweekend.h"
 #include "vec3.h"
+#include "texture.h"
 
 struct hit_record;
 
 class material {
     public:
-        virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const = 0;
+        /* sample the direction of the next path segment; attenuation is BSDF * cos / density, and
+           pdf the solid angle density of the direction, 0 if it came from a specular lobe that
+           eval() and pdf() leave out (perfect mirrors and glass, or lobes with no closed-form density) */
+        virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, double& pdf) const = 0;
+
+        /* BSDF * cos towards the unit direction wi, over the lobes scatter() reports a pdf for */
+        virtual color eval(const ray& /* r_in */, const hit_record& /* rec */, const vec3& /* wi */) const {
+            return color(0,0,0);
+        }
+
+        /* solid angle density of scatter() choosing wi through those lobes */
+        virtual double pdf(const ray& /* r_in */, const hit_record& /* rec */, const vec3& /* wi */) const {
+            return 0.0;
+        }
+
+        /* radiance leaving the front face */
+        virtual color emission() const {
+            return color(0,0,0);
+        }
 
+        /* reads the hit's texture coordinates, which spheres only compute for materials that do */
+        virtual bool is_textured() const {
+            return false;
+        }
+
+        bool is_emissive() const {
+            const color e = emission();
+            return e.x() > 0 || e.y() > 0 || e.z() > 0;
+        }
+};
+
+// Emits the same radiance in every direction from its front face and reflects nothing
+class diffuse_light : public material {
+    public:
+        diffuse_light(const color& radiance) : radiance(radiance) {}
+
+        virtual bool scatter(
+            const ray& /* r_in */, const hit_record& /* rec */, color& /* attenuation */, ray& /* scattered */, double& /* pdf */) const override {
+                return false;
+            }
+
+        virtual color emission() const override {
+            return radiance;
+        }
+
+    private:
+        color radiance;
 };
 
 class glossy : public material {
@@ -17,52 +65,94 @@ class glossy : public material {
         glossy(const color& albedo, const color& specular, const float roughness, const float ps)
             : albedo(albedo), specular_color(specular), roughness(roughness), percent_specular(ps) {}
 
+        /* albedo and roughness from textures; roughness is read from the red channel, a null texture
+           leaves it at 0 */
+        glossy(std::shared_ptr<texture> albedo, const color& specular, std::shared_ptr<texture> roughness, const float ps)
+            : albedo(1, 1, 1), specular_color(specular), roughness(0), percent_specular(ps),
+              albedo_texture(albedo), roughness_texture(roughness) {}
+
         virtual bool scatter(
-            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
+            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, double& pdf) const override {
+                // the direction takes the first two draws of the bounce, which samplers pair up
+                vec3 diffuse_ray_direction = random_cosine_direction(rec.n);
                 float use_specular = random_double() < percent_specular;
 
-                vec3 diffuse_ray_direction = unit_vector(rec.n + vec3::random_in_unit_sphere());
-                if (diffuse_ray_direction.near_zero()) {
-                    diffuse_ray_direction = rec.n;
-                }
-
                 vec3 specular_ray_direction = reflect(r_in.direction(), rec.n);
-                float t = roughness * roughness;
+                float t = roughness_at(rec);
+                t *= t;
                 specular_ray_direction = unit_vector((1-t)*specular_ray_direction + t*diffuse_ray_direction);
 
-                scattered = ray(rec.p, use_specular ? specular_ray_direction : diffuse_ray_direction);
-                attenuation = use_specular ? specular_color : albedo;
+                scattered = ray(rec.p, use_specular ? specular_ray_direction : diffuse_ray_direction, r_in.time(), ray::unit_tag());
+                attenuation = use_specular ? specular_color : albedo_at(rec);
 
+                // only the diffuse lobe has a density; specular bounces count as specular
+                pdf = use_specular ? 0.0 : (1 - percent_specular) * std::fmax(0.0, dot(rec.n, diffuse_ray_direction)) / PI;
                 return true;
             }
-        
+
+        virtual color eval(const ray& /* r_in */, const hit_record& rec, const vec3& wi) const override {
+            return (1 - percent_specular) * std::fmax(0.0, dot(rec.n, wi)) / PI * albedo_at(rec);
+        }
+
+        virtual double pdf(const ray& /* r_in */, const hit_record& rec, const vec3& wi) const override {
+            return (1 - percent_specular) * std::fmax(0.0, dot(rec.n, wi)) / PI;
+        }
+
+        virtual bool is_textured() const override {
+            return albedo_texture || roughness_texture;
+        }
+
+    private:
+        color albedo_at(const hit_record& rec) const {
+            return albedo_texture ? albedo_texture->value(rec.u, rec.v, rec.uv_width()) : albedo;
+        }
+
+        float roughness_at(const hit_record& rec) const {
+            return roughness_texture ? float(roughness_texture->value(rec.u, rec.v, rec.uv_width()).x()) : roughness;
+        }
     
     private:
         color albedo;
         color specular_color;
         float roughness;
         float percent_specular;
+        std::shared_ptr<texture> albedo_texture;        // replaces albedo if set
+        std::shared_ptr<texture> roughness_texture;     // replaces roughness if set
 };
 
 class lambertian : public material {
     public:
         lambertian(const color& a) : albedo(a) {}
+        lambertian(std::shared_ptr<texture> a) : albedo(1, 1, 1), albedo_texture(a) {}
 
         virtual bool scatter(
-            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
-                auto scatter_direction = rec.n + unit_vector(vec3::random_in_unit_sphere());
-
-                if (scatter_direction.near_zero()) {
-                    scatter_direction = rec.n;
-                }
-
-                scattered = ray(rec.p, scatter_direction, r_in.time());
-                attenuation = albedo;
+            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, double& pdf) const override {
+                scattered = ray(rec.p, random_cosine_direction(rec.n), r_in.time(), ray::unit_tag());
+                attenuation = albedo_at(rec);
+                pdf = std::fmax(0.0, dot(rec.n, scattered.direction())) / PI;
                 return true;
             }
 
+        virtual color eval(const ray& /* r_in */, const hit_record& rec, const vec3& wi) const override {
+            return std::fmax(0.0, dot(rec.n, wi)) / PI * albedo_at(rec);
+        }
+
+        virtual double pdf(const ray& /* r_in */, const hit_record& rec, const vec3& wi) const override {
+            return std::fmax(0.0, dot(rec.n, wi)) / PI;
+        }
+
+        virtual bool is_textured() const override {
+            return albedo_texture != nullptr;
+        }
+
+    private:
+        color albedo_at(const hit_record& rec) const {
+            return albedo_texture ? albedo_texture->value(rec.u, rec.v, rec.uv_width()) : albedo;
+        }
+
     private:
         color albedo;
+        std::shared_ptr<texture> albedo_texture;    // replaces albedo if set
 };
 
 class metal : public material {
@@ -70,8 +160,9 @@ class metal : public material {
         metal(const color& a, double f) : albedo(a), fuzz(clamp(f, 0.0, 1.0)) {}
 
         virtual bool scatter(
-            const ray& r_in ,const hit_record& rec, color& attenuation, ray& scattered) const override {
+            const ray& r_in ,const hit_record& rec, color& attenuation, ray& scattered, double& pdf) const override {
                 vec3 scatter_direction = reflect(r_in.direction(), rec.n);
+                pdf = 0.0;
 
                 scattered = ray(rec.p, scatter_direction + fuzz*vec3::random_in_unit_sphere(), r_in.time());
                 attenuation = albedo;
@@ -88,8 +179,9 @@ class dielectric : public material {
         dielectric(double ir) : index_of_refraction(ir) {}
 
         virtual bool scatter(
-            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
+            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, double& pdf) const override {
                 attenuation = color(1.0, 1.0, 1.0);
+                pdf = 0.0;
                 double refraction_ratio = rec.front_face ? (1.0 / index_of_refraction) : index_of_refraction;
 
                 double cos_theta = fmin(dot(-r_in.direction(), rec.n), 1.0);
@@ -102,7 +194,8 @@ class dielectric : public material {
                 else 
                     direction = refract(r_in.direction(), rec.n, refraction_ratio);
 
-                scattered = ray(rec.p, direction, r_in.time());
+                // reflecting or refracting a unit direction keeps it unit length
+                scattered = ray(rec.p, direction, r_in.time(), ray::unit_tag());
                 return true;
             }
         
@@ -0,0 +1,55 @@
+#ifndef MATERIAL_TABLE_H
+#define MATERIAL_TABLE_H
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+class material;
+
+typedef uint32_t material_id;
+const material_id NO_MATERIAL = 0xffffffff;
+
+// Scene-owned list of materials. Objects hand in their shared_ptr<material>
+// once when the scene is committed and keep the returned ID, so intersection
+// only copies an integer and the reference counts are never touched while
+// rendering.
+class material_table {
+    public:
+        /* returns the ID of m, adding it on first use; a null material maps to NO_MATERIAL */
+        material_id add(const std::shared_ptr<material>& m) {
+            if (!m) {
+                return NO_MATERIAL;
+            }
+
+            auto found = _ids.find(m.get());
+            if (found != _ids.end()) {
+                return found->second;
+            }
+
+            material_id id = static_cast<material_id>(_materials.size());
+            _materials.push_back(m);
+            _ids.emplace(m.get(), id);
+            return id;
+        }
+
+        const material* get(const material_id id) const {
+            return id < _materials.size() ? _materials[id].get() : nullptr;
+        }
+
+        size_t size() const {
+            return _materials.size();
+        }
+
+        void clear() {
+            _materials.clear();
+            _ids.clear();
+        }
+
+    private:
+        std::vector<std::shared_ptr<material>> _materials;
+        std::unordered_map<const material*, material_id> _ids;
+};
+
+#endif // MATERIAL_TABLE_H
@@ -0,0 +1,30 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <memory>
+#include <string>
+
+#include "triangle_mesh.h"
+#include "material.h"
+
+// Binary mesh cache stored next to an OBJ file. The file is a fixed header
+// followed by 64-byte aligned raw arrays (vertices, normals, texture coordinates,
+// per-triangle index triples and, for untransformed meshes, the flattened BVH),
+// so loading is a single mmap plus bulk copies with no parsing.
+//
+// A cache records the size, modification time and content hash of the OBJ it
+// was made from and is rejected once the source changes.
+
+const uint32_t MESH_CACHE_VERSION = 1;
+
+/* commits the mesh and writes its geometry (and BVH, if it has no transforms) to cache_file */
+bool write_mesh_cache(const std::string& cache_file, const std::string& source_file, triangle_mesh& mesh);
+
+/* returns nullptr if the cache is missing, malformed or stale with respect to source_file */
+std::shared_ptr<triangle_mesh> load_mesh_cache(const std::string& cache_file, const std::string& source_file,
+                                               std::shared_ptr<material> mat = nullptr);
+
+/* loads "<obj_file>.rtxmesh" if it is current, otherwise parses the OBJ and refreshes the cache */
+std::shared_ptr<triangle_mesh> get_triangle_mesh_cached(const std::string& obj_file, std::shared_ptr<material> mat = nullptr);
+
+#endif // MESH_CACHE_H
@@ -0,0 +1,56 @@
+#ifndef MESH_INSTANCE_H
+#define MESH_INSTANCE_H
+
+#include <memory>
+#include <vector>
+
+#include "hittable.h"
+#include "affine.h"
+#include "transform.h"
+#include "material.h"
+
+// A placed copy of shared geometry. The bottom-level hittable (usually a
+// triangle_mesh) is built once in its own object space; every instance only
+// stores a transform and intersects by moving the ray into object space.
+class mesh_instance : public hittable {
+
+    public:
+        mesh_instance(std::shared_ptr<hittable> object,
+                      const std::vector<std::shared_ptr<transform>>& transforms,
+                      std::shared_ptr<material> m = nullptr)
+            : mesh_instance(object, affine::from_transforms(transforms), m) {}
+
+        mesh_instance(std::shared_ptr<hittable> object, const affine& object_to_world,
+                      std::shared_ptr<material> m = nullptr)
+            : _object(object), _object_to_world(object_to_world),
+              _world_to_object(object_to_world.inverse()), _mat(m) {}
+
+        virtual bool hit(const ray_query& q, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray_query& q, double t_min, double t_max) const override;
+        virtual bool create_bounding_box() override;
+        virtual point3 centroid() const override;
+        virtual bool commit() override;
+        virtual aabb get_bounding_box() const override {
+            return box;
+        }
+
+        virtual void bind_materials(material_table& table) override {
+            _object->bind_materials(table);
+            _mat_id = table.add(_mat);
+        }
+
+        /* overrides the material of the shared geometry for this instance only */
+        void set_material(const std::shared_ptr<material> other) {
+            _mat = other;
+        }
+
+    private:
+        aabb box;
+        std::shared_ptr<hittable> _object;
+        affine _object_to_world;
+        affine _world_to_object;
+        std::shared_ptr<material> _mat;
+        material_id _mat_id = NO_MATERIAL;
+};
+
+#endif // MESH_INSTANCE_H
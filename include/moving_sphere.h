@@ -11,7 +11,8 @@ class moving_sphere : public hittable {
         moving_sphere(const point3& c0, const point3& c1, const double r, std::shared_ptr<material> m, const double t0, const double t1)
             : center0(c0), center1(c1), radius(r), mat_ptr(m), time0(t0), time1(t1) {}
 
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool hit(const ray_query& q, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray_query& q, double t_min, double t_max) const override;
         virtual bool create_bounding_box() override;
         virtual point3 centroid() const override;
         virtual bool commit() override;
@@ -19,16 +20,25 @@ class moving_sphere : public hittable {
             return box;
         }
 
+        /* also decides whether hits need texture coordinates */
+        virtual void bind_materials(material_table& table) override;
+
         void set_mat_ptr(std::shared_ptr<material> m) { mat_ptr = m; }    
 
         inline point3 center(double t) const{
             return center0 + ((t - time0) / (time1 - time0)) * (center1 - center0);
         }
 
+    private:
+        /* nearest root in [t_min, t_max] against the sphere at the ray's time */
+        bool intersect(const ray& r, double t_min, double t_max, double& nearest) const;
+
     private:
         point3 center0, center1;
         double time0, time1;
         double radius; std::shared_ptr<material> mat_ptr; 
+        material_id _mat_id = NO_MATERIAL;
+        bool _textured = false;             // the material reads texture coordinates
         aabb box;
 
 };
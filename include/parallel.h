@@ -0,0 +1,40 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/* number of chunks worth splitting n items into, given at most max_threads workers */
+inline size_t parallel_chunks(const size_t n, const size_t min_chunk, unsigned int max_threads = 0) {
+    if (max_threads == 0) {
+        max_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return std::max<size_t>(1, std::min<size_t>(max_threads, n / std::max<size_t>(1, min_chunk)));
+}
+
+// Splits [0, n) into num_chunks contiguous ranges and calls body(chunk, begin, end)
+// for each, one thread per chunk. The calling thread runs the first chunk.
+template<class F>
+void parallel_for(const size_t n, const size_t num_chunks, F&& body) {
+    if (num_chunks <= 1) {
+        body(size_t(0), size_t(0), n);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(num_chunks - 1);
+    for (size_t c = 1; c < num_chunks; c++) {
+        threads.emplace_back([&body, c, n, num_chunks]() {
+            body(c, c * n / num_chunks, (c + 1) * n / num_chunks);
+        });
+    }
+    body(size_t(0), size_t(0), n / num_chunks);
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+#endif // PARALLEL_H
@@ -8,6 +8,11 @@ class ray{
         ray() {}
         ray(const point3& origin, const vec3& direction, const double time = 0.0) 
             : orig(origin), dir(unit_vector(direction)), tm(time) {}
+
+        /* for directions that are unit length already, skips the normalization */
+        struct unit_tag {};
+        ray(const point3& origin, const vec3& unit_direction, const double time, unit_tag)
+            : orig(origin), dir(unit_direction), tm(time) {}
         
         point3 origin() const { return orig; }
         vec3 direction() const { return dir; }
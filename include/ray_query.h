@@ -0,0 +1,54 @@
+#ifndef RAY_QUERY_H
+#define RAY_QUERY_H
+
+#include <cmath>
+
+#include "ray.h"
+
+// Everything intersection code derives from a ray, computed once when the ray
+// is cast instead of in every box and primitive test. Converts implicitly from
+// ray so callers can keep passing rays; code below the scene root should pass
+// the query along rather than its ray.
+struct ray_query {
+    ray r;
+
+    // slab tests
+    vec3 inv_dir;               // 1 / direction, per component
+    int dir_is_neg[3];          // sign bits of the direction
+
+    // watertight triangle test: kz is the dominant axis, the shear maps the
+    // permuted direction onto +z
+    int kx, ky, kz;
+    double sx, sy, sz;
+
+    // single precision copies for the SIMD paths
+    float origin_f[3];
+    float inv_dir_f[3];
+    float sx_f, sy_f, sz_f;
+
+    ray_query(const ray& ray_in) : r(ray_in) {
+        const point3 o = r.origin();
+        const vec3 d = r.direction();
+
+        inv_dir = vec3(1.0 / d.x(), 1.0 / d.y(), 1.0 / d.z());
+        for (int a = 0; a < 3; a++) {
+            dir_is_neg[a] = inv_dir[a] < 0;
+            origin_f[a] = static_cast<float>(o[a]);
+            inv_dir_f[a] = static_cast<float>(inv_dir[a]);
+        }
+
+        kz = std::fabs(d.y()) > std::fabs(d.x()) ? 1 : 0;
+        kz = std::fabs(d.z()) > std::fabs(d[kz]) ? 2 : kz;
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+
+        sz = 1.0 / d[kz];
+        sx = -d[kx] * sz;
+        sy = -d[ky] * sz;
+        sx_f = static_cast<float>(sx);
+        sy_f = static_cast<float>(sy);
+        sz_f = static_cast<float>(sz);
+    }
+};
+
+#endif // RAY_QUERY_H
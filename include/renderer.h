@@ -1,15 +1,72 @@
 #ifndef RENDERER_H
 #define RENDERER_H
 
+#include <string>
+#include <thread>
+#include <vector>
+
 #include "rtcore.h"
+#include "framebuffer.h"
+#include "image_io.h"
+#include "sampler.h"
+#include "tile_scheduler.h"
+
+struct band_progress;
+
+struct path_stats {
+    uint64_t paths = 0;                     // camera paths traced
+    uint64_t segments = 0;                  // ray segments traced over all paths
+    uint64_t roulette_terminations = 0;     // paths ended early by russian roulette
+    uint64_t shadow_rays = 0;               // next-event estimation rays towards lights
+    uint32_t min_pixel_samples = 0xffffffff;    // fewest and most samples any pixel took
+    uint32_t max_pixel_samples = 0;
+
+    double average_path_length() const {
+        return paths > 0 ? double(segments) / paths : 0.0;
+    }
+};
 
 class renderer {
 
     public:
-        renderer() : _nthreads(std::thread::hardware_concurrency()) {}
+        renderer() : _nthreads(std::thread::hardware_concurrency()), _seed(global_random_seed().load()) {}
 
+        /* render and write the output file (plus the sample count image, if requested) to the
+           working directory; rows of tiles are encoded and written while the rows below render */
         void render_scene();
 
+        /* render into frame() without touching disk */
+        void render();
+
+        /* render, then copy the linear float result into pixels, top row first; see framebuffer::copy_to */
+        bool render_into(float* pixels, const size_t row_stride, const unsigned int channels);
+
+        /* gamma corrected 8-bit PNG of the most recent render */
+        void write_png(const std::string& outputFile) const;
+
+        /* the most recent render in the format of the file's extension, see output_file */
+        bool write_image(const std::string& outputFile) const;
+
+        /* file render_scene writes, render.png by default; .pfm and .exr files keep the
+           linear floats, anything else is written as a PNG */
+        void output_file(const std::string& file) {
+            _output_file = file;
+        }
+
+        /* have render_scene keep only this many rows of tiles in memory: each is written out
+           as soon as it is rendered, and tiles further down wait until a row is free, so the
+           framebuffer takes rows * tile size * width pixels however tall the image is. 0 (the
+           default) keeps the whole image, which the sample count image and frame() need */
+        void streaming_window(const unsigned int rows) {
+            _streaming_rows = rows;
+        }
+
+        /* how PNG output squeezes radiance into [0, 1], after scaling it by exposure */
+        void tone_map(const tone_operator op, const double exposure = 1.0) {
+            _tone.op = op;
+            _tone.exposure = float(exposure);
+        }
+
         void set_scene(const hittable_list& scene) {
             _scene = scene;
         }
@@ -22,15 +79,96 @@ class renderer {
             _samples_per_pixel = s;
         }
 
+        /* sample each pixel until the estimated error of its displayed value drops below
+           threshold, taking at least min_spp and at most max_spp samples; replaces the fixed
+           samples_per_pixel, and a threshold of 0 turns it off again */
+        void adaptive_sampling(const unsigned int min_spp, const unsigned int max_spp, const double threshold) {
+            _min_spp = std::max(2u, min_spp);
+            _max_spp = std::max(_min_spp, max_spp);
+            _adaptive_threshold = threshold;
+        }
+
+        /* also write a grayscale image of the samples taken per pixel, white at the maximum */
+        void sample_count_image(const std::string& file) {
+            _sample_count_image = file;
+        }
+
+        /* only render pixels [x0, x1) x [y0, y1), counted from the top left; the output is
+           the size of the window and matches the same pixels of a full render */
+        void crop_window(const unsigned int x0, const unsigned int y0, const unsigned int x1, const unsigned int y1) {
+            _crop_x0 = x0;
+            _crop_y0 = y0;
+            _crop_x1 = x1;
+            _crop_y1 = y1;
+            _cropped = true;
+        }
+
+        void clear_crop_window() {
+            _cropped = false;
+        }
+
+        /* size of the rendered image, the crop window if one is set */
+        unsigned int output_width() const;
+        unsigned int output_height() const;
+
+        /* colors and sample counts of the most recent render; after a streamed render_scene
+           only the last rows are left */
+        const framebuffer& frame() const {
+            return _frame;
+        }
+
+        /* where pixel, lens, time and bounce samples come from; nullptr (the default)
+           draws everything from the independent counter-based stream */
+        void set_sampler(std::shared_ptr<sampler> s) {
+            _sampler = s;
+        }
+
+        /* radiance of rays that leave the scene, in place of the default sky gradient;
+           black for interiors lit only by the scene's lights. An environment_light in
+           the scene takes precedence over either */
+        void background(const color& c) {
+            _background = c;
+            _sky = false;
+        }
+
+        /* back to the default blue-sky gradient */
+        void sky_background() {
+            _sky = true;
+        }
+
         void max_depth(const unsigned int d) {
             _max_depth = d;
         }
 
+        /* bounce after which paths become candidates for russian roulette */
+        void russian_roulette_depth(const unsigned int d) {
+            _rr_depth = d;
+        }
+
         void image_dims(const unsigned int width, const unsigned int height) {
             _image_width = width;
             _image_height = height;
         }
 
+        /* a fixed seed gives bit-identical images regardless of thread count */
+        void seed(const uint64_t s) {
+            _seed = s;
+        }
+
+        void tile_size(const unsigned int s) {
+            _tile_size = s;
+        }
+
+        /* per-thread busy / idle time of the most recent render */
+        const std::vector<thread_stats>& thread_statistics() const {
+            return _thread_stats;
+        }
+
+        /* path length and termination counters of the most recent render */
+        const path_stats& path_statistics() const {
+            return _path_stats;
+        }
+
         void num_threads(const int t) {
             if (t < 0) {
                 _nthreads = std::thread::hardware_concurrency();
@@ -41,23 +179,51 @@ class renderer {
 
     private:
 
-        void thread_compute_pixel_colors(const std::vector<std::pair<int, int>>& perThreadPixelPos,
-                                  std::vector<std::vector<color>>& frameBuffer);
+        /* render(), reporting finished tiles to progress if there is one */
+        void render_frame(band_progress* progress);
+
+        void thread_compute_pixel_colors(const unsigned int thread_id, tile_scheduler& scheduler, band_progress* progress);
+
+        void compute_tile(const tile& t, path_stats& stats);
         
-        color ray_color(const ray& r, const hittable_list& world, const int depth);
+        color ray_color(const ray& r, const hittable_list& world, const unsigned int max_depth, path_stats& stats);
 
-        void write_color(const std::string& outputFile, const std::vector<std::vector<color>>& frameBuffer) const;
+        color background_color(const ray& r) const;
+
+        void write_sample_counts(const std::string& outputFile) const;
 
     private:
         hittable_list _scene;
         camera _cam;
         unsigned int _samples_per_pixel;
         unsigned int _max_depth;
+        unsigned int _rr_depth = 3;
         unsigned int _image_width;
         unsigned int _image_height;
-
+        unsigned int _tile_size = 16;
+        bool _sky = true;
+        color _background = color(0,0,0);
+        double _pixel_spread = 0.0;     // angle between neighbouring camera rays, for texture filtering
+
+        unsigned int _min_spp = 0;
+        unsigned int _max_spp = 0;
+        double _adaptive_threshold = 0.0;
+        std::string _sample_count_image;
+        std::string _output_file = "render.png";
+        tone_mapping _tone;
+        unsigned int _streaming_rows = 0;
+
+        bool _cropped = false;
+        unsigned int _crop_x0 = 0, _crop_y0 = 0, _crop_x1 = 0, _crop_y1 = 0;
+        unsigned int _origin_x = 0, _origin_y = 0;     // image pixel of the framebuffer's (0, 0)
+        framebuffer _frame;
+        std::shared_ptr<sampler> _sampler = nullptr;
 
         unsigned int _nthreads;
+        uint64_t _seed;
+        std::vector<thread_stats> _thread_stats;
+        std::vector<path_stats> _thread_path_stats;
+        path_stats _path_stats;
 
 };
 
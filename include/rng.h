@@ -0,0 +1,120 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+#include "sampler.h"
+
+// Counter-based random number generation. Every value is a pure function of
+// (seed, pixel, sample, bounce, draw index), so a pixel receives exactly the same
+// random numbers no matter which thread renders it or in what order. While a
+// sampler is set, the first draws of each bounce come from it instead (see sampler.h).
+
+inline uint64_t mix64(uint64_t z) {
+    // splitmix64 / murmur3-style finalizer
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+inline uint64_t hash_combine(const uint64_t h, const uint64_t v) {
+    return mix64(h ^ (mix64(v) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2)));
+}
+
+inline std::atomic<uint64_t>& global_random_seed() {
+    static std::atomic<uint64_t> seed(static_cast<uint64_t>(std::time(0)));   // truly random by default
+    return seed;
+}
+
+class counter_rng {
+    public:
+        counter_rng() { seed(global_random_seed().load()); }
+
+        /* key the stream by seed alone; used outside of rendering, e.g. for scene construction */
+        void seed(const uint64_t s) {
+            _sample_key = mix64(s);
+            start_bounce(0);
+        }
+
+        /* key the stream by a (pixel, sample) pair; bounce 0 covers the camera ray */
+        void start_pixel_sample(const uint64_t s, const uint64_t pixel_index, const uint64_t sample_index) {
+            _pixel_key = hash_combine(mix64(s), pixel_index);
+            _sample_key = hash_combine(_pixel_key, sample_index);
+            _sample_index = uint32_t(sample_index);
+            start_bounce(0);
+        }
+
+        /* draw from s (nullptr for none) for the samples of pixel (x, y) that follow */
+        void use_sampler(const sampler* s, const uint32_t x, const uint32_t y) {
+            _sampler = s;
+            _x = x;
+            _y = y;
+        }
+
+        void start_bounce(const uint64_t bounce) {
+            _key = hash_combine(_sample_key, bounce);
+            _counter = 0;
+            _dimension = _dimension_start = sampler_block_start(bounce);
+            _dimension_end = _dimension + sampler_block_size(bounce);
+        }
+
+        /* continue at dimension offset of the current bounce's block (see sampler.h), skipping
+           what the draws so far left unused; never moves backwards, and the independent stream
+           is unaffected */
+        void skip_to_dimension(const uint32_t offset) {
+            const uint32_t target = std::min(_dimension_start + offset, _dimension_end);
+            if (target <= _dimension) {
+                return;
+            }
+            _dimension = target;
+            // landing on the odd half of a pair that was never fetched
+            if (_sampler && (target & 1) && target < _dimension_end) {
+                _sampler->sample_pair(_pixel_key, _x, _y, _sample_index, target >> 1, _pair[0], _pair[1]);
+            }
+        }
+
+        uint64_t next_u64() {
+            return mix64(_key + 0x9e3779b97f4a7c15ULL * ++_counter);
+        }
+
+        double next_double() {
+            if (_sampler && _dimension < _dimension_end) {
+                // blocks start on even dimensions, so an odd one always has its pair fetched already
+                if ((_dimension++ & 1) == 0) {
+                    _sampler->sample_pair(_pixel_key, _x, _y, _sample_index, _dimension >> 1, _pair[0], _pair[1]);
+                    return _pair[0];
+                }
+                return _pair[1];
+            }
+            // top 53 bits -> double in [0,1)
+            return (next_u64() >> 11) * (1.0 / 9007199254740992.0);
+        }
+
+    private:
+        uint64_t _sample_key;
+        uint64_t _key;
+        uint64_t _counter;
+
+        const sampler* _sampler = nullptr;
+        uint64_t _pixel_key = 0;
+        uint32_t _x = 0, _y = 0;
+        uint32_t _sample_index = 0;
+        uint32_t _dimension = 0, _dimension_start = 0, _dimension_end = 0;
+        double _pair[2];                // both values of the current dimension pair
+};
+
+/* the calling thread's stream; no state is shared between threads */
+inline counter_rng& thread_rng() {
+    static thread_local counter_rng rng;
+    return rng;
+}
+
+/* fix the seed for scene construction and for any renderer created afterwards */
+inline void set_random_seed(const uint64_t s) {
+    global_random_seed().store(s);
+    thread_rng().seed(s);
+}
+
+#endif // RNG_H
@@ -8,8 +8,12 @@
 #include "moving_sphere.h"
 #include "camera.h"
 #include "material.h"
+#include "texture.h"
+#include "light.h"
 #include "bvh.h"
 #include "triangle_mesh.h"
+#include "mesh_instance.h"
+#include "mesh_cache.h"
 #include "obj_loader.h"
 #include "transform.h"
 
@@ -1,28 +1,26 @@
 #ifndef RT_WEEKEND_H
 #define RT_WEEKEND_H
 
+#include <cmath>
 #include <limits>
-#include <random>
+
+#include "rng.h"
 
 const double INF = std::numeric_limits<double>::infinity();
 const double PI = 3.14159265358979;
 const double EPS = 1e-5; 
 
-static std::mt19937 randomEngine(std::time(0));  // truly random
-// static std::mt19937 randomEngine(41);
-static std::uniform_int_distribution<int> distribution;
-static const double one_over_distribution_max = 1.0 / static_cast<double>(distribution.max());
-
 inline double degrees_to_radians(const double degrees) {
     return degrees * PI / 180.0f;
 }
 
 inline int random_int() {
-    return distribution(randomEngine);
+    // return random non-negative int
+    return static_cast<int>(thread_rng().next_u64() >> 33);
 }
 inline double random_double() {
     // return random double in [0,1)
-    return distribution(randomEngine) * one_over_distribution_max;
+    return thread_rng().next_double();
 }
 
 inline double random_double(const double min, const double max) {
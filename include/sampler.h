@@ -0,0 +1,104 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdint>
+
+// Dimension layout of one camera path. Every draw through random_double()
+// consumes the next dimension of its block; draws past the end of a block
+// (e.g. retries of rejection sampling) fall back to the counter-based stream.
+//
+//   camera ray    0-1 pixel jitter, 2-3 lens, 4 time, 5 spare
+//   bounce b >= 1 SAMPLER_CAMERA_DIMENSIONS + (b - 1) * SAMPLER_BOUNCE_DIMENSIONS, 8 each:
+//                 0-1 BSDF direction, 2 BSDF lobe, 3 spare, 4-5 point on a light,
+//                 6 light choice, 7 russian roulette
+//
+// Blocks start on even dimensions so 2D draws (lens, BSDF directions) map to one pair.
+// The renderer moves to the light and roulette offsets with counter_rng::skip_to_dimension,
+// so they stay put however many draws the material took.
+const uint32_t SAMPLER_CAMERA_DIMENSIONS = 6;
+const uint32_t SAMPLER_BOUNCE_DIMENSIONS = 8;
+const uint32_t SAMPLER_LIGHT_OFFSET = 4;
+const uint32_t SAMPLER_ROULETTE_OFFSET = 7;
+
+inline uint32_t sampler_block_start(const uint64_t bounce) {
+    return bounce == 0 ? 0 : SAMPLER_CAMERA_DIMENSIONS + uint32_t(bounce - 1) * SAMPLER_BOUNCE_DIMENSIONS;
+}
+
+inline uint32_t sampler_block_size(const uint64_t bounce) {
+    return bounce == 0 ? SAMPLER_CAMERA_DIMENSIONS : SAMPLER_BOUNCE_DIMENSIONS;
+}
+
+// Source of the sample values behind random_double() while a pixel is rendered.
+// Values are a pure function of their arguments, so renders stay reproducible
+// regardless of thread count or tile order. Dimensions are handed out in pairs,
+// which lets 2D point sets share the work of both halves.
+class sampler {
+    public:
+        virtual ~sampler() {}
+
+        /* values in [0, 1) of dimensions 2 * pair and 2 * pair + 1 for sample sample_index
+           of pixel (x, y); pixel_key mixes the render seed with the pixel index */
+        virtual void sample_pair(const uint64_t pixel_key, const uint32_t x, const uint32_t y,
+                                 const uint32_t sample_index, const uint32_t pair, double& u, double& v) const = 0;
+
+        /* a single dimension */
+        double value(const uint64_t pixel_key, const uint32_t x, const uint32_t y,
+                     const uint32_t sample_index, const uint32_t dim) const {
+            double u, v;
+            sample_pair(pixel_key, x, y, sample_index, dim >> 1, u, v);
+            return (dim & 1) ? v : u;
+        }
+};
+
+// Uncorrelated uniform values, statistically the same as rendering without a sampler
+class independent_sampler : public sampler {
+    public:
+        virtual void sample_pair(const uint64_t pixel_key, const uint32_t x, const uint32_t y,
+                                 const uint32_t sample_index, const uint32_t pair, double& u, double& v) const override;
+};
+
+// Jittered Latin hypercube: every dimension of the first samples_per_pixel samples
+// is stratified on its own, each pixel and dimension pairing strata in a different
+// random order. Later samples (e.g. from adaptive sampling) are independent.
+class stratified_sampler : public sampler {
+    public:
+        stratified_sampler(const uint32_t samples_per_pixel) : _samples(samples_per_pixel > 0 ? samples_per_pixel : 1) {}
+
+        virtual void sample_pair(const uint64_t pixel_key, const uint32_t x, const uint32_t y,
+                                 const uint32_t sample_index, const uint32_t pair, double& u, double& v) const override;
+
+    private:
+        uint32_t _samples;
+};
+
+// Owen-scrambled Sobol points with hash-based nested uniform scrambling (Burley,
+// "Practical Hash-based Owen Scrambling", 2020). Each pair of dimensions takes the
+// first two Sobol dimensions through its own index shuffle and scramble, which
+// keeps every prefix of 2^k samples stratified in 1D and 2D, for any sample count.
+class sobol_sampler : public sampler {
+    public:
+        virtual void sample_pair(const uint64_t pixel_key, const uint32_t x, const uint32_t y,
+                                 const uint32_t sample_index, const uint32_t pair, double& u, double& v) const override;
+};
+
+// The same scrambled Sobol sequence in every pixel, shifted per pixel by a
+// blue-noise mask (Cranley-Patterson rotation). Neighbouring pixels get very
+// different offsets, so the remaining error is pushed to high frequencies where
+// it is least visible, especially at low sample counts.
+class blue_noise_sampler : public sampler {
+    public:
+        /* builds the mask on first use, so that is not timed as part of a render */
+        blue_noise_sampler(const uint64_t seed = 0);
+
+        virtual void sample_pair(const uint64_t pixel_key, const uint32_t x, const uint32_t y,
+                                 const uint32_t sample_index, const uint32_t pair, double& u, double& v) const override;
+
+        /* value in [0, 1) of the tiled 64x64 void-and-cluster mask at (x, y) */
+        static float mask(const uint32_t x, const uint32_t y);
+
+    private:
+        uint64_t _seed;
+        const float* _mask;     // 64x64, row by row
+};
+
+#endif // SAMPLER_H
@@ -22,7 +22,8 @@ class sphere : public hittable {
                 create_bounding_box();
             }
 
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool hit(const ray_query& q, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray_query& q, double t_min, double t_max) const override;
         virtual bool create_bounding_box() override; 
         virtual point3 centroid() const override;
         virtual bool commit() override;
@@ -30,14 +31,26 @@ class sphere : public hittable {
             return this->box;
         }
 
+        /* also decides whether hits need texture coordinates */
+        virtual void bind_materials(material_table& table) override;
+
+        virtual void bind_lights(light_list& lights) override;
+
         void set_mat_ptr(std::shared_ptr<material> m) { mat_ptr = m; }    
 
 
+    private:
+        /* nearest root in [t_min, t_max] of the ray against a sphere around c */
+        bool intersect(const ray& r, const point3& c, double t_min, double t_max, double& nearest) const;
+
     private:
         aabb box;
         point3 center;
         double radius;
         std::shared_ptr<material> mat_ptr;
+        material_id _mat_id = NO_MATERIAL;
+        bool _textured = false;             // the material reads texture coordinates
+        light_id _light_id = NO_LIGHT;      // set while the material is emissive
         std::vector<std::shared_ptr<transform>> _transforms;
 
 };
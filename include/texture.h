@@ -0,0 +1,93 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "vec3.h"
+#include "image_io.h"
+#include "tile_cache.h"
+
+// Color over the (u, v) texture coordinates of a surface
+class texture {
+    public:
+        virtual ~texture() {}
+
+        /* color at (u, v), averaged over a footprint about width wide in texture coordinates */
+        virtual color value(const double u, const double v, const double width) const = 0;
+};
+
+class solid_color : public texture {
+    public:
+        solid_color(const color& c) : _color(c) {}
+
+        virtual color value(const double /* u */, const double /* v */, const double /* width */) const override {
+            return _color;
+        }
+
+    private:
+        color _color;
+};
+
+// Squares of two colors, n per unit of u and v; blends into their mean once
+// the footprint covers several squares
+class checker_texture : public texture {
+    public:
+        checker_texture(const color& even, const color& odd, const double n)
+            : _even(even), _odd(odd), _n(n) {}
+
+        virtual color value(const double u, const double v, const double width) const override;
+
+    private:
+        color _even, _odd;
+        double _n;
+};
+
+// Image stored as a tiled mip pyramid on disk (see write_tiled_texture) and
+// read through a tile_cache, so only the tiles and levels renders actually
+// look at are ever resident. Lookups are trilinear: bilinear within the two
+// levels whose texel size brackets the footprint, repeating at the edges.
+class image_texture : public texture, public tile_source {
+    public:
+        /* throws std::runtime_error if the file is not a tiled texture */
+        image_texture(const std::string& tiled_file, tile_cache& cache = tile_cache::shared());
+        ~image_texture();
+
+        image_texture(const image_texture&) = delete;
+        image_texture& operator=(const image_texture&) = delete;
+
+        virtual color value(const double u, const double v, const double width) const override;
+
+        virtual void load_tile(const uint32_t level, const uint32_t tx, const uint32_t ty, std::vector<float>& texels) const override;
+
+        unsigned int width() const { return _levels[0].width; }
+        unsigned int height() const { return _levels[0].height; }
+        unsigned int levels() const { return unsigned(_levels.size()); }
+
+        /* texel (x, y) of level, top row first, wrapping around */
+        color texel(const unsigned int level, const int x, const int y) const;
+
+    private:
+        color bilinear(const unsigned int level, const double u, const double v) const;
+
+    private:
+        struct level_info {
+            uint32_t width, height;
+            uint32_t tiles_x, tiles_y;
+            uint64_t offset;        // of the first tile in the file
+        };
+
+        int _fd = -1;
+        uint32_t _tile_size;
+        std::vector<level_info> _levels;
+        tile_cache& _cache;
+        uint32_t _id;
+};
+
+/* write image as a tiled mip pyramid (box-filtered down to 1x1) that image_texture reads;
+   false if the file cannot be written */
+bool write_tiled_texture(const std::string& filename, const float_image& image, const unsigned int tile_size = 64);
+
+#endif // TEXTURE_H
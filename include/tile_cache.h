@@ -0,0 +1,92 @@
+#ifndef TILE_CACHE_H
+#define TILE_CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Square block of RGB float texels from one level of a texture's mip pyramid
+struct texture_tile {
+    std::vector<float> texels;
+};
+
+// Anything that can read its tiles on demand, e.g. an image_texture's file
+class tile_source {
+    public:
+        virtual ~tile_source() {}
+
+        /* fill texels with tile (tx, ty) of mip level */
+        virtual void load_tile(const uint32_t level, const uint32_t tx, const uint32_t ty, std::vector<float>& texels) const = 0;
+};
+
+// Least-recently-used tiles of many textures within one memory budget, so a
+// scene may reference far more texture data than fits in memory. The keys are
+// spread over independently locked shards, each holding its share of the
+// budget, so render threads rarely wait on each other; on top of that every
+// thread remembers the tiles it used last and finds those without any lock.
+// Evicted tiles stay valid for threads still reading them.
+class tile_cache {
+    public:
+        explicit tile_cache(const size_t budget_bytes, const unsigned int num_shards = 16);
+
+        tile_cache(const tile_cache&) = delete;
+        tile_cache& operator=(const tile_cache&) = delete;
+
+        /* the cache image textures share unless given their own, 256 MB until set_budget() */
+        static tile_cache& shared();
+
+        /* evicts down to the new budget as tiles are next added */
+        void set_budget(const size_t bytes) {
+            _shard_budget = bytes / _shards.size();
+        }
+
+        size_t budget() const {
+            return _shard_budget * _shards.size();
+        }
+
+        /* a key for each texture that reads through the cache */
+        uint32_t new_texture_id() {
+            return _next_texture_id++;
+        }
+
+        /* tile (tx, ty) of level of a texture, read from source on a miss; valid until the calling
+           thread has made another 64 lookups, which is plenty for one filtered texture lookup */
+        const texture_tile* get(const uint32_t texture, const uint32_t level, const uint32_t tx, const uint32_t ty,
+                                const tile_source& source);
+
+        size_t resident_bytes() const;
+        uint64_t hits() const;
+        uint64_t misses() const;
+
+    private:
+        struct entry {
+            uint64_t key;
+            std::shared_ptr<const texture_tile> tile;
+            size_t bytes;
+        };
+
+        struct shard {
+            std::mutex lock;
+            std::list<entry> lru;      // most recently used first
+            std::unordered_map<uint64_t, std::list<entry>::iterator> index;
+            size_t bytes = 0;
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+        };
+
+        std::shared_ptr<const texture_tile> find_or_load(const uint64_t key, const uint32_t level, const uint32_t tx,
+                                                         const uint32_t ty, const tile_source& source);
+
+    private:
+        std::vector<std::unique_ptr<shard>> _shards;
+        size_t _shard_budget;
+        std::atomic<uint32_t> _next_texture_id{0};
+        const uint64_t _instance;     // tells this cache's tiles apart in the per-thread memo
+};
+
+#endif // TILE_CACHE_H
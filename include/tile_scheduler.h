@@ -0,0 +1,52 @@
+#ifndef TILE_SCHEDULER_H
+#define TILE_SCHEDULER_H
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct tile {
+    unsigned int x0, y0;    // first pixel column / row (inclusive)
+    unsigned int x1, y1;    // last pixel column / row (exclusive)
+};
+
+struct thread_stats {
+    double busy_seconds = 0.0;          // time spent rendering tiles
+    double idle_seconds = 0.0;          // time spent fetching work or waiting for other threads to finish
+    unsigned int tiles_rendered = 0;
+    unsigned int tiles_stolen = 0;      // tiles taken from another thread's queue
+};
+
+enum class tile_order {
+    z_curve,        // neighbouring tiles close together in time, for coherence
+    top_down        // rows of tiles from the top of the image, for output that streams as rows finish
+};
+
+class tile_scheduler {
+
+    public:
+        tile_scheduler(const unsigned int width, const unsigned int height,
+                       const unsigned int tile_size, const unsigned int nthreads,
+                       const tile_order order = tile_order::z_curve);
+
+        /* fetch the next tile for thread t, stealing from other threads once its own queue runs dry */
+        bool next_tile(const unsigned int t, tile& out, bool& stolen);
+
+        size_t num_tiles() const { return _num_tiles; }
+
+    private:
+        struct work_queue {
+            std::mutex lock;
+            std::deque<tile> tiles;
+        };
+
+        bool pop_front(work_queue& q, tile& out);
+        bool pop_back(work_queue& q, tile& out);
+
+    private:
+        std::vector<std::unique_ptr<work_queue>> _queues;
+        size_t _num_tiles = 0;
+};
+
+#endif // TILE_SCHEDULER_H
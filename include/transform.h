@@ -2,12 +2,17 @@
 #define TRANSFORM_H
 
 #include <cmath>
-#include <vec3.h>
+#include <memory>
+#include <vector>
+#include "vec3.h"
 
 class transform {
     public:
         virtual vec3 apply(const vec3& input) const = 0;
 
+        /* transform a surface normal (inverse transpose of the linear part, unnormalized) */
+        virtual vec3 apply_normal(const vec3& input) const = 0;
+
         static vec3 apply_transforms(const vec3& input, const std::vector<std::shared_ptr<transform>>& transforms) {
             vec3 out = input;
             for (auto& transform_ptr : transforms) {
@@ -15,6 +20,14 @@ class transform {
             }
             return out;
         }
+
+        static vec3 apply_normal_transforms(const vec3& input, const std::vector<std::shared_ptr<transform>>& transforms) {
+            vec3 out = input;
+            for (auto& transform_ptr : transforms) {
+                out = transform_ptr->apply_normal(out);
+            }
+            return out;
+        }
     
     protected:
         transform(const vec3& params) : _params(params) {}
@@ -30,6 +43,10 @@ class translation : public transform {
             vec3 output = input + _params;
             return output;
         }
+
+        vec3 apply_normal(const vec3& input) const override {
+            return input;
+        }
 };
 
 class scale : public transform {
@@ -41,6 +58,11 @@ class scale : public transform {
             vec3 output = input * _params;
             return output;
         }
+
+        vec3 apply_normal(const vec3& input) const override {
+            vec3 output(input[0] / _params[0], input[1] / _params[1], input[2] / _params[2]);
+            return output;
+        }
 };
 
 class rotation : public transform {
@@ -52,13 +74,18 @@ class rotation : public transform {
             vec3 output = rotateZ(rotateY(rotateX(input)));
             return output;
         }
+
+        vec3 apply_normal(const vec3& input) const override {
+            // rotations are orthonormal, so normals rotate like points
+            return apply(input);
+        }
     
     private:
         inline vec3 rotateX(const vec3& input) const {
             float thetaX = _params[0];
             vec3 output(input[0],
                         cos(thetaX) * input[1] - sin(thetaX) * input[2],
-                        sin(thetaX * input[1] + cos(thetaX) * input[2]));
+                        sin(thetaX) * input[1] + cos(thetaX) * input[2]);
             return output;
         }
 
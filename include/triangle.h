@@ -15,13 +15,22 @@ typedef enum winding {
 
 class triangle_mesh;    // forward declaration
 
+const uint32_t NO_INDEX = 0xffffffff;
+
 class triangle : public hittable {
 
     public:
 
-        triangle(const triangle_mesh* mesh, const std::vector<uint32_t>& vertex_indices, const std::vector<uint32_t>& normal_indices); 
+        /* normal and texture indices are used when there are (at least) three of them */
+        triangle(const triangle_mesh* mesh, const std::vector<uint32_t>& vertex_indices, const std::vector<uint32_t>& normal_indices,
+                 const std::vector<uint32_t>& texture_indices = std::vector<uint32_t>());
+
+        /* three vertex, normal and texture indices; a leading NO_INDEX means the face has none of that kind */
+        triangle(const triangle_mesh* mesh, const uint32_t* vertex_indices, const uint32_t* normal_indices,
+                 const uint32_t* texture_indices = nullptr);
 
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool hit(const ray_query& q, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray_query& q, double t_min, double t_max) const override;
         virtual bool create_bounding_box() override;
         virtual point3 centroid() const override;
         virtual bool commit() override;
@@ -29,6 +38,18 @@ class triangle : public hittable {
             return box;
         }
 
+    private:
+        /* watertight ray-triangle test; distance and barycentric coordinates of a hit in (t_min, t_max] */
+        bool intersect(const ray_query& q, double t_min, double t_max,
+                       double& t_hit, double& b0, double& b1, double& b2) const;
+
+        /* shading data for a hit at distance t with barycentric coordinates b0, b1, b2 */
+        void set_hit_record(const ray& r, const double t, const double b0, const double b1, const double b2,
+                            hit_record& rec) const;
+
+        /* world-space corner k (0, 1 or 2) */
+        const point3& vertex(const int k) const;
+
     private:
         
         aabb box;
@@ -37,9 +58,15 @@ class triangle : public hittable {
         point3 _centroid;
         uint32_t _vi0, _vi1, _vi2;      // vertex indices (index into parent_mesh's vertex list)
         uint32_t _ni0, _ni1, _ni2;      // normal indices (index into parent_mesh's normal list)
+        uint32_t _ti0 = NO_INDEX, _ti1 = NO_INDEX, _ti2 = NO_INDEX;     // texture coordinate indices
+        bool _has_normals;
+        light_id _light_id = NO_LIGHT;  // set by the mesh while its material is emissive
 
         winding _winding = NONE;   // enforces ordering on _v0, _v1, _v2
 
+    friend class triangle4_leaves;
+    friend class triangle_mesh;
+    friend bool write_mesh_cache(const std::string& cache_file, const std::string& source_file, triangle_mesh& mesh);
 };
 
 
@@ -0,0 +1,41 @@
+#ifndef TRIANGLE4_H
+#define TRIANGLE4_H
+
+#include <cstdint>
+#include <vector>
+
+#include "linear_bvh.h"
+#include "triangle.h"
+
+// Four triangles in structure-of-arrays layout, one per SIMD lane. Positions
+// are stored per axis so the watertight test can permute axes by picking rows.
+struct alignas(16) triangle4 {
+    float v0[3][4];             // [axis][lane]
+    float v1[3][4];
+    float v2[3][4];
+    uint32_t primitive[4];      // index into the tree's primitive list, NO_INDEX for unused lanes
+};
+
+// Packed single precision copy of the triangles in each leaf of a mesh BVH.
+// Every leaf is tested four triangles at a time with SSE (or a plain loop
+// over the lanes without SSE2), and only the nearest hit is shaded through
+// triangle::set_hit_record.
+class triangle4_leaves : public leaf_intersector {
+    public:
+        /* tree must hold triangles only; positions are taken from their world-space vertices */
+        triangle4_leaves(const linear_bvh& tree);
+
+        virtual bool hit_leaf(const uint32_t first_primitive, const uint32_t num_primitives,
+                              const ray_query& q, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool occluded_leaf(const uint32_t first_primitive, const uint32_t num_primitives,
+                                   const ray_query& q, double t_min, double t_max) const override;
+
+        size_t memory_bytes() const;
+
+    private:
+        std::vector<triangle4> _packets;
+        std::vector<uint32_t> _first_packet;           // indexed by the first primitive of each leaf
+        std::vector<const triangle*> _triangles;       // the tree's primitives, in tree order
+};
+
+#endif // TRIANGLE4_H
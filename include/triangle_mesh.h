@@ -3,8 +3,12 @@
 
 #include "triangle.h"
 #include "bvh.h"
+#include "linear_bvh.h"
+#include "bvh4.h"
+#include "triangle4.h"
 #include "transform.h"
 #include <cassert>
+#include <mutex>
 
 struct face {
     std::vector<uint32_t> vertex_indices;
@@ -12,6 +16,13 @@ struct face {
     std::vector<uint32_t> normal_indices;
 };
 
+/* flat index buffers with three entries per triangle; NO_INDEX marks a missing normal / texture index */
+struct triangle_indices {
+    std::vector<uint32_t> vertex_indices;
+    std::vector<uint32_t> texture_indices;
+    std::vector<uint32_t> normal_indices;
+};
+
 class triangle_mesh : public hittable {
 
     public:
@@ -32,8 +43,15 @@ class triangle_mesh : public hittable {
                       const std::vector<vec3>& texture_coords, 
                       const std::vector<face>& faces, 
                       std::shared_ptr<material> m);
+
+        triangle_mesh(std::vector<point3>&& vertices,
+                      std::vector<vec3>&& normals,
+                      std::vector<vec3>&& texture_coords,
+                      const triangle_indices& indices,
+                      std::shared_ptr<material> m);
         
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool hit(const ray_query& q, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray_query& q, double t_min, double t_max) const override;
         virtual point3 centroid() const override;
         virtual bool create_bounding_box() override;
         virtual bool commit() override;
@@ -41,36 +59,116 @@ class triangle_mesh : public hittable {
             return box;
         }
 
+        virtual void bind_materials(material_table& table) override {
+            _mat_id = table.add(_mat);
+        }
+
+        /* one triangle_light per triangle while the material is emissive */
+        virtual void bind_lights(light_list& lights) override;
+
         void set_material(const std::shared_ptr<material> other) {
             _mat = other;
         }
         void to_origin() {
             create_bounding_box();  // must do this before computing centroid
             point3 _centroid = centroid();
-            _transforms.push_back(std::make_shared<translation>(-_centroid));
+            push_transform(std::make_shared<translation>(-_centroid));
+        }
+
+        void set_bvh_options(const bvh_build_options& options) {
+            _bvh_options = options;
+            _cached_bvh = nullptr;  // built with whatever options the cache was written with
+            reset_bvh();
+        }
+
+        std::shared_ptr<linear_bvh> bvh() const {
+            return node;
+        }
+
+        /* four-wide tree collapsed from bvh(), used for tracing */
+        std::shared_ptr<bvh4> wide_bvh() const {
+            return _wide;
+        }
+
+        /* wall time of the most recent BVH build in commit(), 0 if the BVH came from a mesh cache */
+        double build_seconds() const {
+            return _build_seconds;
+        }
+
+        /* test BVH leaves four triangles at a time (default), or one by one with the scalar triangle::hit */
+        void set_packet_intersection(const bool enable) {
+            _packet_intersection = enable;
+            if (node) {
+                node->set_leaf_intersector(enable ? _leaves.get() : nullptr);
+                _wide->set_leaf_intersector(enable ? _leaves.get() : nullptr);
+            }
         }
 
         void push_transform(const std::shared_ptr<transform> t) {
             _transforms.push_back(t);
+            _transforms_dirty = true;
+            reset_bvh();
         }
 
         void pop_transform() {
             if (_transforms.size() > 0) {
                 _transforms.pop_back();
+                _transforms_dirty = true;
+                reset_bvh();
             }
         }
 
+    private:
+        /* the next commit() rebuilds the BVH and its leaves; trees already handed out by bvh()
+           and wide_bvh() stop using the packed leaves, which are freed here */
+        void reset_bvh() {
+            if (node) {
+                node->set_leaf_intersector(nullptr);
+            }
+            if (_wide) {
+                _wide->set_leaf_intersector(nullptr);
+            }
+            node = nullptr;
+            _wide = nullptr;
+            _leaves = nullptr;
+        }
+
+        /* apply the transform chain to every vertex and normal once */
+        void bake_transforms();
+
     private:
         aabb box;
-        std::shared_ptr<bvh_node> node = nullptr;
+        std::shared_ptr<linear_bvh> node = nullptr;
+        std::shared_ptr<bvh4> _wide = nullptr;
         std::vector<point3> _vertices;
         std::vector<vec3> _normals;
-        std::vector<vec3> _texture_coords;  // not implemented yet
+        std::vector<vec3> _texture_coords;  // (u, v) in x and y
         std::vector<std::shared_ptr<hittable>> _triangles;
         std::shared_ptr<material> _mat;
+        material_id _mat_id = NO_MATERIAL;  // shared by all triangles
         std::vector<std::shared_ptr<transform>> _transforms;
+        bvh_build_options _bvh_options;
+
+        // world-space copies of _vertices and _normals, rebuilt only when _transforms changes
+        std::vector<point3> _world_vertices;
+        std::vector<vec3> _world_normals;
+        bool _transforms_dirty = true;
+
+        // object-space BVH from a mesh cache, its primitives are _triangles in order
+        std::shared_ptr<linear_bvh> _cached_bvh = nullptr;
+
+        // SIMD copy of the BVH leaves, rebuilt with the BVH
+        std::shared_ptr<triangle4_leaves> _leaves = nullptr;
+        bool _packet_intersection = true;
+
+        // instances sharing this mesh may commit it from several threads at once
+        std::mutex _commit_mutex;
+        double _build_seconds = 0.0;
 
     friend class triangle;
+    friend bool write_mesh_cache(const std::string& cache_file, const std::string& source_file, triangle_mesh& mesh);
+    friend std::shared_ptr<triangle_mesh> load_mesh_cache(const std::string& cache_file, const std::string& source_file,
+                                                          std::shared_ptr<material> mat);
 
 };
 
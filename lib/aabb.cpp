@@ -1,14 +1,14 @@
 #include "aabb.h"
 
-bool aabb::hit(const ray& r, double t_min, double t_max) const {
+bool aabb::hit(const ray_query& q, double t_min, double t_max) const {
+    const point3 origin = q.r.origin();
     for (int i = 0; i < 3; i++) {
-        auto invD = 1.0f / r.direction()[i];
-        
-        auto t0 = std::fmin((min()[i] - r.origin()[i]) * invD, (max()[i] - r.origin()[i]) * invD);
-        auto t1 = std::max((min()[i] - r.origin()[i]) * invD, (max()[i] - r.origin()[i]) * invD);
+        // the direction's sign picks the entry plane, no min / max needed
+        double t0 = ((q.dir_is_neg[i] ? maximum[i] : minimum[i]) - origin[i]) * q.inv_dir[i];
+        double t1 = ((q.dir_is_neg[i] ? minimum[i] : maximum[i]) - origin[i]) * q.inv_dir[i];
 
-        t_min = std::max(t0, t_min);
-        t_max = std::min(t1, t_max);
+        t_min = t0 > t_min ? t0 : t_min;
+        t_max = t1 < t_max ? t1 : t_max;
 
         if (t_min >= t_max) return false;
     }
@@ -16,6 +16,15 @@ bool aabb::hit(const ray& r, double t_min, double t_max) const {
     return true;
 }
 
+double aabb::subtended_cos(const point3& p) const {
+    const double radius_squared = 0.25 * diagonal().length_squared();
+    const double distance_squared = (p - center()).length_squared();
+    if (distance_squared <= radius_squared) {
+        return -1.0;
+    }
+    return std::sqrt(std::fmax(0.0, 1.0 - radius_squared / distance_squared));
+}
+
 aabb surrounding_box(const aabb& box0, const aabb& box1) {
     point3 min(std::fmin(box0.min().x(), box1.min().x()),
                std::fmin(box0.min().y(), box1.min().y()),
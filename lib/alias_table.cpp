@@ -0,0 +1,65 @@
+#include <algorithm>
+
+#include "alias_table.h"
+
+alias_table::alias_table(const std::vector<double>& weights) {
+
+    double total = 0.0;
+    for (double w : weights) {
+        total += std::max(w, 0.0);
+    }
+    if (!(total > 0.0)) {
+        return;
+    }
+
+    const size_t n = weights.size();
+    _slots.resize(n);
+
+    // scaled so the mean is 1; slots below it get topped up by ones above
+    std::vector<double> scaled(n);
+    std::vector<uint32_t> under, over;
+    for (size_t i = 0; i < n; i++) {
+        _slots[i].pmf = std::max(weights[i], 0.0) / total;
+        scaled[i] = _slots[i].pmf * n;
+        (scaled[i] < 1.0 ? under : over).push_back(uint32_t(i));
+    }
+
+    while (!under.empty() && !over.empty()) {
+        const uint32_t small = under.back(), large = over.back();
+        under.pop_back();
+        over.pop_back();
+
+        _slots[small].q = scaled[small];
+        _slots[small].alias = large;
+
+        scaled[large] -= 1.0 - scaled[small];
+        (scaled[large] < 1.0 ? under : over).push_back(large);
+    }
+
+    // whatever is left is 1 up to rounding
+    for (uint32_t i : under) {
+        _slots[i].q = 1.0;
+        _slots[i].alias = i;
+    }
+    for (uint32_t i : over) {
+        _slots[i].q = 1.0;
+        _slots[i].alias = i;
+    }
+}
+
+uint32_t alias_table::sample(const double u, double& pmf, double& remapped) const {
+    const double one_minus_epsilon = 0x1.fffffffffffffp-1;
+    const double scaled = u * _slots.size();
+    const uint32_t i = std::min(uint32_t(scaled), uint32_t(_slots.size() - 1));
+    const double up = std::min(scaled - i, one_minus_epsilon);
+
+    const slot& s = _slots[i];
+    if (up < s.q) {
+        pmf = s.pmf;
+        remapped = std::min(up / s.q, one_minus_epsilon);
+        return i;
+    }
+    pmf = _slots[s.alias].pmf;
+    remapped = std::min((up - s.q) / (1.0 - s.q), one_minus_epsilon);
+    return s.alias;
+}
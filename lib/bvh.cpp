@@ -1,79 +1,395 @@
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
 #include "bvh.h"
+#include "parallel.h"
+
+// unpadded bounds used while binning, unlike aabb these may start out empty
+struct bin_bounds {
+    point3 lo = point3(INF, INF, INF);
+    point3 hi = point3(-INF, -INF, -INF);
+
+    void grow(const point3& pmin, const point3& pmax) {
+        for (int a = 0; a < 3; a++) {
+            lo[a] = std::fmin(lo[a], pmin[a]);
+            hi[a] = std::fmax(hi[a], pmax[a]);
+        }
+    }
+
+    double surface_area() const {
+        if (lo.x() > hi.x()) return 0.0;
+        vec3 d = hi - lo;
+        return 2.0 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+    }
+};
 
-bvh_node::bvh_node(const std::vector<std::shared_ptr<hittable>>& src_objects,
-                   size_t start, size_t end) {
+static size_t median_partition(std::vector<std::shared_ptr<hittable>>& objects,
+                               size_t start, size_t end, const int axis) {
+    size_t mid = start + (end - start) / 2;
+    std::nth_element(objects.begin() + start, objects.begin() + mid, objects.begin() + end,
+        [axis] (const std::shared_ptr<hittable>& h1, const std::shared_ptr<hittable>& h2) -> bool {
+            return h1->centroid()[axis] < h2->centroid()[axis];
+        });
+    return mid;
+}
 
-    // sort objects along desired axis
-    const int axis = 2; // x axis
-    auto comparator = [&axis] (std::shared_ptr<hittable>& h1, std::shared_ptr<hittable>& h2) -> bool {
-        return h1->centroid()[axis] < h2->centroid()[axis];
-    };
+// intersection cost of n primitives when a leaf tests them leaf_batch_size at a time
+static inline double batches(const size_t n, const bvh_build_options& options) {
+    const size_t b = std::max<size_t>(1, options.leaf_batch_size);
+    return double((n + b - 1) / b);
+}
 
-    auto objects = src_objects;
+// bins of all three axes, filled in one pass over the primitives
+struct sah_bins {
+    std::vector<bin_bounds> bins[3];
+    std::vector<size_t> counts[3];
 
-    if (!std::is_sorted(objects.begin(), objects.end(), comparator)) {
-        std::sort(objects.begin(), objects.end(), comparator);
+    sah_bins(const int nbins) {
+        for (int a = 0; a < 3; a++) {
+            bins[a].resize(nbins);
+            counts[a].resize(nbins);
+        }
+    }
+
+    void merge(const sah_bins& other) {
+        for (int a = 0; a < 3; a++) {
+            for (size_t b = 0; b < bins[a].size(); b++) {
+                bins[a][b].grow(other.bins[a][b].lo, other.bins[a][b].hi);
+                counts[a][b] += other.counts[a][b];
+            }
+        }
+    }
+};
+
+// axes whose centroids coincide, or whose bounds overflowed to inf, are left to the median fallback
+static inline bool splittable(const double extent) {
+    return extent > 0 && std::isfinite(extent);
+}
+
+// bin of a centroid coordinate, clamped so stray values (NaN, inf) still land in a valid bin
+static inline int bin_index(const double c, const double cmin, const double extent, const int nbins) {
+    const double f = nbins * (c - cmin) / extent;
+    if (!(f > 0)) return 0;
+    return f < nbins ? int(f) : nbins - 1;
+}
+
+static void fill_bins(const std::vector<std::shared_ptr<hittable>>& objects, size_t start, size_t end,
+                      const point3& cmin, const point3& cmax, sah_bins& out) {
+    const int nbins = out.bins[0].size();
+    for (size_t k = start; k < end; k++) {
+        const point3 c = objects[k]->centroid();
+        const aabb object_box = objects[k]->get_bounding_box();
+        for (int axis = 0; axis < 3; axis++) {
+            const double extent = cmax[axis] - cmin[axis];
+            if (!splittable(extent)) continue;
+
+            const int b = bin_index(c[axis], cmin[axis], extent, nbins);
+            out.bins[axis][b].grow(object_box.min(), object_box.max());
+            out.counts[axis][b]++;
+        }
+    }
+}
+
+// returns the partition point of the cheapest binned split, or start if a leaf is cheaper
+static size_t sah_partition(std::vector<std::shared_ptr<hittable>>& objects,
+                            size_t start, size_t end, const aabb& box,
+                            const point3& cmin, const point3& cmax,
+                            const bvh_build_options& options, const unsigned int threads, int& split_axis) {
+
+    const size_t n = end - start;
+    const int nbins = std::max(2, options.num_bins);
+    const double box_area = box.surface_area();
+
+    // bin every primitive once, in parallel chunks for large ranges
+    sah_bins binned(nbins);
+    const size_t num_chunks = threads > 1 ? parallel_chunks(n, options.parallel_min_primitives, threads) : 1;
+    if (num_chunks > 1) {
+        std::vector<sah_bins> chunk_bins(num_chunks, sah_bins(nbins));
+        parallel_for(n, num_chunks, [&](size_t c, size_t b, size_t e) {
+            fill_bins(objects, start + b, start + e, cmin, cmax, chunk_bins[c]);
+        });
+        for (auto& chunk : chunk_bins) {
+            binned.merge(chunk);
+        }
+    } else {
+        fill_bins(objects, start, end, cmin, cmax, binned);
+    }
+
+    std::vector<double> right_area(nbins);
+    std::vector<size_t> right_count(nbins);
+
+    double best_cost = INF;
+    int best_axis = -1, best_bin = -1;
+
+    for (int axis = 0; axis < 3; axis++) {
+        const double extent = cmax[axis] - cmin[axis];
+        if (!splittable(extent)) continue;
+
+        const std::vector<bin_bounds>& bins = binned.bins[axis];
+        const std::vector<size_t>& counts = binned.counts[axis];
+
+        // sweep from the right to get the cost of everything above each split plane
+        bin_bounds accum;
+        size_t count = 0;
+        for (int b = nbins - 1; b > 0; b--) {
+            accum.grow(bins[b].lo, bins[b].hi);
+            count += counts[b];
+            right_area[b] = accum.surface_area();
+            right_count[b] = count;
+        }
+
+        // then sweep from the left, splitting between bin b-1 and bin b
+        accum = bin_bounds();
+        count = 0;
+        for (int b = 1; b < nbins; b++) {
+            accum.grow(bins[b-1].lo, bins[b-1].hi);
+            count += counts[b-1];
+            if (count == 0 || right_count[b] == 0) continue;
+
+            double cost = BVH_TRAVERSAL_COST
+                        + (batches(count, options) * accum.surface_area()
+                           + batches(right_count[b], options) * right_area[b]) / box_area;
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = b;
+            }
+        }
+    }
+
+    if (best_axis < 0) {
+        // every centroid coincides or their bounds are not finite, binning cannot separate anything
+        split_axis = 0;
+        if (n <= options.max_leaf_size) return start;
+        return median_partition(objects, start, end, 0);
+    }
+
+    if (n <= options.max_leaf_size && batches(n, options) <= best_cost) {
+        return start;
+    }
+
+    split_axis = best_axis;
+    const double extent = cmax[best_axis] - cmin[best_axis];
+    auto split = std::partition(objects.begin() + start, objects.begin() + end,
+        [&] (const std::shared_ptr<hittable>& h) -> bool {
+            return bin_index(h->centroid()[best_axis], cmin[best_axis], extent, nbins) < best_bin;
+        });
+
+    size_t mid = split - objects.begin();
+    if (mid == start || mid == end) {
+        return median_partition(objects, start, end, best_axis);
+    }
+    return mid;
+}
+
+// bounds of the primitives and of their centroids over [start, end)
+static void range_bounds(const std::vector<std::shared_ptr<hittable>>& objects, size_t start, size_t end,
+                         bin_bounds& bounds, point3& cmin, point3& cmax) {
+    for (size_t k = start; k < end; k++) {
+        const aabb object_box = objects[k]->get_bounding_box();
+        bounds.grow(object_box.min(), object_box.max());
+
+        point3 c = objects[k]->centroid();
+        for (int a = 0; a < 3; a++) {
+            cmin[a] = std::fmin(cmin[a], c[a]);
+            cmax[a] = std::fmax(cmax[a], c[a]);
+        }
+    }
+}
+
+bvh_node::bvh_node(std::vector<std::shared_ptr<hittable>>& objects,
+                   size_t start, size_t end, const bvh_build_options& options) {
+    unsigned int threads = options.num_threads > 0 ? options.num_threads : std::thread::hardware_concurrency();
+    bvh_build_options clamped = options;
+    clamped.max_leaf_size = std::min(options.max_leaf_size, BVH_MAX_LEAF_SIZE);
+    build(objects, start, end, clamped, std::max(1u, threads));
+}
+
+void bvh_node::build(std::vector<std::shared_ptr<hittable>>& objects, size_t start, size_t end,
+                     const bvh_build_options& options, const unsigned int threads) {
+
+    const size_t n = end - start;
+    const bool parallel = threads > 1 && n >= options.parallel_min_primitives;
+
+    // bounds of the primitives and of their centroids
+    bin_bounds bounds;
+    point3 cmin(INF, INF, INF), cmax(-INF, -INF, -INF);
+    const size_t num_chunks = parallel ? parallel_chunks(n, options.parallel_min_primitives, threads) : 1;
+    if (num_chunks > 1) {
+        std::vector<bin_bounds> chunk_bounds(num_chunks), chunk_centroids(num_chunks);
+        parallel_for(n, num_chunks, [&](size_t c, size_t b, size_t e) {
+            range_bounds(objects, start + b, start + e, chunk_bounds[c], chunk_centroids[c].lo, chunk_centroids[c].hi);
+        });
+        for (size_t c = 0; c < num_chunks; c++) {
+            bounds.grow(chunk_bounds[c].lo, chunk_bounds[c].hi);
+            for (int a = 0; a < 3; a++) {
+                cmin[a] = std::fmin(cmin[a], chunk_centroids[c].lo[a]);
+                cmax[a] = std::fmax(cmax[a], chunk_centroids[c].hi[a]);
+            }
+        }
+    } else {
+        range_bounds(objects, start, end, bounds, cmin, cmax);
+    }
+    box = aabb(bounds.lo, bounds.hi);
+
+    // pick a split
+    size_t mid = start;
+    if (n > 1) {
+        if (options.method == SPLIT_SAH) {
+            mid = sah_partition(objects, start, end, box, cmin, cmax, options, parallel ? threads : 1, axis);
+        } else if (n > options.max_leaf_size) {
+            vec3 extent = cmax - cmin;
+            axis = (extent.x() > extent.y() && extent.x() > extent.z()) ? 0 : (extent.y() > extent.z() ? 1 : 2);
+            mid = median_partition(objects, start, end, axis);
+        }
     }
 
     // divide objects between left and right children
-    if (end - start == 1) {
-        left = src_objects[start];
-        is_leaf = true;
-    } else if (end - start == 2) {
-        left = src_objects[start];
-        right = src_objects[start+1];
+    if (mid == start) {
+        primitives.assign(objects.begin() + start, objects.begin() + end);
         is_leaf = true;
     } else {
-                            
-        size_t midpoint = start + (end - start) / 2;
-        left = std::make_shared<bvh_node>(src_objects, start, midpoint);
-        right = std::make_shared<bvh_node>(src_objects, midpoint, end);
+        left = std::make_shared<bvh_node>();
+        right = std::make_shared<bvh_node>();
         is_leaf = false;
+
+        // the halves are disjoint ranges of objects, so they can be built concurrently
+        if (parallel) {
+            const unsigned int left_threads = threads / 2;
+            std::thread left_builder([&]() {
+                left->build(objects, start, mid, options, left_threads);
+            });
+            right->build(objects, mid, end, options, threads - left_threads);
+            left_builder.join();
+        } else {
+            left->build(objects, start, mid, options, 1);
+            right->build(objects, mid, end, options, 1);
+        }
     }
 
     // initialize bounding box
     create_bounding_box();
 }
 
-bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool bvh_node::hit(const ray_query& q, double t_min, double t_max, hit_record& rec) const {
 
-    if (!box.hit(r, t_min, t_max)) {
+    if (!box.hit(q, t_min, t_max)) {
         return false;
-    } 
+    }
 
     bool hit_anything = false;
-    if (left) {
-        hit_anything |= left->hit(r, t_min, t_max, rec);
-        if (hit_anything) {
-            t_max = rec.t;
+    if (is_leaf) {
+        for (auto& object : primitives) {
+            if (object->hit(q, t_min, t_max, rec)) {
+                hit_anything = true;
+                t_max = rec.t;
+            }
         }
+        return hit_anything;
     }
 
-    if (right) {
-        hit_anything |= right->hit(r, t_min, t_max, rec);
+    // visit the child on the near side of the split first, so the far one is
+    // tested against a shorter interval
+    const bvh_node* near_child = q.dir_is_neg[axis] ? right.get() : left.get();
+    const bvh_node* far_child = q.dir_is_neg[axis] ? left.get() : right.get();
+
+    hit_anything |= near_child->hit(q, t_min, t_max, rec);
+    if (hit_anything) {
+        t_max = rec.t;
     }
+
+    hit_anything |= far_child->hit(q, t_min, t_max, rec);
     return hit_anything;
 }
 
+bool bvh_node::occluded(const ray_query& q, double t_min, double t_max) const {
+
+    if (!box.hit(q, t_min, t_max)) {
+        return false;
+    }
+
+    if (is_leaf) {
+        for (auto& object : primitives) {
+            if (object->occluded(q, t_min, t_max)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    return left->occluded(q, t_min, t_max) || right->occluded(q, t_min, t_max);
+}
+
 point3 bvh_node::centroid() const {
     return (box.min() + box.max()) / 2;
 }
 
 bool bvh_node::create_bounding_box() {
     if (is_leaf) {
-        if (left && right) {
-            aabb left_box, right_box;
-            left_box = left->get_bounding_box();
-            right_box = right->get_bounding_box();
-            this->box = surrounding_box(left_box, right_box);
-        } else if (left) {
-            this->box = left->get_bounding_box();
+        for (size_t k = 0; k < primitives.size(); k++) {
+            aabb object_box = primitives[k]->get_bounding_box();
+            this->box = (k == 0) ? object_box : surrounding_box(this->box, object_box);
         }
-        return true;
+        return !primitives.empty();
     }
 
     aabb left_box = left->get_bounding_box();
     aabb right_box = right->get_bounding_box();
     this->box = surrounding_box(left_box, right_box);
     return true;
-}
\ No newline at end of file
+}
+
+double bvh_node::sah_cost() const {
+    return sah_cost(box.surface_area());
+}
+
+double bvh_node::sah_cost(const double root_area) const {
+    double p = box.surface_area() / root_area;   // probability that a random ray through the root hits this node
+    if (is_leaf) {
+        return p * primitives.size();
+    }
+    return p * BVH_TRAVERSAL_COST + left->sah_cost(root_area) + right->sah_cost(root_area);
+}
+
+size_t bvh_node::node_count() const {
+    return is_leaf ? 1 : 1 + left->node_count() + right->node_count();
+}
+
+size_t bvh_node::memory_bytes() const {
+    size_t bytes = sizeof(bvh_node) + primitives.capacity() * sizeof(std::shared_ptr<hittable>);
+    return is_leaf ? bytes : bytes + left->memory_bytes() + right->memory_bytes();
+}
+
+size_t bvh_node::nodes_visited(const ray& r, double t_min, double t_max) const {
+    hit_record rec;
+    size_t visited = 0;
+    count_visits(r, t_min, t_max, rec, visited);
+    return visited;
+}
+
+bool bvh_node::count_visits(const ray_query& q, double t_min, double& t_max, hit_record& rec, size_t& visited) const {
+
+    // mirrors hit(), but shrinks the caller's t_max so pruning matches a real query
+    visited++;
+    if (!box.hit(q, t_min, t_max)) {
+        return false;
+    }
+
+    bool hit_anything = false;
+    if (is_leaf) {
+        for (auto& object : primitives) {
+            if (object->hit(q, t_min, t_max, rec)) {
+                hit_anything = true;
+                t_max = rec.t;
+            }
+        }
+        return hit_anything;
+    }
+
+    const bvh_node* near_child = q.dir_is_neg[axis] ? right.get() : left.get();
+    const bvh_node* far_child = q.dir_is_neg[axis] ? left.get() : right.get();
+    hit_anything |= near_child->count_visits(q, t_min, t_max, rec, visited);
+    hit_anything |= far_child->count_visits(q, t_min, t_max, rec, visited);
+    return hit_anything;
+}
@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <limits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "bvh4.h"
+
+// pending child: an interior node (num_primitives == 0) or a leaf, with its entry distance
+struct bvh4_entry {
+    uint32_t child;
+    uint32_t num_primitives;
+    float t;
+};
+
+// float rounding of the slab distances can lose a grazing hit, so the exit
+// distance is pushed out by a few ulps (see PBRT, "Robust ray-bounds intersections")
+static const float slab_exit_scale = 1.0f + 4.0f * std::numeric_limits<float>::epsilon();
+
+static inline float node_area(const linear_bvh_node& node) {
+    float dx = node.bounds_max[0] - node.bounds_min[0];
+    float dy = node.bounds_max[1] - node.bounds_min[1];
+    float dz = node.bounds_max[2] - node.bounds_min[2];
+    return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+bvh4::bvh4(const linear_bvh& tree) : _primitives(tree.primitives()), box(tree.get_bounding_box()) {
+    // a tree over no primitives has no nodes, and neither has its collapsed copy
+    const std::vector<linear_bvh_node>& binary = tree.nodes();
+    if (binary.empty()) {
+        return;
+    }
+
+    _nodes.reserve(binary.size() / 2 + 1);
+    collapse(binary, 0, 0);
+}
+
+uint32_t bvh4::collapse(const std::vector<linear_bvh_node>& binary, const uint32_t index, const uint32_t depth) {
+    const uint32_t node_index = _nodes.size();
+    _nodes.emplace_back();
+    _depth = std::max(_depth, depth);
+
+    // pull grandchildren up into this node, always opening the largest interior child
+    std::vector<uint32_t> children;
+    if (binary[index].num_primitives > 0) {
+        children.push_back(index);      // a single leaf at the root
+    } else {
+        children = { index + 1, binary[index].offset };
+    }
+
+    while (children.size() < 4) {
+        int largest = -1;
+        float largest_area = -1.0f;
+        for (size_t k = 0; k < children.size(); k++) {
+            const linear_bvh_node& c = binary[children[k]];
+            if (c.num_primitives == 0 && node_area(c) > largest_area) {
+                largest = k;
+                largest_area = node_area(c);
+            }
+        }
+        if (largest < 0) {
+            break;
+        }
+
+        const uint32_t opened = children[largest];
+        children[largest] = opened + 1;
+        children.push_back(binary[opened].offset);
+    }
+
+    // recurse before filling in, since emplace_back may move this node
+    uint32_t child_index[4];
+    for (size_t k = 0; k < children.size(); k++) {
+        const linear_bvh_node& c = binary[children[k]];
+        child_index[k] = c.num_primitives > 0 ? c.offset : collapse(binary, children[k], depth + 1);
+    }
+
+    bvh4_node& node = _nodes[node_index];
+    node.num_children = children.size();
+    for (int k = 0; k < 4; k++) {
+        if (k < (int)children.size()) {
+            const linear_bvh_node& c = binary[children[k]];
+            for (int a = 0; a < 3; a++) {
+                node.bounds_min[a][k] = c.bounds_min[a];
+                node.bounds_max[a][k] = c.bounds_max[a];
+            }
+            node.child[k] = child_index[k];
+            node.num_primitives[k] = c.num_primitives;
+        } else {
+            // empty slots have inverted bounds and never pass the slab test
+            for (int a = 0; a < 3; a++) {
+                node.bounds_min[a][k] = std::numeric_limits<float>::infinity();
+                node.bounds_max[a][k] = -std::numeric_limits<float>::infinity();
+            }
+            node.child[k] = 0;
+            node.num_primitives[k] = 0;
+        }
+    }
+    std::fill(std::begin(node.pad), std::end(node.pad), 0);
+    return node_index;
+}
+
+template<bool any_hit>
+bool bvh4::traverse(const ray_query& q, double t_min, double t_max, hit_record& rec, size_t& visited) const {
+
+    if (_nodes.empty()) {
+        return false;
+    }
+
+    const float* origin = q.origin_f;
+    const float* inv_dir = q.inv_dir_f;
+    const int* near_is_max = q.dir_is_neg;
+
+#if defined(__SSE2__)
+    const __m128 ox = _mm_set1_ps(origin[0]), oy = _mm_set1_ps(origin[1]), oz = _mm_set1_ps(origin[2]);
+    const __m128 ix = _mm_set1_ps(inv_dir[0]), iy = _mm_set1_ps(inv_dir[1]), iz = _mm_set1_ps(inv_dir[2]);
+    const __m128 exit_scale = _mm_set1_ps(slab_exit_scale);
+#endif
+
+    // each level pops one entry and pushes up to four, so 3 * depth + 4 entries are enough;
+    // deeper trees than the fixed stack covers spill to the heap
+    bvh4_entry local_stack[256];
+    std::vector<bvh4_entry> deep_stack;
+    bvh4_entry* stack = local_stack;
+    const size_t stack_capacity = 3 * size_t(_depth) + 4;
+    if (stack_capacity > 256) {
+        deep_stack.resize(stack_capacity);
+        stack = deep_stack.data();
+    }
+    int stack_size = 0;
+    stack[stack_size++] = { 0, 0, static_cast<float>(t_min) };
+    bool hit_anything = false;
+
+    while (stack_size > 0) {
+        const bvh4_entry entry = stack[--stack_size];
+        if (entry.t > t_max) {
+            continue;   // starts behind the closest hit found since it was pushed
+        }
+
+        if (entry.num_primitives > 0) {
+            if (any_hit) {
+                if (leaf_occluded(entry.child, entry.num_primitives, q, t_min, t_max)) {
+                    return true;
+                }
+            } else if (_leaf_intersector) {
+                if (_leaf_intersector->hit_leaf(entry.child, entry.num_primitives, q, t_min, t_max, rec)) {
+                    hit_anything = true;
+                    t_max = rec.t;
+                }
+            } else {
+                for (uint32_t k = entry.child; k < entry.child + entry.num_primitives; k++) {
+                    if (_primitives[k]->hit(q, t_min, t_max, rec)) {
+                        hit_anything = true;
+                        t_max = rec.t;
+                    }
+                }
+            }
+            continue;
+        }
+
+        const bvh4_node& node = _nodes[entry.child];
+        visited++;
+
+        // slab test against all four children at once
+        alignas(16) float t_enter[4];
+        int mask;
+#if defined(__SSE2__)
+        const __m128 near_x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_is_max[0] ? node.bounds_max[0] : node.bounds_min[0]), ox), ix);
+        const __m128 near_y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_is_max[1] ? node.bounds_max[1] : node.bounds_min[1]), oy), iy);
+        const __m128 near_z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_is_max[2] ? node.bounds_max[2] : node.bounds_min[2]), oz), iz);
+        const __m128 far_x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_is_max[0] ? node.bounds_min[0] : node.bounds_max[0]), ox), ix);
+        const __m128 far_y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_is_max[1] ? node.bounds_min[1] : node.bounds_max[1]), oy), iy);
+        const __m128 far_z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_is_max[2] ? node.bounds_min[2] : node.bounds_max[2]), oz), iz);
+
+        const __m128 enter = _mm_max_ps(_mm_max_ps(near_x, near_y), _mm_max_ps(near_z, _mm_set1_ps(t_min)));
+        const __m128 exit = _mm_mul_ps(_mm_min_ps(_mm_min_ps(far_x, far_y), _mm_min_ps(far_z, _mm_set1_ps(t_max))), exit_scale);
+        mask = _mm_movemask_ps(_mm_cmple_ps(enter, exit));
+        _mm_store_ps(t_enter, enter);
+#else
+        mask = 0;
+        for (int k = 0; k < 4; k++) {
+            float enter = static_cast<float>(t_min), exit = static_cast<float>(t_max);
+            for (int a = 0; a < 3; a++) {
+                float t0 = ((near_is_max[a] ? node.bounds_max[a][k] : node.bounds_min[a][k]) - origin[a]) * inv_dir[a];
+                float t1 = ((near_is_max[a] ? node.bounds_min[a][k] : node.bounds_max[a][k]) - origin[a]) * inv_dir[a];
+                enter = t0 > enter ? t0 : enter;
+                exit = t1 < exit ? t1 : exit;
+            }
+            t_enter[k] = enter;
+            mask |= (enter <= exit * slab_exit_scale) << k;
+        }
+#endif
+        mask &= (1 << node.num_children) - 1;
+
+        if (any_hit) {
+            // any hit ends the query, so the order children are visited in does not matter
+            for (int k = 0; k < 4; k++) {
+                if (mask & (1 << k)) {
+                    stack[stack_size++] = { node.child[k], node.num_primitives[k], t_enter[k] };
+                }
+            }
+            continue;
+        }
+
+        // push hit children farthest first so the nearest is popped next
+        bvh4_entry hits[4];
+        int num_hits = 0;
+        for (int k = 0; k < 4; k++) {
+            if (mask & (1 << k)) {
+                bvh4_entry e = { node.child[k], node.num_primitives[k], t_enter[k] };
+                int pos = num_hits++;
+                while (pos > 0 && hits[pos-1].t < e.t) {
+                    hits[pos] = hits[pos-1];
+                    pos--;
+                }
+                hits[pos] = e;
+            }
+        }
+        for (int k = 0; k < num_hits; k++) {
+            stack[stack_size++] = hits[k];
+        }
+    }
+
+    return hit_anything;
+}
+
+bool bvh4::hit(const ray_query& q, double t_min, double t_max, hit_record& rec) const {
+    size_t visited = 0;
+    return traverse<false>(q, t_min, t_max, rec, visited);
+}
+
+bool bvh4::occluded(const ray_query& q, double t_min, double t_max) const {
+    hit_record rec;
+    size_t visited = 0;
+    return traverse<true>(q, t_min, t_max, rec, visited);
+}
+
+bool bvh4::leaf_occluded(const uint32_t first, const uint32_t num_primitives,
+                         const ray_query& q, double t_min, double t_max) const {
+    if (_leaf_intersector) {
+        return _leaf_intersector->occluded_leaf(first, num_primitives, q, t_min, t_max);
+    }
+    for (uint32_t k = first; k < first + num_primitives; k++) {
+        if (_primitives[k]->occluded(q, t_min, t_max)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool bvh4::create_bounding_box() {
+    return !_nodes.empty();
+}
+
+point3 bvh4::centroid() const {
+    return (box.min() + box.max()) / 2;
+}
+
+size_t bvh4::memory_bytes() const {
+    return sizeof(bvh4) + _nodes.capacity() * sizeof(bvh4_node)
+         + _primitives.capacity() * sizeof(std::shared_ptr<hittable>);
+}
+
+size_t bvh4::nodes_visited(const ray& r, double t_min, double t_max) const {
+    hit_record rec;
+    size_t visited = 0;
+    traverse<false>(r, t_min, t_max, rec, visited);
+    return visited;
+}
@@ -1,18 +1,75 @@
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "color.h"
 
-/*void write_color(const std::string& outputFile, const std::vector<std::vector<color>>& frameBuffer, const int samples_per_pixel) {
-    
-    auto r = pixel_color.x();
-    auto g = pixel_color.y();
-    auto b = pixel_color.z();
-
-    auto scale = 1.0 / samples_per_pixel;
-    r = std::sqrt(r * scale); 
-    g = std::sqrt(g * scale);
-    b = std::sqrt(b * scale);
-
-    os << static_cast<int>(255.999 * clamp(r, 0.0, 0.999)) << ' '
-      << static_cast<int>(255.999 * clamp(g, 0.0, 0.999)) << ' '
-      << static_cast<int>(255.999 * clamp(b, 0.0, 0.999)) << '\n';
-}*/
\ No newline at end of file
+/* one value through the tone curve, gamma 2 and quantization, as the SSE2 path below does four at a time */
+static inline uint8_t encode_scalar(float x, const tone_mapping& t) {
+    x *= t.exposure;
+
+    // the curves have poles below zero and turn infinities into NaNs
+    if (t.op != tone_operator::clamp) {
+        x = x > 0.0f ? x : 0.0f;
+        x = x < 1e9f ? x : 1e9f;
+    }
+    if (t.op == tone_operator::reinhard) {
+        x = x / (1.0f + x);
+    } else if (t.op == tone_operator::aces) {
+        x = (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+    }
+
+    // negative values and NaNs go to black
+    float s = std::sqrt(x);
+    s = s > 0.0f ? s : 0.0f;
+    s = s < 0.999f ? s : 0.999f;
+    return uint8_t(int(255.99 * s));
+}
+
+void encode_8bit(const float* linear, uint8_t* out, const size_t count, const tone_mapping& t) {
+    size_t k = 0;
+
+#if defined(__SSE2__)
+    const __m128 exposure = _mm_set1_ps(t.exposure);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 top = _mm_set1_ps(0.999f);
+    const __m128 largest = _mm_set1_ps(1e9f);
+    const __m128d scale = _mm_set1_pd(255.99);
+
+    for (; k + 4 <= count; k += 4) {
+        __m128 x = _mm_mul_ps(_mm_loadu_ps(linear + k), exposure);
+        if (t.op != tone_operator::clamp) {
+            x = _mm_min_ps(_mm_max_ps(x, zero), largest);
+        }
+        if (t.op == tone_operator::reinhard) {
+            x = _mm_div_ps(x, _mm_add_ps(one, x));
+        } else if (t.op == tone_operator::aces) {
+            const __m128 n = _mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), x), _mm_set1_ps(0.03f)));
+            const __m128 d = _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), x), _mm_set1_ps(0.59f))),
+                                        _mm_set1_ps(0.14f));
+            x = _mm_div_ps(n, d);
+        }
+
+        // max returns its second operand for NaNs, so they become 0 like in encode_scalar
+        const __m128 s = _mm_min_ps(_mm_max_ps(_mm_sqrt_ps(x), zero), top);
+
+        // scaled in double precision, as the scalar path does
+        const __m128i lo = _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtps_pd(s), scale));
+        const __m128i hi = _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(s, s)), scale));
+        const __m128i v = _mm_unpacklo_epi64(lo, hi);
+        const __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(v, v), v);
+        const int packed = _mm_cvtsi128_si32(bytes);
+        out[k] = uint8_t(packed);
+        out[k + 1] = uint8_t(packed >> 8);
+        out[k + 2] = uint8_t(packed >> 16);
+        out[k + 3] = uint8_t(packed >> 24);
+    }
+#endif
+
+    for (; k < count; k++) {
+        out[k] = encode_scalar(linear[k], t);
+    }
+}
@@ -0,0 +1,54 @@
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#include "framebuffer.h"
+
+static const size_t cache_line_bytes = 64;
+static const size_t pixels_per_line = cache_line_bytes / sizeof(framebuffer_pixel);
+
+framebuffer::framebuffer(const unsigned int width, const unsigned int height, const unsigned int tile_size,
+                         const unsigned int resident_rows)
+    : _width(width), _height(height), _tile_size(std::max(1u, tile_size)) {
+
+    _tiles_x = (_width + _tile_size - 1) / _tile_size;
+    const unsigned int tiles_y = (_height + _tile_size - 1) / _tile_size;
+    _resident_rows = std::max(1u, resident_rows > 0 ? std::min(resident_rows, tiles_y) : tiles_y);
+    _tile_stride = (size_t(_tile_size) * _tile_size + pixels_per_line - 1) / pixels_per_line * pixels_per_line;
+
+    // aligned_alloc wants a multiple of the alignment, which whole tiles always are
+    const size_t bytes = std::max<size_t>(1, size_t(_tiles_x) * _resident_rows) * _tile_stride * sizeof(framebuffer_pixel);
+    _pixels.reset(static_cast<framebuffer_pixel*>(std::aligned_alloc(cache_line_bytes, bytes)));
+    if (!_pixels) {
+        throw std::bad_alloc();
+    }
+    std::memset(_pixels.get(), 0, bytes);
+}
+
+bool framebuffer::copy_to(float* pixels, const size_t row_stride, const unsigned int channels) const {
+    return copy_rows(0, _height, pixels, row_stride, channels);
+}
+
+bool framebuffer::copy_rows(const unsigned int row, const unsigned int rows, float* pixels, const size_t row_stride,
+                            const unsigned int channels) const {
+
+    if (!pixels || (channels != 3 && channels != 4) || row_stride < size_t(_width) * channels || row + rows > _height) {
+        return false;
+    }
+
+    for (unsigned int r = 0; r < rows; r++) {
+        float* out = pixels + r * row_stride;
+        const unsigned int y = _height - 1 - (row + r);
+        for (unsigned int x = 0; x < _width; x++) {
+            const framebuffer_pixel& p = at(x, y);
+            out[0] = p.rgb[0];
+            out[1] = p.rgb[1];
+            out[2] = p.rgb[2];
+            if (channels == 4) {
+                out[3] = 1.0f;
+            }
+            out += channels;
+        }
+    }
+    return true;
+}
@@ -1,19 +1,64 @@
+#include <atomic>
+
 #include "hittable_list.h"
 #include "bvh.h"
+#include "parallel.h"
+
+bool hittable_list::commit() {
 
-bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    // objects (mostly meshes building their BVHs) commit concurrently, handed
+    // out one at a time since their cost varies wildly; shared geometry locks itself
+    std::vector<char> committed(objects.size(), 0);
+    std::atomic<size_t> next(0);
+    const size_t num_workers = parallel_chunks(objects.size(), 1);
+    parallel_for(num_workers, num_workers, [&](size_t, size_t, size_t) {
+        for (size_t k = next++; k < objects.size(); k = next++) {
+            committed[k] = objects[k]->commit();
+        }
+    });
 
-    if (!box.hit(r, t_min, t_max)) {
+    for (char ok : committed) {
+        if (!ok) {
+            return false;
+        }
+    }
+    if (!create_bounding_box() || !construct_bvh()) {
+        return false;
+    }
+
+    // the list that commits last (the scene root) owns the IDs everything below it reports
+    _materials.clear();
+    bind_materials(_materials);
+    _lights.clear();
+    bind_lights(_lights);
+    _lights.commit(box);
+    return true;
+}
+
+bool hittable_list::hit(const ray_query& q, double t_min, double t_max, hit_record& rec) const {
+
+    if (!box.hit(q, t_min, t_max)) {
         return false;
     }
      
-    bool hit_anything = node->hit(r, 0.001, INF, rec);
-    return hit_anything;
+    return wide->hit(q, t_min, t_max, rec);
+}
+
+bool hittable_list::occluded(const ray_query& q, double t_min, double t_max) const {
+
+    if (!box.hit(q, t_min, t_max)) {
+        return false;
+    }
+
+    return wide->occluded(q, t_min, t_max);
 }
 
 bool hittable_list::construct_bvh() {
-    // sort list of objects based on centroid
-    node = std::make_shared<bvh_node>(objects, 0, objects.size());
+    // reorders objects so that each BVH leaf covers a contiguous range,
+    // then compacts the pointer tree into a flat array and collapses that to four children per node
+    bvh_node tree(objects, 0, objects.size(), bvh_options);
+    node = std::make_shared<linear_bvh>(tree);
+    wide = std::make_shared<bvh4>(*node);
     return true;
 }
 
@@ -0,0 +1,640 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "image_io.h"
+#include "mapped_file.h"
+
+/* next whitespace-separated token of the header, advancing pos past it */
+static std::string header_token(const char* data, const size_t size, size_t& pos) {
+    while (pos < size && std::isspace(static_cast<unsigned char>(data[pos]))) {
+        pos++;
+    }
+    const size_t start = pos;
+    while (pos < size && !std::isspace(static_cast<unsigned char>(data[pos]))) {
+        pos++;
+    }
+    return std::string(data + start, pos - start);
+}
+
+static bool host_little_endian() {
+    const uint16_t probe = 1;
+    return *reinterpret_cast<const uint8_t*>(&probe) == 1;
+}
+
+float_image read_pfm(const std::string& filename) {
+
+    mapped_file file(filename);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not read PFM file " + filename);
+    }
+    const char* data = file.data();
+    const size_t size = file.size();
+
+    size_t pos = 0;
+    const std::string magic = header_token(data, size, pos);
+    const int width = std::atoi(header_token(data, size, pos).c_str());
+    const int height = std::atoi(header_token(data, size, pos).c_str());
+    const double scale = std::atof(header_token(data, size, pos).c_str());
+    if ((magic != "PF" && magic != "Pf") || width <= 0 || height <= 0 || scale == 0.0) {
+        throw std::runtime_error("Malformed PFM header in " + filename);
+    }
+    pos++;  // the single whitespace character ending the header
+
+    const int channels = magic == "PF" ? 3 : 1;
+    const size_t count = size_t(width) * height * channels;
+    if (pos > size || size - pos < count * sizeof(float)) {
+        throw std::runtime_error("Truncated PFM file " + filename);
+    }
+
+    // a negative scale marks little-endian data
+    const bool swap = (scale < 0.0) != host_little_endian();
+
+    float_image image;
+    image.width = width;
+    image.height = height;
+    image.rgb.resize(size_t(width) * height * 3);
+
+    // rows are stored bottom to top
+    const char* pixels = data + pos;
+    for (int y = 0; y < height; y++) {
+        const char* row = pixels + size_t(height - 1 - y) * width * channels * sizeof(float);
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < 3; c++) {
+                uint32_t bits;
+                std::memcpy(&bits, row + (size_t(x) * channels + (channels == 3 ? c : 0)) * sizeof(float), sizeof(bits));
+                if (swap) {
+                    bits = __builtin_bswap32(bits);
+                }
+                float value;
+                std::memcpy(&value, &bits, sizeof(value));
+                image.rgb[(size_t(y) * width + x) * 3 + c] = value;
+            }
+        }
+    }
+    return image;
+}
+
+image_format image_format_for(const std::string& filename) {
+    const size_t dot = filename.find_last_of('.');
+    std::string extension = dot == std::string::npos ? "" : filename.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+    if (extension == "pfm") {
+        return image_format::pfm;
+    }
+    if (extension == "exr") {
+        return image_format::exr;
+    }
+    return image_format::png;
+}
+
+// A file written through a descriptor, sequentially or at given offsets; remembers
+// whether any write failed so writers only need to check once at the end
+class output_file {
+    public:
+        output_file(const std::string& filename) {
+            _fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        }
+
+        ~output_file() {
+            close();
+        }
+
+        bool is_open() const { return _fd >= 0; }
+
+        void write(const void* data, const size_t size) {
+            write_at(data, size, _end);
+        }
+
+        void write_at(const void* data, const size_t size, const uint64_t offset) {
+            const char* bytes = static_cast<const char*>(data);
+            size_t done = 0;
+            while (_ok && done < size) {
+                const ssize_t n = pwrite(_fd, bytes + done, size - done, off_t(offset + done));
+                _ok = n > 0;
+                done += n > 0 ? size_t(n) : 0;
+            }
+            _end = std::max(_end, offset + size);
+        }
+
+        /* false if the file could not be opened or any write or the close failed */
+        bool close() {
+            if (_fd >= 0) {
+                _ok &= ::close(_fd) == 0;
+                _fd = -1;
+            }
+            return _ok;
+        }
+
+    private:
+        int _fd = -1;
+        bool _ok = true;
+        uint64_t _end = 0;
+};
+
+/* png_writer */
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t* data, const size_t size) {
+    static const struct crc_table {
+        uint32_t entries[256];
+        crc_table() {
+            for (uint32_t n = 0; n < 256; n++) {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++) {
+                    c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                }
+                entries[n] = c;
+            }
+        }
+    } table;
+
+    crc = ~crc;
+    for (size_t k = 0; k < size; k++) {
+        crc = table.entries[(crc ^ data[k]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t adler32_update(const uint32_t adler, const uint8_t* data, size_t size) {
+    uint32_t a = adler & 0xffff, b = adler >> 16;
+    while (size > 0) {
+        // the largest run whose sums cannot overflow before the modulo
+        const size_t run = std::min<size_t>(size, 5552);
+        for (size_t k = 0; k < run; k++) {
+            a += data[k];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        data += run;
+        size -= run;
+    }
+    return b << 16 | a;
+}
+
+static inline void put_be32(uint8_t* out, const uint32_t v) {
+    out[0] = uint8_t(v >> 24);
+    out[1] = uint8_t(v >> 16);
+    out[2] = uint8_t(v >> 8);
+    out[3] = uint8_t(v);
+}
+
+// zlib stream of one deflate block with the fixed Huffman codes, fed piece by
+// piece. Matches are found greedily along hash chains and may reach 32 KB back
+// into earlier pieces, so cutting the input into bands costs almost nothing.
+class deflate_stream {
+    public:
+        deflate_stream() : _head(1 << hash_bits, -1), _prev(window_size, -1) {
+            for (int sym = 0; sym < 288; sym++) {
+                const int length = sym < 144 ? 8 : sym < 256 ? 9 : sym < 280 ? 7 : 8;
+                const int code = sym < 144 ? 0x30 + sym : sym < 256 ? 0x190 + sym - 144 : sym < 280 ? sym - 256 : 0xc0 + sym - 280;
+                _literal_codes[sym] = reverse(code, length);
+                _literal_lengths[sym] = uint8_t(length);
+            }
+            _out.push_back(0x78);   // deflate, 32 KB window
+            _out.push_back(0x01);   // fastest compression, checksum of the two bytes
+            put_bits(0x2, 3);       // a fixed Huffman block that is not the last
+        }
+
+        /* compress the next piece; the bytes ready to be written are in output() until take_output() */
+        void write(const uint8_t* data, const size_t size) {
+            _adler = adler32_update(_adler, data, size);
+            _window.insert(_window.end(), data, data + size);
+            compress(_window.size() - size);
+
+            // keep the last 32 KB for the next piece to refer to
+            if (_window.size() > window_size) {
+                const size_t drop = _window.size() - window_size;
+                _window.erase(_window.begin(), _window.begin() + drop);
+                _window_start += drop;
+            }
+        }
+
+        /* end the stream with its checksum */
+        void finish() {
+            put_literal(256);
+            put_bits(0x3, 3);       // an empty last block
+            put_literal(256);
+            if (_bit_count > 0) {
+                put_bits(0, 8 - _bit_count);
+            }
+            uint8_t adler[4];
+            put_be32(adler, _adler);
+            _out.insert(_out.end(), adler, adler + 4);
+        }
+
+        std::vector<uint8_t>& output() { return _out; }
+
+    private:
+        static const size_t window_size = 32768;
+        static const int hash_bits = 15;
+        static const int max_chain = 8;
+        static const int max_match = 258;
+
+        static uint16_t reverse(int code, int length) {
+            int r = 0;
+            for (int k = 0; k < length; k++, code >>= 1) {
+                r = (r << 1) | (code & 1);
+            }
+            return uint16_t(r);
+        }
+
+        static uint32_t hash(const uint8_t* p) {
+            return ((uint32_t(p[0]) << 16 | uint32_t(p[1]) << 8 | p[2]) * 0x9e3779b1u) >> (32 - hash_bits);
+        }
+
+        void put_bits(const uint32_t bits, const int count) {
+            _bits |= uint64_t(bits) << _bit_count;
+            _bit_count += count;
+            while (_bit_count >= 8) {
+                _out.push_back(uint8_t(_bits));
+                _bits >>= 8;
+                _bit_count -= 8;
+            }
+        }
+
+        void put_literal(const int sym) {
+            put_bits(_literal_codes[sym], _literal_lengths[sym]);
+        }
+
+        void put_match(const int length, const int distance) {
+            // length symbols 265 and up cover 2^extra lengths each, four symbols per extra bit
+            const int l = length - 3;
+            if (length == max_match) {
+                put_literal(285);
+            } else if (l < 8) {
+                put_literal(257 + l);
+            } else {
+                const int msb = 31 - __builtin_clz(l);
+                put_literal(257 + 4 * (msb - 1) + ((l >> (msb - 2)) & 3));
+                put_bits(l & ((1 << (msb - 2)) - 1), msb - 2);
+            }
+
+            // distance codes cover 2^extra distances each, two codes per extra bit
+            const int d = distance - 1;
+            if (d < 4) {
+                put_bits(reverse(d, 5), 5);
+            } else {
+                const int msb = 31 - __builtin_clz(d);
+                put_bits(reverse(2 * msb + ((d >> (msb - 1)) & 1), 5), 5);
+                put_bits(d & ((1 << (msb - 1)) - 1), msb - 1);
+            }
+        }
+
+        void insert(const size_t i) {
+            const int64_t position = int64_t(_window_start + i);
+            const uint32_t h = hash(&_window[i]);
+            _prev[position & (window_size - 1)] = _head[h];
+            _head[h] = position;
+        }
+
+        void compress(size_t i) {
+            const size_t end = _window.size();
+            while (i < end) {
+                int best_length = 0, best_distance = 0;
+                if (end - i >= 3) {
+                    const int64_t position = int64_t(_window_start + i);
+                    const int limit = int(std::min<size_t>(max_match, end - i));
+                    int64_t candidate = _head[hash(&_window[i])];
+                    for (int chain = 0; chain < max_chain && candidate >= 0 && position - candidate <= int64_t(window_size); chain++) {
+                        const uint8_t* a = &_window[size_t(candidate - int64_t(_window_start))];
+                        const uint8_t* b = &_window[i];
+                        int length = 0;
+                        while (length < limit && a[length] == b[length]) {
+                            length++;
+                        }
+                        if (length > best_length) {
+                            best_length = length;
+                            best_distance = int(position - candidate);
+                            if (length == limit) {
+                                break;
+                            }
+                        }
+                        const int64_t next = _prev[candidate & (window_size - 1)];
+                        if (next >= candidate) {
+                            break;  // the slot was reused by a newer position
+                        }
+                        candidate = next;
+                    }
+                    insert(i);
+                }
+
+                if (best_length >= 3) {
+                    put_match(best_length, best_distance);
+                    for (size_t k = i + 1; k < i + best_length && end - k >= 3; k++) {
+                        insert(k);
+                    }
+                    i += best_length;
+                } else {
+                    put_literal(_window[i]);
+                    i++;
+                }
+            }
+        }
+
+    private:
+        std::vector<uint8_t> _window;       // the last 32 KB already compressed, then the new piece
+        uint64_t _window_start = 0;         // stream position of _window[0]
+        std::vector<int64_t> _head;         // latest position of each hash
+        std::vector<int64_t> _prev;         // previous position with the same hash, by position mod 32 KB
+        uint16_t _literal_codes[288];       // bit reversed, as deflate sends Huffman codes
+        uint8_t _literal_lengths[288];
+        uint64_t _bits = 0;
+        int _bit_count = 0;
+        uint32_t _adler = 1;
+        std::vector<uint8_t> _out;
+};
+
+// 8-bit RGB PNG written band by band: each row is tone mapped, filtered with
+// whichever PNG filter leaves the smallest residuals, compressed, and sent out
+// as an IDAT chunk
+class png_writer : public image_writer {
+    public:
+        png_writer(const std::string& filename, const unsigned int width, const unsigned int height, const tone_mapping& tone)
+            : _file(filename), _width(width), _height(height), _tone(tone),
+              _row(size_t(width) * 3), _previous(size_t(width) * 3, 0), _filtered(5 * (size_t(width) * 3 + 1)) {
+
+            static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+            _file.write(signature, sizeof(signature));
+
+            uint8_t header[13];
+            put_be32(header, width);
+            put_be32(header + 4, height);
+            header[8] = 8;      // bits per channel
+            header[9] = 2;      // RGB
+            header[10] = header[11] = header[12] = 0;   // deflate, adaptive filtering, no interlacing
+            write_chunk("IHDR", header, sizeof(header));
+        }
+
+        bool is_open() const { return _file.is_open(); }
+
+        virtual bool write_rows(const float* rgb, const unsigned int rows) override {
+            const size_t stride = size_t(_width) * 3;
+            _band.clear();
+            for (unsigned int r = 0; r < rows && _next_row < _height; r++, _next_row++) {
+                encode_8bit(rgb + r * stride, _row.data(), stride, _tone);
+                const uint8_t* best = filter_row();
+                _band.insert(_band.end(), best, best + stride + 1);
+                std::swap(_row, _previous);
+            }
+            _deflate.write(_band.data(), _band.size());
+            flush();
+            return true;
+        }
+
+        virtual bool finish() override {
+            _deflate.finish();
+            flush();
+            write_chunk("IEND", nullptr, 0);
+            return _next_row == _height && _file.close();
+        }
+
+    private:
+        void write_chunk(const char* type, const uint8_t* data, const size_t size) {
+            uint8_t length[4], crc[4];
+            put_be32(length, uint32_t(size));
+            put_be32(crc, crc32_update(crc32_update(0, reinterpret_cast<const uint8_t*>(type), 4), data, size));
+            _file.write(length, 4);
+            _file.write(type, 4);
+            _file.write(data, size);
+            _file.write(crc, 4);
+        }
+
+        /* whatever the compressor has finished, as one IDAT chunk */
+        void flush() {
+            std::vector<uint8_t>& out = _deflate.output();
+            if (!out.empty()) {
+                write_chunk("IDAT", out.data(), out.size());
+                out.clear();
+            }
+        }
+
+        /* _row filtered with each of the five filters (filter byte first); returns the one whose
+           residuals have the smallest sum as signed bytes, the usual heuristic */
+        const uint8_t* filter_row() {
+            const size_t stride = size_t(_width) * 3;
+            const uint8_t* x = _row.data();
+            const uint8_t* up = _previous.data();
+
+            uint8_t* out[5];
+            for (int filter = 0; filter < 5; filter++) {
+                out[filter] = &_filtered[filter * (stride + 1)];
+                out[filter][0] = uint8_t(filter);
+                out[filter]++;
+            }
+
+            // the first pixel has nothing to its left
+            for (size_t k = 0; k < std::min<size_t>(3, stride); k++) {
+                out[0][k] = x[k];
+                out[1][k] = x[k];
+                out[2][k] = uint8_t(x[k] - up[k]);
+                out[3][k] = uint8_t(x[k] - (up[k] >> 1));
+                out[4][k] = uint8_t(x[k] - up[k]);
+            }
+            for (size_t k = 3; k < stride; k++) {
+                const int a = x[k - 3], b = up[k], c = up[k - 3];
+                const int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+                out[0][k] = x[k];
+                out[1][k] = uint8_t(x[k] - a);
+                out[2][k] = uint8_t(x[k] - b);
+                out[3][k] = uint8_t(x[k] - ((a + b) >> 1));
+                out[4][k] = uint8_t(x[k] - (pa <= pb && pa <= pc ? a : pb <= pc ? b : c));
+            }
+
+            int best = 0;
+            unsigned long best_cost = ~0ul;
+            for (int filter = 0; filter < 5; filter++) {
+                unsigned long cost = 0;
+                for (size_t k = 0; k < stride; k++) {
+                    cost += std::abs(int(int8_t(out[filter][k])));
+                }
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best = filter;
+                }
+            }
+            return out[best] - 1;
+        }
+
+    private:
+        output_file _file;
+        unsigned int _width, _height;
+        unsigned int _next_row = 0;
+        tone_mapping _tone;
+        std::vector<uint8_t> _row, _previous;     // this row and the one above, as bytes
+        std::vector<uint8_t> _filtered;           // the row under each filter
+        std::vector<uint8_t> _band;
+        deflate_stream _deflate;
+};
+
+/* pfm_writer */
+
+// Rows go from the top down, the file stores them from the bottom up; with a
+// fixed row size each one can be written straight to its place
+class pfm_writer : public image_writer {
+    public:
+        pfm_writer(const std::string& filename, const unsigned int width, const unsigned int height)
+            : _file(filename), _width(width), _height(height) {
+
+            // a negative scale marks little-endian data
+            _header = "PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n" + (host_little_endian() ? "-1.0\n" : "1.0\n");
+            _file.write(_header.data(), _header.size());
+        }
+
+        bool is_open() const { return _file.is_open(); }
+
+        virtual bool write_rows(const float* rgb, const unsigned int rows) override {
+            const size_t row_bytes = size_t(_width) * 3 * sizeof(float);
+            for (unsigned int r = 0; r < rows && _next_row < _height; r++, _next_row++) {
+                _file.write_at(rgb + size_t(r) * _width * 3, row_bytes, _header.size() + (_height - 1 - _next_row) * row_bytes);
+            }
+            return true;
+        }
+
+        virtual bool finish() override {
+            return _next_row == _height && _file.close();
+        }
+
+    private:
+        output_file _file;
+        unsigned int _width, _height;
+        unsigned int _next_row = 0;
+        std::string _header;
+};
+
+/* exr_writer */
+
+// Scanline OpenEXR with no compression and one line per chunk: a header,
+// a table of chunk offsets (all known up front), then for each line its y and
+// the B, G and R floats, channels being stored in alphabetical order
+class exr_writer : public image_writer {
+    public:
+        exr_writer(const std::string& filename, const unsigned int width, const unsigned int height)
+            : _file(filename), _width(width), _height(height), _line(size_t(width) * 3 * sizeof(float) + 8) {
+
+            std::vector<uint8_t> header = { 0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0 };     // magic, version 2, scanlines
+
+            std::vector<uint8_t> channels;
+            for (const char* name : { "B", "G", "R" }) {
+                channels.push_back(uint8_t(name[0]));
+                channels.push_back(0);
+                append_le32(channels, 2);           // FLOAT
+                append_le32(channels, 0);           // pLinear and three reserved bytes
+                append_le32(channels, 1);           // x sampling
+                append_le32(channels, 1);           // y sampling
+            }
+            channels.push_back(0);
+            attribute(header, "channels", "chlist", channels);
+            attribute(header, "compression", "compression", { 0 });
+
+            std::vector<uint8_t> window;
+            for (const uint32_t v : { 0u, 0u, width - 1, height - 1 }) {
+                append_le32(window, v);
+            }
+            attribute(header, "dataWindow", "box2i", window);
+            attribute(header, "displayWindow", "box2i", window);
+            attribute(header, "lineOrder", "lineOrder", { 0 });     // increasing y
+            attribute(header, "pixelAspectRatio", "float", float_bytes(1.0f));
+            std::vector<uint8_t> center = float_bytes(0.0f);
+            center.resize(8, 0);
+            attribute(header, "screenWindowCenter", "v2f", center);
+            attribute(header, "screenWindowWidth", "float", float_bytes(1.0f));
+            header.push_back(0);
+
+            const uint64_t first_line = header.size() + size_t(height) * 8;
+            for (unsigned int y = 0; y < height; y++) {
+                const uint64_t offset = first_line + uint64_t(y) * _line.size();
+                for (int k = 0; k < 8; k++) {
+                    header.push_back(uint8_t(offset >> (8 * k)));
+                }
+            }
+            _file.write(header.data(), header.size());
+        }
+
+        bool is_open() const { return _file.is_open(); }
+
+        virtual bool write_rows(const float* rgb, const unsigned int rows) override {
+            const bool swap = !host_little_endian();
+            for (unsigned int r = 0; r < rows && _next_row < _height; r++, _next_row++) {
+                const uint32_t prefix[2] = { _next_row, uint32_t(_line.size() - 8) };
+                std::memcpy(_line.data(), prefix, sizeof(prefix));
+
+                float* out = reinterpret_cast<float*>(_line.data() + 8);
+                const float* in = rgb + size_t(r) * _width * 3;
+                for (int c = 0; c < 3; c++) {
+                    for (unsigned int x = 0; x < _width; x++) {
+                        out[c * _width + x] = in[x * 3 + 2 - c];
+                    }
+                }
+                if (swap) {
+                    uint32_t* words = reinterpret_cast<uint32_t*>(_line.data());
+                    for (size_t k = 0; k < _line.size() / 4; k++) {
+                        words[k] = __builtin_bswap32(words[k]);
+                    }
+                }
+                _file.write(_line.data(), _line.size());
+            }
+            return true;
+        }
+
+        virtual bool finish() override {
+            return _next_row == _height && _file.close();
+        }
+
+    private:
+        static void append_le32(std::vector<uint8_t>& out, const uint32_t v) {
+            for (int k = 0; k < 4; k++) {
+                out.push_back(uint8_t(v >> (8 * k)));
+            }
+        }
+
+        static std::vector<uint8_t> float_bytes(const float f) {
+            uint32_t bits;
+            std::memcpy(&bits, &f, sizeof(bits));
+            std::vector<uint8_t> out;
+            append_le32(out, bits);
+            return out;
+        }
+
+        static void attribute(std::vector<uint8_t>& header, const char* name, const char* type, const std::vector<uint8_t>& value) {
+            header.insert(header.end(), name, name + std::strlen(name) + 1);
+            header.insert(header.end(), type, type + std::strlen(type) + 1);
+            append_le32(header, uint32_t(value.size()));
+            header.insert(header.end(), value.begin(), value.end());
+        }
+
+    private:
+        output_file _file;
+        unsigned int _width, _height;
+        unsigned int _next_row = 0;
+        std::vector<uint8_t> _line;     // y, size and the three channels of one line
+};
+
+std::unique_ptr<image_writer> open_image_writer(const std::string& filename, const image_format format,
+                                                const unsigned int width, const unsigned int height,
+                                                const tone_mapping& tone) {
+    if (width == 0 || height == 0) {
+        return nullptr;
+    }
+
+    if (format == image_format::pfm) {
+        auto writer = std::make_unique<pfm_writer>(filename, width, height);
+        return writer->is_open() ? std::move(writer) : nullptr;
+    }
+    if (format == image_format::exr) {
+        auto writer = std::make_unique<exr_writer>(filename, width, height);
+        return writer->is_open() ? std::move(writer) : nullptr;
+    }
+    auto writer = std::make_unique<png_writer>(filename, width, height, tone);
+    return writer->is_open() ? std::move(writer) : nullptr;
+}
+
+bool write_image(const std::string& filename, const float_image& image, const tone_mapping& tone) {
+    std::unique_ptr<image_writer> writer = open_image_writer(filename, image_format_for(filename), image.width, image.height, tone);
+    return writer && writer->write_rows(image.rgb.data(), image.height) && writer->finish();
+}
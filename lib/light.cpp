@@ -0,0 +1,293 @@
+#include "light.h"
+#include "color.h"
+#include "light_bvh.h"
+
+/* point_light */
+
+bool point_light::sample(const point3& p, const double /* u */, const double /* v */, light_sample& s) const {
+    const vec3 d = _position - p;
+    const double distance_squared = d.length_squared();
+    if (distance_squared == 0.0) {
+        return false;
+    }
+
+    s.distance = std::sqrt(distance_squared);
+    s.wi = d / s.distance;
+    s.radiance = _intensity / distance_squared;
+    s.pdf = 1.0;
+    return true;
+}
+
+double point_light::power() const {
+    return 4.0 * PI * luminance(_intensity);
+}
+
+bool point_light::bounds(light_bounds& b) const {
+    b.box = aabb(_position, _position);
+    b.cos_theta_o = -1.0;   // every direction
+    b.cos_theta_e = 0.0;
+    b.phi = power();
+    b.two_sided = false;
+    return true;
+}
+
+/* directional_light */
+
+bool directional_light::sample(const point3& /* p */, const double /* u */, const double /* v */, light_sample& s) const {
+    s.wi = -_direction;
+    s.distance = INF;
+    s.radiance = _irradiance;
+    s.pdf = 1.0;
+    return true;
+}
+
+double directional_light::power() const {
+    // everything crossing a disk that covers the scene
+    return PI * _scene_radius * _scene_radius * luminance(_irradiance);
+}
+
+void directional_light::preprocess(const aabb& scene_bounds) {
+    _scene_radius = 0.5 * (scene_bounds.max() - scene_bounds.min()).length();
+}
+
+/* sphere_light */
+
+bool sphere_light::sample(const point3& p, const double u, const double v, light_sample& s) const {
+    const vec3 oc = _center - p;
+    const double distance_squared = oc.length_squared();
+    const double radius_squared = _radius * _radius;
+    if (distance_squared <= radius_squared) {
+        return false;   // inside, where nothing is emitted
+    }
+
+    // 1 - cos(theta_max) of the cone around the center, written to stay accurate for small, distant spheres
+    const double sin2_max = radius_squared / distance_squared;
+    const double one_minus_cos_max = sin2_max / (1.0 + std::sqrt(std::fmax(0.0, 1.0 - sin2_max)));
+
+    // cos(theta) uniform in [cos(theta_max), 1] is uniform in solid angle
+    const double one_minus_cos = u * one_minus_cos_max;
+    const double cos_theta = 1.0 - one_minus_cos;
+    const double sin_theta = std::sqrt(std::fmax(0.0, one_minus_cos * (2.0 - one_minus_cos)));
+    const double phi = 2.0 * PI * v;
+
+    const vec3 axis = oc / std::sqrt(distance_squared);
+    vec3 tangent, bitangent;
+    orthonormal_basis(axis, tangent, bitangent);
+    s.wi = sin_theta * std::cos(phi) * tangent + sin_theta * std::sin(phi) * bitangent + cos_theta * axis;
+
+    // nearer root of |p + t wi - center|^2 = r^2; the cone guarantees a hit up to rounding
+    const double half_b = dot(s.wi, oc);
+    const double discriminant = std::fmax(0.0, half_b * half_b - (distance_squared - radius_squared));
+    s.distance = half_b - std::sqrt(discriminant);
+    s.radiance = _radiance;
+    s.pdf = 1.0 / (2.0 * PI * one_minus_cos_max);
+    return true;
+}
+
+double sphere_light::pdf(const point3& p, const point3& /* y */, const vec3& /* n */) const {
+    const double distance_squared = (_center - p).length_squared();
+    const double radius_squared = _radius * _radius;
+    if (distance_squared <= radius_squared) {
+        return 0.0;
+    }
+
+    const double sin2_max = radius_squared / distance_squared;
+    const double one_minus_cos_max = sin2_max / (1.0 + std::sqrt(std::fmax(0.0, 1.0 - sin2_max)));
+    return 1.0 / (2.0 * PI * one_minus_cos_max);
+}
+
+double sphere_light::power() const {
+    return PI * 4.0 * PI * _radius * _radius * luminance(_radiance);
+}
+
+bool sphere_light::bounds(light_bounds& b) const {
+    const vec3 extent(_radius, _radius, _radius);
+    b.box = aabb(_center - extent, _center + extent);
+    b.cos_theta_o = -1.0;   // normals point everywhere
+    b.cos_theta_e = 0.0;    // each emits over its hemisphere
+    b.phi = power();
+    b.two_sided = false;
+    return true;
+}
+
+/* triangle_light */
+
+triangle_light::triangle_light(const point3& v0, const point3& v1, const point3& v2, const color& radiance, const vec3& n)
+    : _v0(v0), _v1(v1), _v2(v2), _radiance(radiance) {
+
+    const vec3 c = cross(v1 - v0, v2 - v0);
+    const double length = c.length();
+    _area = 0.5 * length;
+    _normal = length > 0.0 ? c / length : vec3(0, 0, 1);
+    if (dot(_normal, n) < 0.0) {
+        _normal = -_normal;
+    }
+}
+
+bool triangle_light::sample(const point3& p, const double u, const double v, light_sample& s) const {
+    if (_area == 0.0) {
+        return false;
+    }
+
+    // uniform barycentrics from the square root warp
+    const double su = std::sqrt(u);
+    const double b0 = 1.0 - su;
+    const double b1 = v * su;
+    const point3 y = b0 * _v0 + b1 * _v1 + (1.0 - b0 - b1) * _v2;
+
+    const vec3 d = y - p;
+    const double distance_squared = d.length_squared();
+    s.distance = std::sqrt(distance_squared);
+    s.wi = d / s.distance;
+
+    const double cos_light = -dot(s.wi, _normal);
+    if (cos_light <= 0.0) {
+        return false;   // p sees the back
+    }
+
+    // area density converted to solid angle
+    s.radiance = _radiance;
+    s.pdf = distance_squared / (cos_light * _area);
+    return true;
+}
+
+double triangle_light::pdf(const point3& p, const point3& y, const vec3& /* n */) const {
+    const vec3 d = y - p;
+    const double distance_squared = d.length_squared();
+    const double cos_light = std::fabs(dot(d, _normal)) / std::sqrt(distance_squared);
+    return cos_light > 0.0 && _area > 0.0 ? distance_squared / (cos_light * _area) : 0.0;
+}
+
+double triangle_light::power() const {
+    return PI * _area * luminance(_radiance);
+}
+
+bool triangle_light::bounds(light_bounds& b) const {
+    b.box = aabb(point3(std::fmin(_v0.x(), std::fmin(_v1.x(), _v2.x())),
+                        std::fmin(_v0.y(), std::fmin(_v1.y(), _v2.y())),
+                        std::fmin(_v0.z(), std::fmin(_v1.z(), _v2.z()))),
+                 point3(std::fmax(_v0.x(), std::fmax(_v1.x(), _v2.x())),
+                        std::fmax(_v0.y(), std::fmax(_v1.y(), _v2.y())),
+                        std::fmax(_v0.z(), std::fmax(_v1.z(), _v2.z()))));
+    b.w = _normal;
+    b.cos_theta_o = 1.0;
+    b.cos_theta_e = 0.0;
+    b.phi = power();
+    b.two_sided = false;
+    return true;
+}
+
+/* environment_light */
+
+environment_light::environment_light(const float_image& image, const double scale)
+    : _width(image.width), _height(image.height) {
+
+    _radiance.resize(size_t(_width) * _height);
+    std::vector<double> row_weights(_height, 0.0);
+    std::vector<double> weights(_width);
+    double weighted_luminance = 0.0;
+
+    _columns.reserve(_height);
+    for (unsigned int y = 0; y < _height; y++) {
+        const double sin_theta = std::sin(PI * (y + 0.5) / _height);
+        for (unsigned int x = 0; x < _width; x++) {
+            const float* texel = image.at(x, y);
+            color& c = _radiance[size_t(y) * _width + x];
+            c = scale * color(std::fmax(0.0f, texel[0]), std::fmax(0.0f, texel[1]), std::fmax(0.0f, texel[2]));
+
+            // luminance can be zero where the color is not; any light left has to be reachable
+            weights[x] = sin_theta * std::fmax(luminance(c), 1e-3 * (c.x() + c.y() + c.z()));
+            row_weights[y] += weights[x];
+            weighted_luminance += sin_theta * luminance(c);
+        }
+        _columns.push_back(alias_table(weights));
+    }
+    _rows = alias_table(row_weights);
+
+    // the rows' sin(theta) sum to about 2 / pi times their number
+    _mean_luminance = weighted_luminance / (double(_width) * _height * 2.0 / PI);
+}
+
+void environment_light::texel(const vec3& w, unsigned int& x, unsigned int& y) const {
+    const double theta = std::atan2(std::sqrt(w.x() * w.x() + w.z() * w.z()), w.y());
+    double phi = std::atan2(w.z(), w.x());
+    if (phi < 0.0) {
+        phi += 2.0 * PI;
+    }
+    x = std::min(unsigned(phi / (2.0 * PI) * _width), _width - 1);
+    y = std::min(unsigned(theta / PI * _height), _height - 1);
+}
+
+double environment_light::direction_pdf(const vec3& w) const {
+    if (_rows.empty()) {
+        return 0.0;
+    }
+
+    unsigned int x, y;
+    texel(w, x, y);
+    const alias_table& columns = _columns[y];
+    if (columns.empty()) {
+        return 0.0;
+    }
+
+    // density over the image's [0, 1)^2, then per solid angle: d(omega) = 2 pi^2 sin(theta) du dv
+    const double sin_theta = std::sqrt(w.x() * w.x() + w.z() * w.z()) / w.length();
+    const double image_pdf = _rows.pmf(y) * columns.pmf(x) * double(_width) * _height;
+    return sin_theta > 0.0 ? image_pdf / (2.0 * PI * PI * sin_theta) : 0.0;
+}
+
+bool environment_light::sample(const point3& /* p */, const double u, const double v, light_sample& s) const {
+    if (_rows.empty()) {
+        return false;
+    }
+
+    // a row from u and a column from v; what is left of each places the point inside the texel
+    double row_pmf, column_pmf, du, dv;
+    const uint32_t y = _rows.sample(u, row_pmf, dv);
+    const uint32_t x = _columns[y].sample(v, column_pmf, du);
+
+    const double theta = PI * (y + dv) / _height;
+    const double phi = 2.0 * PI * (x + du) / _width;
+    const double sin_theta = std::sin(theta);
+    if (sin_theta <= 0.0) {
+        return false;
+    }
+
+    s.wi = vec3(sin_theta * std::cos(phi), std::cos(theta), sin_theta * std::sin(phi));
+    s.distance = INF;
+
+    // rounding can carry a point at the edge of its texel into the next; report what pdf() and environment() will
+    unsigned int wx, wy;
+    texel(s.wi, wx, wy);
+    if (wx != x || wy != y) {
+        s.pdf = direction_pdf(s.wi);
+        s.radiance = _radiance[size_t(wy) * _width + wx];
+        return s.pdf > 0.0;
+    }
+    s.radiance = _radiance[size_t(y) * _width + x];
+    s.pdf = row_pmf * column_pmf * double(_width) * _height / (2.0 * PI * PI * sin_theta);
+    return true;
+}
+
+double environment_light::pdf(const point3& p, const point3& y, const vec3& /* n */) const {
+    // renormalizing could move a sample on a texel edge into the next texel, away from what sample() reported
+    return direction_pdf(y - p);
+}
+
+color environment_light::environment(const vec3& w) const {
+    if (_radiance.empty()) {
+        return color(0, 0, 0);
+    }
+    unsigned int x, y;
+    texel(w, x, y);
+    return _radiance[size_t(y) * _width + x];
+}
+
+double environment_light::power() const {
+    // everything crossing a disk that covers the scene, from every direction
+    return 4.0 * PI * PI * _scene_radius * _scene_radius * _mean_luminance;
+}
+
+void environment_light::preprocess(const aabb& scene_bounds) {
+    _scene_radius = 0.5 * (scene_bounds.max() - scene_bounds.min()).length();
+}
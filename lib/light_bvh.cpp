@@ -0,0 +1,324 @@
+#include <algorithm>
+
+#include "light_bvh.h"
+
+static const uint32_t NOT_IN_TREE = 0xffffffff;     // lights without power are never chosen
+static const uint32_t INFINITE_LIGHT = 0xfffffffe;  // lights without bounds
+
+static const int NUM_BUCKETS = 12;
+
+static inline double safe_sqrt(const double x) {
+    return std::sqrt(std::fmax(0.0, x));
+}
+
+/* cos(max(0, a - b)) and sin(max(0, a - b)) for angles a, b in [0, pi], from their sines and cosines */
+static inline double cos_sub_clamped(const double sin_a, const double cos_a, const double sin_b, const double cos_b) {
+    return cos_a > cos_b ? 1.0 : cos_a * cos_b + sin_a * sin_b;
+}
+
+static inline double sin_sub_clamped(const double sin_a, const double cos_a, const double sin_b, const double cos_b) {
+    return cos_a > cos_b ? 0.0 : sin_a * cos_b - cos_a * sin_b;
+}
+
+double light_bounds::importance(const point3& p, const vec3& n) const {
+
+    // close to the lights, distance says little about what arrives; clamp it at their extent
+    const vec3 d = p - box.center();
+    const double length_squared = d.length_squared();
+    const double distance_squared = std::fmax(length_squared, 0.5 * box.diagonal().length());
+
+    // p inside the box's bounding sphere may receive light from any direction
+    const double cos_b = box.subtended_cos(p);
+    if (cos_b <= -1.0) {
+        return phi / distance_squared;
+    }
+    const vec3 wo = d / std::sqrt(length_squared);
+    const double sin_b = safe_sqrt(1.0 - cos_b * cos_b);
+
+    // smallest angle of incidence at p, one-sided; the cheaper test, so first
+    const double cos_i = -dot(wo, n);
+    const double sin_i = safe_sqrt(1.0 - cos_i * cos_i);
+    const double cos_pi = cos_sub_clamped(sin_i, cos_i, sin_b, cos_b);
+    if (cos_pi <= 0.0) {
+        return 0.0;
+    }
+
+    // and the smallest angle between an emitting normal and some direction towards p: theta_w - theta_o - theta_b
+    double cos_w = dot(w, wo);
+    if (two_sided) {
+        cos_w = std::fabs(cos_w);
+    }
+    const double sin_w = safe_sqrt(1.0 - cos_w * cos_w);
+    const double sin_o = safe_sqrt(1.0 - cos_theta_o * cos_theta_o);
+    const double cos_x = cos_sub_clamped(sin_w, cos_w, sin_o, cos_theta_o);
+    const double sin_x = sin_sub_clamped(sin_w, cos_w, sin_o, cos_theta_o);
+    const double cos_p = cos_sub_clamped(sin_x, cos_x, sin_b, cos_b);
+    if (cos_p <= cos_theta_e) {
+        return 0.0;
+    }
+    return phi * cos_p * cos_pi / distance_squared;
+}
+
+/* angle between unit vectors, accurate for nearly (anti)parallel ones */
+static double angle_between(const vec3& a, const vec3& b) {
+    if (dot(a, b) < 0.0) {
+        return PI - 2.0 * std::asin(std::fmin(1.0, (a + b).length() / 2.0));
+    }
+    return 2.0 * std::asin(std::fmin(1.0, (b - a).length() / 2.0));
+}
+
+/* smallest cone around both cones (wa, theta_a) and (wb, theta_b) */
+static void union_cones(const vec3& wa, const double cos_a, const vec3& wb, const double cos_b, vec3& w, double& cos_o) {
+    w = wa;
+    cos_o = -1.0;
+    if (cos_a <= -1.0 || cos_b <= -1.0) {
+        return;
+    }
+
+    const double theta_a = std::acos(clamp(cos_a, -1.0, 1.0));
+    const double theta_b = std::acos(clamp(cos_b, -1.0, 1.0));
+    const double theta_d = angle_between(wa, wb);
+    if (std::fmin(theta_d + theta_b, PI) <= theta_a) {
+        cos_o = cos_a;
+        return;
+    }
+    if (std::fmin(theta_d + theta_a, PI) <= theta_b) {
+        w = wb;
+        cos_o = cos_b;
+        return;
+    }
+
+    const double theta_o = 0.5 * (theta_a + theta_d + theta_b);
+    const vec3 axis = cross(wa, wb);
+    if (theta_o >= PI || axis.length_squared() == 0.0) {
+        return;
+    }
+
+    // rotate wa towards wb by theta_o - theta_a (Rodrigues' formula)
+    const vec3 k = unit_vector(axis);
+    const double theta_r = theta_o - theta_a;
+    w = unit_vector(std::cos(theta_r) * wa + std::sin(theta_r) * cross(k, wa) + (1.0 - std::cos(theta_r)) * dot(k, wa) * k);
+    cos_o = std::cos(theta_o);
+}
+
+light_bounds union_bounds(const light_bounds& a, const light_bounds& b) {
+    if (a.phi == 0.0) {
+        return b;
+    }
+    if (b.phi == 0.0) {
+        return a;
+    }
+
+    light_bounds u;
+    u.box = surrounding_box(a.box, b.box);
+    union_cones(a.w, a.cos_theta_o, b.w, b.cos_theta_o, u.w, u.cos_theta_o);
+    u.cos_theta_e = std::fmin(a.cos_theta_e, b.cos_theta_e);
+    u.phi = a.phi + b.phi;
+    u.two_sided = a.two_sided || b.two_sided;
+    return u;
+}
+
+/* surface area orientation heuristic: power times the box's area times the solid angle the
+   normals and their emission cover, stretched for boxes thin along the split axis */
+static double split_cost(const light_bounds& b, const aabb& parent_box, const int axis) {
+    const double theta_o = std::acos(clamp(b.cos_theta_o, -1.0, 1.0));
+    const double theta_e = std::acos(clamp(b.cos_theta_e, -1.0, 1.0));
+    const double theta_w = std::fmin(theta_o + theta_e, PI);
+    const double sin_o = std::sin(theta_o);
+    const double m_omega = 2.0 * PI * (1.0 - b.cos_theta_o)
+                         + PI / 2.0 * (2.0 * theta_w * sin_o - std::cos(theta_o - 2.0 * theta_w) - 2.0 * theta_o * sin_o + b.cos_theta_o);
+
+    const vec3 diagonal = parent_box.diagonal();
+    const double k_r = std::fmax(diagonal.x(), std::fmax(diagonal.y(), diagonal.z())) / diagonal[axis];
+    return b.phi * m_omega * k_r * b.box.surface_area();
+}
+
+void light_bvh::build(const std::vector<std::shared_ptr<light>>& lights) {
+
+    _nodes.clear();
+    _infinite.clear();
+    _lights.resize(lights.size());
+    _leaf_of.assign(lights.size(), NOT_IN_TREE);
+
+    std::vector<build_item> items;
+    for (size_t k = 0; k < lights.size(); k++) {
+        _lights[k] = lights[k].get();
+        build_item item;
+        item.id = light_id(k);
+        if (!lights[k]->bounds(item.bounds)) {
+            _infinite.push_back(item.id);
+            _leaf_of[k] = INFINITE_LIGHT;
+        } else if (item.bounds.phi > 0.0) {
+            item.centroid = item.bounds.box.center();
+            items.push_back(item);
+        }
+    }
+
+    if (!items.empty()) {
+        _nodes.reserve(2 * items.size() - 1);
+        build(items, 0, items.size(), 0);
+    }
+}
+
+uint32_t light_bvh::build(std::vector<build_item>& items, const size_t begin, const size_t end, const uint32_t parent) {
+
+    const uint32_t index = uint32_t(_nodes.size());
+    _nodes.push_back(node());
+
+    if (end - begin == 1) {
+        _nodes[index] = node{ items[begin].bounds, items[begin].id, parent, true };
+        _leaf_of[items[begin].id] = index;
+        return index;
+    }
+
+    light_bounds total = items[begin].bounds;
+    double centroid_min[3], centroid_max[3];
+    for (int axis = 0; axis < 3; axis++) {
+        centroid_min[axis] = centroid_max[axis] = items[begin].centroid[axis];
+    }
+    for (size_t k = begin + 1; k < end; k++) {
+        total = union_bounds(total, items[k].bounds);
+        for (int axis = 0; axis < 3; axis++) {
+            centroid_min[axis] = std::fmin(centroid_min[axis], items[k].centroid[axis]);
+            centroid_max[axis] = std::fmax(centroid_max[axis], items[k].centroid[axis]);
+        }
+    }
+
+    // best of NUM_BUCKETS - 1 planes per axis
+    double best_cost = INF;
+    int best_axis = -1, best_split = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        const double extent = centroid_max[axis] - centroid_min[axis];
+        if (extent <= 0.0) {
+            continue;
+        }
+
+        light_bounds buckets[NUM_BUCKETS];
+        bool filled[NUM_BUCKETS] = {};
+        for (size_t k = begin; k < end; k++) {
+            const int b = std::min(NUM_BUCKETS - 1, int(NUM_BUCKETS * (items[k].centroid[axis] - centroid_min[axis]) / extent));
+            buckets[b] = filled[b] ? union_bounds(buckets[b], items[k].bounds) : items[k].bounds;
+            filled[b] = true;
+        }
+
+        for (int split = 1; split < NUM_BUCKETS; split++) {
+            light_bounds below, above;
+            bool any_below = false, any_above = false;
+            for (int b = 0; b < NUM_BUCKETS; b++) {
+                if (!filled[b]) {
+                    continue;
+                }
+                if (b < split) {
+                    below = any_below ? union_bounds(below, buckets[b]) : buckets[b];
+                    any_below = true;
+                } else {
+                    above = any_above ? union_bounds(above, buckets[b]) : buckets[b];
+                    any_above = true;
+                }
+            }
+            if (!any_below || !any_above) {
+                continue;
+            }
+
+            const double cost = split_cost(below, total.box, axis) + split_cost(above, total.box, axis);
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = split;
+            }
+        }
+    }
+
+    size_t mid = (begin + end) / 2;
+    if (best_axis >= 0) {
+        const double extent = centroid_max[best_axis] - centroid_min[best_axis];
+        auto below = std::partition(items.begin() + begin, items.begin() + end, [&](const build_item& item) {
+            const int b = std::min(NUM_BUCKETS - 1, int(NUM_BUCKETS * (item.centroid[best_axis] - centroid_min[best_axis]) / extent));
+            return b < best_split;
+        });
+        mid = below - items.begin();
+    }
+    // all centroids in one spot: any halving is as good as another
+
+    build(items, begin, mid, index);
+    const uint32_t second = build(items, mid, end, index);
+    _nodes[index] = node{ total, second, parent, false };
+    return index;
+}
+
+double light_bvh::first_child_probability(const node& n, const point3& p, const vec3& normal) const {
+    const node* first = &n + 1;
+    const double i0 = first->bounds.importance(p, normal);
+    const double i1 = _nodes[n.offset].bounds.importance(p, normal);
+    return i0 + i1 > 0.0 ? i0 / (i0 + i1) : -1.0;
+}
+
+const light* light_bvh::sample(const point3& p, const vec3& n, double u, double& pmf) const {
+
+    // lights without bounds share one slot with the whole tree
+    const double p_infinite = _infinite.empty() ? 0.0 : double(_infinite.size()) / (_infinite.size() + (_nodes.empty() ? 0 : 1));
+    if (u < p_infinite) {
+        const size_t k = std::min<size_t>(size_t(u / p_infinite * _infinite.size()), _infinite.size() - 1);
+        pmf = p_infinite / _infinite.size();
+        return _lights[_infinite[k]];
+    }
+    if (_nodes.empty()) {
+        return nullptr;
+    }
+
+    const double one_minus_epsilon = 0x1.fffffffffffffp-1;
+    u = std::fmin((u - p_infinite) / (1.0 - p_infinite), one_minus_epsilon);
+    pmf = 1.0 - p_infinite;
+
+    uint32_t index = 0;
+    if (_nodes[0].leaf && _nodes[0].bounds.importance(p, n) <= 0.0) {
+        return nullptr;
+    }
+
+    // descend, reusing u: rescaled to [0, 1) it stays uniform for the next choice
+    while (!_nodes[index].leaf) {
+        const double p0 = first_child_probability(_nodes[index], p, n);
+        if (p0 < 0.0) {
+            return nullptr;
+        }
+        if (u < p0) {
+            index = index + 1;
+            u = std::fmin(u / p0, one_minus_epsilon);
+            pmf *= p0;
+        } else {
+            index = _nodes[index].offset;
+            u = std::fmin((u - p0) / (1.0 - p0), one_minus_epsilon);
+            pmf *= 1.0 - p0;
+        }
+    }
+    return _lights[_nodes[index].offset];
+}
+
+double light_bvh::pmf(const point3& p, const vec3& n, const light_id id) const {
+
+    if (id >= _leaf_of.size() || _leaf_of[id] == NOT_IN_TREE) {
+        return 0.0;
+    }
+
+    const double p_infinite = _infinite.empty() ? 0.0 : double(_infinite.size()) / (_infinite.size() + (_nodes.empty() ? 0 : 1));
+    if (_leaf_of[id] == INFINITE_LIGHT) {
+        return p_infinite / _infinite.size();
+    }
+
+    // the choices sample() makes on the way down, collected on the way up
+    uint32_t index = _leaf_of[id];
+    double pmf = 1.0 - p_infinite;
+    if (index == 0) {
+        return _nodes[0].bounds.importance(p, n) > 0.0 ? pmf : 0.0;
+    }
+    while (index != 0) {
+        const uint32_t parent = _nodes[index].parent;
+        const double p0 = first_child_probability(_nodes[parent], p, n);
+        if (p0 < 0.0) {
+            return 0.0;
+        }
+        pmf *= index == parent + 1 ? p0 : 1.0 - p0;
+        index = parent;
+    }
+    return pmf;
+}
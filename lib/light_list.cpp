@@ -0,0 +1,8 @@
+#include "light_list.h"
+
+void light_list::commit(const aabb& scene_bounds) {
+    for (auto& l : _lights) {
+        l->preprocess(scene_bounds);
+    }
+    _bvh.build(_lights);
+}
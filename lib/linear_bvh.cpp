@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#include "linear_bvh.h"
+
+// round outward so the float box always contains the double precision one
+static inline float round_down(const double x) {
+    float f = static_cast<float>(x);
+    return (f > x) ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+
+static inline float round_up(const double x) {
+    float f = static_cast<float>(x);
+    return (f < x) ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
+static inline double node_area(const linear_bvh_node& node) {
+    double dx = node.bounds_max[0] - node.bounds_min[0];
+    double dy = node.bounds_max[1] - node.bounds_min[1];
+    double dz = node.bounds_max[2] - node.bounds_min[2];
+    return 2.0 * (dx * dy + dy * dz + dz * dx);
+}
+
+static inline bool node_hit(const linear_bvh_node& node, const point3& origin, const ray_query& q,
+                            double t_min, double t_max) {
+    for (int i = 0; i < 3; i++) {
+        double t0 = ((q.dir_is_neg[i] ? node.bounds_max[i] : node.bounds_min[i]) - origin[i]) * q.inv_dir[i];
+        double t1 = ((q.dir_is_neg[i] ? node.bounds_min[i] : node.bounds_max[i]) - origin[i]) * q.inv_dir[i];
+
+        t_min = t0 > t_min ? t0 : t_min;
+        t_max = t1 < t_max ? t1 : t_max;
+        if (t_min > t_max) return false;
+    }
+    return true;
+}
+
+linear_bvh::linear_bvh(const bvh_node& root) {
+    box = root.get_bounding_box();
+    if (root.is_leaf && root.primitives.empty()) {
+        return;     // an empty leaf would read as an interior node
+    }
+
+    _nodes.reserve(root.node_count());
+    flatten(root);
+    measure_depth();
+}
+
+linear_bvh::linear_bvh(std::vector<linear_bvh_node>&& nodes, const std::vector<std::shared_ptr<hittable>>& primitives)
+    : _nodes(std::move(nodes)), _primitives(primitives) {
+    if (!_nodes.empty()) {
+        const linear_bvh_node& root = _nodes[0];
+        box = aabb(point3(root.bounds_min[0], root.bounds_min[1], root.bounds_min[2]),
+                   point3(root.bounds_max[0], root.bounds_max[1], root.bounds_max[2]));
+    }
+    measure_depth();
+}
+
+uint32_t linear_bvh::flatten(const bvh_node& node) {
+    const uint32_t index = _nodes.size();
+    _nodes.emplace_back();
+
+    aabb node_box = node.get_bounding_box();
+    for (int a = 0; a < 3; a++) {
+        _nodes[index].bounds_min[a] = round_down(node_box.min()[a]);
+        _nodes[index].bounds_max[a] = round_up(node_box.max()[a]);
+    }
+    _nodes[index].pad = 0;
+
+    if (node.is_leaf) {
+        _nodes[index].offset = _primitives.size();
+        _nodes[index].num_primitives = node.primitives.size();
+        _nodes[index].axis = 0;
+        _primitives.insert(_primitives.end(), node.primitives.begin(), node.primitives.end());
+    } else {
+        _nodes[index].num_primitives = 0;
+        _nodes[index].axis = node.axis;
+        flatten(*node.left);
+        uint32_t second = flatten(*node.right);
+        _nodes[index].offset = second;
+    }
+    return index;
+}
+
+void linear_bvh::measure_depth() {
+    // children always come after their parent, so one forward pass sees every parent first
+    std::vector<uint32_t> depth(_nodes.size(), 0);
+    _depth = 0;
+    for (size_t i = 0; i < _nodes.size(); i++) {
+        _depth = std::max(_depth, depth[i]);
+        if (_nodes[i].num_primitives == 0) {
+            depth[i + 1] = depth[i] + 1;
+            depth[_nodes[i].offset] = depth[i] + 1;
+        }
+    }
+}
+
+template<bool any_hit>
+bool linear_bvh::traverse(const ray_query& q, double t_min, double t_max, hit_record& rec, size_t& visited) const {
+
+    if (_nodes.empty()) {
+        return false;
+    }
+
+    const point3 origin = q.r.origin();
+
+    // a node at depth d has at most d siblings of its ancestors pending, deeper trees spill to the heap
+    uint32_t local_stack[64];
+    std::vector<uint32_t> deep_stack;
+    uint32_t* stack = local_stack;
+    if (_depth > 64) {
+        deep_stack.resize(_depth);
+        stack = deep_stack.data();
+    }
+    int stack_size = 0;
+    uint32_t current = 0;
+    bool hit_anything = false;
+
+    while (true) {
+        const linear_bvh_node& node = _nodes[current];
+        visited++;
+
+        if (node_hit(node, origin, q, t_min, t_max)) {
+            if (node.num_primitives > 0) {
+                if (any_hit) {
+                    if (leaf_occluded(node, q, t_min, t_max)) {
+                        return true;
+                    }
+                } else if (_leaf_intersector) {
+                    if (_leaf_intersector->hit_leaf(node.offset, node.num_primitives, q, t_min, t_max, rec)) {
+                        hit_anything = true;
+                        t_max = rec.t;
+                    }
+                } else {
+                    for (uint32_t k = node.offset; k < node.offset + node.num_primitives; k++) {
+                        if (_primitives[k]->hit(q, t_min, t_max, rec)) {
+                            hit_anything = true;
+                            t_max = rec.t;
+                        }
+                    }
+                }
+                if (stack_size == 0) break;
+                current = stack[--stack_size];
+            } else {
+                // visit the child on the near side of the split first
+                if (q.dir_is_neg[node.axis]) {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                } else {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+            }
+        } else {
+            if (stack_size == 0) break;
+            current = stack[--stack_size];
+        }
+    }
+
+    return hit_anything;
+}
+
+bool linear_bvh::hit(const ray_query& q, double t_min, double t_max, hit_record& rec) const {
+    size_t visited = 0;
+    return traverse<false>(q, t_min, t_max, rec, visited);
+}
+
+bool linear_bvh::occluded(const ray_query& q, double t_min, double t_max) const {
+    hit_record rec;
+    size_t visited = 0;
+    return traverse<true>(q, t_min, t_max, rec, visited);
+}
+
+bool linear_bvh::leaf_occluded(const linear_bvh_node& node, const ray_query& q, double t_min, double t_max) const {
+    if (_leaf_intersector) {
+        return _leaf_intersector->occluded_leaf(node.offset, node.num_primitives, q, t_min, t_max);
+    }
+    for (uint32_t k = node.offset; k < node.offset + node.num_primitives; k++) {
+        if (_primitives[k]->occluded(q, t_min, t_max)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool linear_bvh::create_bounding_box() {
+    return !_nodes.empty();
+}
+
+point3 linear_bvh::centroid() const {
+    return (box.min() + box.max()) / 2;
+}
+
+double linear_bvh::sah_cost() const {
+    if (_nodes.empty()) {
+        return 0.0;
+    }
+
+    const double root_area = node_area(_nodes[0]);
+    double cost = 0.0;
+    for (auto& node : _nodes) {
+        double p = node_area(node) / root_area;
+        cost += p * (node.num_primitives > 0 ? node.num_primitives : BVH_TRAVERSAL_COST);
+    }
+    return cost;
+}
+
+size_t linear_bvh::memory_bytes() const {
+    return sizeof(linear_bvh) + _nodes.capacity() * sizeof(linear_bvh_node)
+         + _primitives.capacity() * sizeof(std::shared_ptr<hittable>);
+}
+
+size_t linear_bvh::nodes_visited(const ray& r, double t_min, double t_max) const {
+    hit_record rec;
+    size_t visited = 0;
+    traverse<false>(r, t_min, t_max, rec, visited);
+    return visited;
+}
@@ -0,0 +1,32 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapped_file.h"
+
+mapped_file::mapped_file(const std::string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            _data = static_cast<const char*>(addr);
+            _size = st.st_size;
+            madvise(addr, _size, MADV_SEQUENTIAL);
+        }
+    }
+
+    // the mapping stays valid after the descriptor is closed
+    close(fd);
+}
+
+mapped_file::~mapped_file() {
+    if (_data) {
+        munmap(const_cast<char*>(_data), _size);
+    }
+}
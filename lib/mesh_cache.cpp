@@ -0,0 +1,297 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+
+#include "mesh_cache.h"
+#include "mapped_file.h"
+#include "obj_loader.h"
+#include "rng.h"
+
+static const char mesh_cache_magic[8] = { 'R', 'T', 'X', 'M', 'E', 'S', 'H', '\0' };
+static const size_t mesh_cache_alignment = 64;
+static const uint32_t MESH_CACHE_HAS_BVH = 1;
+
+// arrays are stored in their in-memory representation
+static_assert(sizeof(vec3) == 3 * sizeof(double), "vec3 must be three packed doubles");
+
+struct mesh_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+
+    // source file the cache was made from
+    uint64_t source_size;
+    int64_t source_mtime;
+    uint64_t source_hash;
+
+    uint64_t num_vertices;
+    uint64_t num_normals;
+    uint64_t num_texture_coords;
+    uint64_t num_triangles;
+    uint64_t num_bvh_nodes;
+
+    // byte offsets from the start of the file
+    uint64_t vertices_offset;
+    uint64_t normals_offset;
+    uint64_t texture_coords_offset;
+    uint64_t vertex_indices_offset;
+    uint64_t texture_indices_offset;
+    uint64_t normal_indices_offset;
+    uint64_t bvh_offset;
+};
+
+struct source_info {
+    bool exists = false;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+};
+
+static source_info stat_source(const std::string& filename) {
+    source_info info;
+    struct stat st;
+    if (stat(filename.c_str(), &st) == 0) {
+        info.exists = true;
+        info.size = static_cast<uint64_t>(st.st_size);
+        info.mtime = static_cast<int64_t>(st.st_mtime);
+    }
+    return info;
+}
+
+// word-at-a-time hash of the whole file; cheap next to parsing it
+static uint64_t hash_file(const std::string& filename) {
+    mapped_file file(filename);
+    const char* data = file.data();
+    const size_t size = file.size();
+
+    uint64_t h = mix64(size);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        h = hash_combine(h, word);
+    }
+    if (i < size) {
+        uint64_t word = 0;
+        std::memcpy(&word, data + i, size - i);
+        h = hash_combine(h, word);
+    }
+    return h;
+}
+
+static uint64_t align_offset(const uint64_t offset) {
+    return (offset + mesh_cache_alignment - 1) & ~(uint64_t)(mesh_cache_alignment - 1);
+}
+
+bool write_mesh_cache(const std::string& cache_file, const std::string& source_file, triangle_mesh& mesh) {
+
+    source_info source = stat_source(source_file);
+    if (!source.exists || !mesh.commit()) {
+        return false;
+    }
+
+    // the BVH is only reusable when it was built over the untransformed vertices
+    const bool has_bvh = mesh._transforms.empty() && mesh.node;
+    const std::vector<std::shared_ptr<hittable>>& triangles = has_bvh ? mesh.node->primitives() : mesh._triangles;
+
+    // triangles are written in BVH leaf order so the BVH can refer to them by position
+    const size_t num_triangles = triangles.size();
+    std::vector<uint32_t> vertex_indices(3 * num_triangles);
+    std::vector<uint32_t> texture_indices(3 * num_triangles);
+    std::vector<uint32_t> normal_indices(3 * num_triangles);
+    for (size_t k = 0; k < num_triangles; k++) {
+        const triangle& tri = static_cast<const triangle&>(*triangles[k]);
+        vertex_indices[3*k] = tri._vi0;
+        vertex_indices[3*k+1] = tri._vi1;
+        vertex_indices[3*k+2] = tri._vi2;
+        texture_indices[3*k] = tri._ti0;
+        texture_indices[3*k+1] = tri._ti1;
+        texture_indices[3*k+2] = tri._ti2;
+        normal_indices[3*k] = tri._has_normals ? tri._ni0 : NO_INDEX;
+        normal_indices[3*k+1] = tri._has_normals ? tri._ni1 : NO_INDEX;
+        normal_indices[3*k+2] = tri._has_normals ? tri._ni2 : NO_INDEX;
+    }
+
+    mesh_cache_header header = {};
+    std::memcpy(header.magic, mesh_cache_magic, sizeof(mesh_cache_magic));
+    header.version = MESH_CACHE_VERSION;
+    header.flags = has_bvh ? MESH_CACHE_HAS_BVH : 0;
+    header.source_size = source.size;
+    header.source_mtime = source.mtime;
+    header.source_hash = hash_file(source_file);
+    header.num_vertices = mesh._vertices.size();
+    header.num_normals = mesh._normals.size();
+    header.num_texture_coords = mesh._texture_coords.size();
+    header.num_triangles = num_triangles;
+    header.num_bvh_nodes = has_bvh ? mesh.node->nodes().size() : 0;
+
+    // lay out the sections
+    struct section {
+        uint64_t* offset;
+        const void* data;
+        size_t bytes;
+    };
+    const section sections[] = {
+        { &header.vertices_offset, mesh._vertices.data(), mesh._vertices.size() * sizeof(point3) },
+        { &header.normals_offset, mesh._normals.data(), mesh._normals.size() * sizeof(vec3) },
+        { &header.texture_coords_offset, mesh._texture_coords.data(), mesh._texture_coords.size() * sizeof(vec3) },
+        { &header.vertex_indices_offset, vertex_indices.data(), vertex_indices.size() * sizeof(uint32_t) },
+        { &header.texture_indices_offset, texture_indices.data(), texture_indices.size() * sizeof(uint32_t) },
+        { &header.normal_indices_offset, normal_indices.data(), normal_indices.size() * sizeof(uint32_t) },
+        { &header.bvh_offset, has_bvh ? mesh.node->nodes().data() : nullptr, header.num_bvh_nodes * sizeof(linear_bvh_node) },
+    };
+
+    uint64_t offset = align_offset(sizeof(header));
+    for (const section& s : sections) {
+        *s.offset = offset;
+        offset = align_offset(offset + s.bytes);
+    }
+
+    // write to a temporary name and rename, so concurrent readers never see a partial file
+    const std::string tmp_file = cache_file + ".tmp";
+    {
+        std::ofstream out(tmp_file, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            return false;
+        }
+
+        static const char zeros[mesh_cache_alignment] = {};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        uint64_t written = sizeof(header);
+        for (const section& s : sections) {
+            out.write(zeros, *s.offset - written);
+            out.write(static_cast<const char*>(s.data), s.bytes);
+            written = *s.offset + s.bytes;
+        }
+
+        if (!out) {
+            std::remove(tmp_file.c_str());
+            return false;
+        }
+    }
+
+    if (std::rename(tmp_file.c_str(), cache_file.c_str()) != 0) {
+        std::remove(tmp_file.c_str());
+        return false;
+    }
+    return true;
+}
+
+// true if count elements of element_size bytes starting at offset lie within the file, without overflowing
+static bool section_in_file(const uint64_t offset, const uint64_t count, const size_t element_size, const size_t file_size) {
+    return offset <= file_size && count <= (file_size - offset) / element_size;
+}
+
+// true if every triangle's three indices refer into an array of count elements; optional indices may instead be all NO_INDEX
+static bool indices_in_range(const std::vector<uint32_t>& indices, const uint64_t count, const bool optional) {
+    for (size_t k = 0; k + 2 < indices.size(); k += 3) {
+        const uint32_t* tri = &indices[k];
+        if (optional && tri[0] == NO_INDEX && tri[1] == NO_INDEX && tri[2] == NO_INDEX) {
+            continue;
+        }
+        if (tri[0] >= count || tri[1] >= count || tri[2] >= count) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template<class T>
+static std::vector<T> read_array(const char* data, const uint64_t offset, const uint64_t count) {
+    std::vector<T> values(count);
+    if (count > 0) {
+        std::memcpy(values.data(), data + offset, count * sizeof(T));   // data() may be null when empty
+    }
+    return values;
+}
+
+std::shared_ptr<triangle_mesh> load_mesh_cache(const std::string& cache_file, const std::string& source_file,
+                                               std::shared_ptr<material> mat) {
+
+    mapped_file file(cache_file);
+    if (!file.is_open() || file.size() < sizeof(mesh_cache_header)) {
+        return nullptr;
+    }
+
+    mesh_cache_header header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, mesh_cache_magic, sizeof(mesh_cache_magic)) != 0 || header.version != MESH_CACHE_VERSION) {
+        return nullptr;
+    }
+
+    // a source that is no longer around cannot invalidate the cache, e.g. when only caches are deployed
+    source_info source = stat_source(source_file);
+    if (source.exists) {
+        if (source.size != header.source_size) {
+            return nullptr;
+        }
+        // same size and timestamp is taken as unchanged, anything else is settled by the content hash
+        if (source.mtime != header.source_mtime && hash_file(source_file) != header.source_hash) {
+            return nullptr;
+        }
+    }
+
+    const size_t size = file.size();
+    const uint64_t num_indices = 3 * header.num_triangles;
+    // bounding num_triangles by the file size also keeps num_indices from overflowing
+    if (header.num_triangles > size ||
+        !section_in_file(header.vertices_offset, header.num_vertices, sizeof(point3), size) ||
+        !section_in_file(header.normals_offset, header.num_normals, sizeof(vec3), size) ||
+        !section_in_file(header.texture_coords_offset, header.num_texture_coords, sizeof(vec3), size) ||
+        !section_in_file(header.vertex_indices_offset, num_indices, sizeof(uint32_t), size) ||
+        !section_in_file(header.texture_indices_offset, num_indices, sizeof(uint32_t), size) ||
+        !section_in_file(header.normal_indices_offset, num_indices, sizeof(uint32_t), size) ||
+        !section_in_file(header.bvh_offset, header.num_bvh_nodes, sizeof(linear_bvh_node), size)) {
+        return nullptr;
+    }
+
+    const char* data = file.data();
+    triangle_indices indices;
+    indices.vertex_indices = read_array<uint32_t>(data, header.vertex_indices_offset, num_indices);
+    indices.texture_indices = read_array<uint32_t>(data, header.texture_indices_offset, num_indices);
+    indices.normal_indices = read_array<uint32_t>(data, header.normal_indices_offset, num_indices);
+
+    // a corrupt cache must not index past the arrays it came with; the caller falls back to the OBJ
+    if (!indices_in_range(indices.vertex_indices, header.num_vertices, false) ||
+        !indices_in_range(indices.normal_indices, header.num_normals, true) ||
+        !indices_in_range(indices.texture_indices, header.num_texture_coords, true)) {
+        return nullptr;
+    }
+
+    auto mesh = std::make_shared<triangle_mesh>(read_array<point3>(data, header.vertices_offset, header.num_vertices),
+                                                read_array<vec3>(data, header.normals_offset, header.num_normals),
+                                                read_array<vec3>(data, header.texture_coords_offset, header.num_texture_coords),
+                                                indices, mat);
+
+    if ((header.flags & MESH_CACHE_HAS_BVH) && header.num_bvh_nodes > 0) {
+        std::vector<linear_bvh_node> nodes = read_array<linear_bvh_node>(data, header.bvh_offset, header.num_bvh_nodes);
+        // leaves stay within the triangles, interior nodes have both children after them (depth-first order)
+        for (size_t i = 0; i < nodes.size(); i++) {
+            const linear_bvh_node& node = nodes[i];
+            const bool valid = node.num_primitives > 0
+                ? node.offset + (uint64_t)node.num_primitives <= header.num_triangles
+                : node.offset > i + 1 && node.offset < nodes.size() && node.axis < 3;
+            if (!valid) {
+                return nullptr;
+            }
+        }
+        mesh->_cached_bvh = std::make_shared<linear_bvh>(std::move(nodes), mesh->_triangles);
+    }
+    return mesh;
+}
+
+std::shared_ptr<triangle_mesh> get_triangle_mesh_cached(const std::string& obj_file, std::shared_ptr<material> mat) {
+    const std::string cache_file = obj_file + ".rtxmesh";
+
+    auto mesh = load_mesh_cache(cache_file, obj_file, mat);
+    if (mesh) {
+        return mesh;
+    }
+
+    mesh = get_triangle_mesh_from_file(obj_file, mat);
+    if (!write_mesh_cache(cache_file, obj_file, *mesh)) {
+        std::cerr << "Could not write mesh cache " << cache_file << std::endl;
+    }
+    return mesh;
+}
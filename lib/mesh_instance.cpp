@@ -0,0 +1,73 @@
+#include "mesh_instance.h"
+
+bool mesh_instance::hit(const ray_query& q, double t_min, double t_max, hit_record& rec) const {
+
+    const ray& r = q.r;
+    if (!box.hit(q, t_min, t_max)) {
+        return false;
+    }
+
+    // ray directions are unit length, so distances scale by the length of the
+    // direction once it is moved into object space; the object-space ray needs a query of its own
+    vec3 object_direction = _world_to_object.apply_vector(r.direction());
+    double scale = object_direction.length();
+    ray object_ray(_world_to_object.apply_point(r.origin()), object_direction, r.time());
+
+    if (!_object->hit(object_ray, t_min * scale, t_max * scale, rec)) {
+        return false;
+    }
+
+    // normals map through the inverse transpose; front_face is preserved by the mapping
+    rec.t /= scale;
+    rec.p = r.at(rec.t);
+    rec.n = unit_vector(_world_to_object.apply_transpose(rec.n));
+    rec.uv_scale *= scale;
+    if (_mat_id != NO_MATERIAL) {
+        rec.mat_id = _mat_id;
+    }
+    // lights are made from the shared geometry's own placement, not from instances
+    rec.emitter = NO_LIGHT;
+    return true;
+}
+
+bool mesh_instance::occluded(const ray_query& q, double t_min, double t_max) const {
+
+    const ray& r = q.r;
+    if (!box.hit(q, t_min, t_max)) {
+        return false;
+    }
+
+    vec3 object_direction = _world_to_object.apply_vector(r.direction());
+    double scale = object_direction.length();
+    ray object_ray(_world_to_object.apply_point(r.origin()), object_direction, r.time());
+    return _object->occluded(object_ray, t_min * scale, t_max * scale);
+}
+
+bool mesh_instance::create_bounding_box() {
+    aabb object_box = _object->get_bounding_box();
+
+    // bound the eight transformed corners of the object-space box
+    point3 lo(INF, INF, INF), hi(-INF, -INF, -INF);
+    for (int corner = 0; corner < 8; corner++) {
+        point3 p((corner & 1) ? object_box.max().x() : object_box.min().x(),
+                 (corner & 2) ? object_box.max().y() : object_box.min().y(),
+                 (corner & 4) ? object_box.max().z() : object_box.min().z());
+        p = _object_to_world.apply_point(p);
+        for (int a = 0; a < 3; a++) {
+            lo[a] = std::fmin(lo[a], p[a]);
+            hi[a] = std::fmax(hi[a], p[a]);
+        }
+    }
+
+    this->box = aabb(lo, hi);
+    return true;
+}
+
+point3 mesh_instance::centroid() const {
+    return (box.min() + box.max()) / 2;
+}
+
+bool mesh_instance::commit() {
+    // shared geometry is only built by the first instance to commit it
+    return _object->commit() && create_bounding_box();
+}
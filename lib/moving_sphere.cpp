@@ -1,17 +1,53 @@
 #include "moving_sphere.h"
+#include "material.h"
 
-bool moving_sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool moving_sphere::hit(const ray_query& q, double t_min, double t_max, hit_record& rec) const {
+    const ray& r = q.r;
 
-    if (!box.hit(r, t_min, t_max)) {
+    if (!box.hit(q, t_min, t_max)) {
         return false;
     }
     
+    double root;
+    if (!intersect(r, t_min, t_max, root)) {
+        return false;
+    }
+
+    rec.t = root;
+    rec.p = r.at(rec.t);
+    vec3 outward_normal = (rec.p - center(r.time())) / radius;
+    rec.set_face_normal(r, outward_normal);
+    rec.mat_id = _mat_id;
+    rec.emitter = NO_LIGHT;     // lights do not move, so emission is only found by hitting it
+
+    if (_textured) {
+        // longitude around y from +x, and latitude from the south pole; 2 pi r by pi r in world units
+        const double theta = std::acos(clamp(-outward_normal.y(), -1.0, 1.0));
+        const double phi = std::atan2(-outward_normal.z(), outward_normal.x()) + PI;
+        rec.u = phi / (2.0 * PI);
+        rec.v = theta / PI;
+        rec.uv_scale = 1.0 / (PI * std::fabs(radius) * std::sqrt(2.0));
+    }
+    
+    return true;
+};
+
+bool moving_sphere::occluded(const ray_query& q, double t_min, double t_max) const {
+    if (!box.hit(q, t_min, t_max)) {
+        return false;
+    }
+
+    double root;
+    return intersect(q.r, t_min, t_max, root);
+}
+
+bool moving_sphere::intersect(const ray& r, double t_min, double t_max, double& nearest) const {
     const vec3 oc = r.origin() - center(r.time());
     const float a = r.direction().length_squared();
     const float half_b = dot(r.direction(), oc);
     const float c = oc.length_squared() - radius * radius;
     const float discriminant = half_b * half_b - a * c;
-    
+
     if (discriminant < 0) return false;
     auto sqrtd = sqrt(discriminant);
     auto root = (-half_b - sqrtd) / a;
@@ -21,15 +57,9 @@ bool moving_sphere::hit(const ray& r, double t_min, double t_max, hit_record& re
             return false;
         }
     }
-
-    rec.t = root;
-    rec.p = r.at(rec.t);
-    vec3 outward_normal = (rec.p - center(r.time())) / radius;
-    rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mat_ptr;
-    
+    nearest = root;
     return true;
-};
+}
 
 bool moving_sphere::create_bounding_box() {
     // assumes that sphere moves in straight line defined by lerp
@@ -53,4 +83,8 @@ point3 moving_sphere::centroid() const {
 
 bool moving_sphere::commit() {
     return create_bounding_box();
-}
\ No newline at end of file
+}
+void moving_sphere::bind_materials(material_table& table) {
+    _mat_id = table.add(mat_ptr);
+    _textured = mat_ptr && mat_ptr->is_textured();
+}
@@ -1,126 +1,228 @@
-#include <iostream>
-#include <vector>
-#include <fstream>
-#include <sstream>
-#include <string>
-#include <map>
+#include <algorithm>
+#include <charconv>
 #include <exception>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "obj_loader.h"
+#include "mapped_file.h"
+
+// The file is memory-mapped and split into line-aligned chunks that are parsed
+// in parallel. OBJ indices are absolute, so the per-chunk arrays can simply be
+// concatenated afterwards.
+
+static const size_t min_chunk_size = 1 << 20;
 
-typedef enum OBJElement {
-    VERTEX,
-    NORMAL,
-    TEXTURE,
-    FACE
-} OBJElement;
-
-static std::map<std::string, OBJElement> string_to_obj_element {
-    { "v", VERTEX },
-    { "vn", NORMAL },
-    { "vt", TEXTURE },
-    { "f", FACE }
+struct obj_chunk {
+    std::vector<point3> vertices;
+    std::vector<vec3> normals;
+    std::vector<vec3> texture_coords;
+    triangle_indices indices;
 };
 
-inline point3 read_vertex(std::vector<std::string>& tokens) {
-    point3 v(std::stod(tokens[1]), std::stod(tokens[2]), std::stod(tokens[3]));
-    return v;
+static inline bool is_blank(const char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char* skip_blanks(const char* p, const char* end) {
+    while (p < end && is_blank(*p)) p++;
+    return p;
+}
+
+// parse the next number on the line, returns false at end of line or on a comment
+static inline bool read_double(const char*& p, const char* end, double& value) {
+    p = skip_blanks(p, end);
+    if (p < end && *p == '+') p++;
+    if (p >= end || *p == '#') return false;
+
+    auto result = std::from_chars(p, end, value);
+    if (result.ec != std::errc()) {
+        throw std::runtime_error("Failed to parse number in OBJ file");
+    }
+    p = result.ptr;
+    return true;
 }
 
-inline vec3 read_normal(std::vector<std::string>& tokens) {
-    vec3 n(std::stod(tokens[1]), std::stod(tokens[2]), std::stod(tokens[3]));
+static inline int read_doubles(const char* p, const char* end, double* values, const int max_values) {
+    int n = 0;
+    double value;
+    while (read_double(p, end, value)) {
+        if (n < max_values) values[n] = value;
+        n++;
+    }
     return n;
 }
 
-inline vec3 read_texture_coords(std::vector<std::string>& tokens) {
-    vec3 t;
-    if (tokens.size() == 3) {
-        t = vec3{std::stod(tokens[1]), std::stod(tokens[2]), 0};
-    } else if (tokens.size() == 4) {
-        t = vec3{std::stod(tokens[1]), std::stod(tokens[2]), std::stod(tokens[3])};
-    } else {
-        throw std::runtime_error("Received texture coordinates that are neither 2D nor 3D");
+static inline uint32_t read_index(const char*& p, const char* end) {
+    long index = 0;
+    auto result = std::from_chars(p, end, index);
+    if (result.ec != std::errc()) {
+        throw std::runtime_error("Failed to parse face index in OBJ file");
     }
-    return t;
+    p = result.ptr;
+    return static_cast<uint32_t>(index - 1);
 }
 
-inline face read_face(std::vector<std::string>& tokens) {
-    
+static void read_face(const char* p, const char* end, triangle_indices& indices) {
+
     // face tokens are further delimited by '/'
     // f 1/2/3 means "face with vertex index 1, texture index 2, normal index 3"
-    std::vector<uint32_t> vertex_indices;
-    std::vector<uint32_t> normal_indices;
-    std::vector<uint32_t> texture_indices;
-
-    for (int i = 1; i < tokens.size(); i++) {
-        std::string token = tokens[i];
-        std::istringstream iss(token);
-
-        // parse token for '/'-delimited sub-tokens
-        std::vector<std::string> indices;
-        for (std::string index; std::getline(iss, index, '/'); ) {
-            indices.push_back(index);
+    // only the first three corners of a polygon are kept
+    uint32_t v[3], t[3] = { NO_INDEX, NO_INDEX, NO_INDEX }, n[3] = { NO_INDEX, NO_INDEX, NO_INDEX };
+    int corners = 0;
+
+    while (true) {
+        p = skip_blanks(p, end);
+        if (p >= end || *p == '#') break;
+
+        uint32_t vi = read_index(p, end), ti = NO_INDEX, ni = NO_INDEX;
+        if (p < end && *p == '/') {
+            p++;
+            if (p < end && *p != '/' && !is_blank(*p)) ti = read_index(p, end);
+            if (p < end && *p == '/') {
+                p++;
+                ni = read_index(p, end);
+            }
+        }
+
+        if (corners < 3) {
+            v[corners] = vi;
+            t[corners] = ti;
+            n[corners] = ni;
+        }
+        corners++;
+    }
+
+    if (corners < 3) {
+        throw std::runtime_error("Received face with fewer than three vertices");
+    }
+
+    // normals / texture coordinates are only used when every corner has one
+    bool has_normals = n[0] != NO_INDEX && n[1] != NO_INDEX && n[2] != NO_INDEX;
+    bool has_texture = t[0] != NO_INDEX && t[1] != NO_INDEX && t[2] != NO_INDEX;
+    for (int k = 0; k < 3; k++) {
+        indices.vertex_indices.push_back(v[k]);
+        indices.normal_indices.push_back(has_normals ? n[k] : NO_INDEX);
+        indices.texture_indices.push_back(has_texture ? t[k] : NO_INDEX);
+    }
+}
+
+static void parse_chunk(const char* begin, const char* end, obj_chunk& chunk) {
+
+    double values[3];
+    for (const char* line = begin; line < end; ) {
+        const char* line_end = std::find(line, end, '\n');
+        const char* p = skip_blanks(line, line_end);
+
+        if (line_end - p >= 2 && p[0] == 'v' && is_blank(p[1])) {
+            if (read_doubles(p + 2, line_end, values, 3) < 3) {
+                throw std::runtime_error("Received vertex with fewer than three coordinates");
+            }
+            chunk.vertices.push_back(point3(values[0], values[1], values[2]));
+        } else if (line_end - p >= 3 && p[0] == 'v' && p[1] == 'n' && is_blank(p[2])) {
+            if (read_doubles(p + 3, line_end, values, 3) < 3) {
+                throw std::runtime_error("Received normal with fewer than three coordinates");
+            }
+            chunk.normals.push_back(vec3(values[0], values[1], values[2]));
+        } else if (line_end - p >= 3 && p[0] == 'v' && p[1] == 't' && is_blank(p[2])) {
+            int n = read_doubles(p + 3, line_end, values, 3);
+            if (n == 2) {
+                chunk.texture_coords.push_back(vec3(values[0], values[1], 0));
+            } else if (n == 3) {
+                chunk.texture_coords.push_back(vec3(values[0], values[1], values[2]));
+            } else {
+                throw std::runtime_error("Received texture coordinates that are neither 2D nor 3D");
+            }
+        } else if (line_end - p >= 2 && p[0] == 'f' && is_blank(p[1])) {
+            read_face(p + 2, line_end, chunk.indices);
         }
 
-        vertex_indices.push_back(std::stoi(indices[0]) - 1);
-        if (indices.size() >= 2 && !indices[1].empty()) texture_indices.push_back(std::stoi(indices[1]) - 1);
-        if (indices.size() == 3) normal_indices.push_back(std::stoi(indices[2]) - 1);
-            
+        if (line_end == end) break;
+        line = line_end + 1;
     }
+}
 
-    face f;
-    f.vertex_indices = vertex_indices;
-    f.normal_indices = normal_indices;
-    return f;
+template<class T>
+static void append(std::vector<T>& dst, const std::vector<T>& src) {
+    dst.insert(dst.end(), src.begin(), src.end());
 }
 
 std::shared_ptr<triangle_mesh> get_triangle_mesh_from_file(std::string filename, std::shared_ptr<material> mat) {
 
-    std::ifstream infile(filename);
+    mapped_file file(filename);
+    const char* data = file.data();
+    const char* data_end = data + file.size();
+
+    // split into line-aligned chunks, one per thread
+    size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t num_chunks = std::max<size_t>(1, std::min(num_threads, file.size() / min_chunk_size));
 
+    std::vector<const char*> bounds(1, data);
+    for (size_t c = 1; c < num_chunks; c++) {
+        const char* split = std::max(bounds.back(), data + c * (file.size() / num_chunks));
+        split = std::find(split, data_end, '\n');
+        bounds.push_back(split < data_end ? split + 1 : data_end);
+    }
+    bounds.push_back(data_end);
+
+    // parse chunks in parallel, keeping the first error to rethrow on this thread
+    std::vector<obj_chunk> chunks(num_chunks);
+    std::vector<std::exception_ptr> errors(num_chunks);
+    std::vector<std::thread> threads;
+    for (size_t c = 0; c < num_chunks; c++) {
+        threads.push_back(std::thread([&, c]() {
+            try {
+                parse_chunk(bounds[c], bounds[c+1], chunks[c]);
+            } catch (...) {
+                errors[c] = std::current_exception();
+            }
+        }));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (auto& error : errors) {
+        if (error) std::rethrow_exception(error);
+    }
+
+    // merge
     std::vector<point3> vertices;
     std::vector<vec3> normals;
     std::vector<vec3> texture_coords;
-    std::vector<face> faces;
+    triangle_indices indices;
 
-    for (std::string line; std::getline(infile, line); ) {
-
-        // retrieve line from file
-        std::istringstream iss(line);
-        std::vector<std::string> tokens;
-
-        // split into tokens
-        for (std::string token; std::getline(iss, token, ' '); ) {
-            if (token.empty()) continue;
-            if (token[0] == '#') break;
-            
-            tokens.push_back(token);
+    if (num_chunks == 1) {
+        vertices = std::move(chunks[0].vertices);
+        normals = std::move(chunks[0].normals);
+        texture_coords = std::move(chunks[0].texture_coords);
+        indices = std::move(chunks[0].indices);
+    } else {
+        size_t num_vertices = 0, num_normals = 0, num_texture_coords = 0, num_indices = 0;
+        for (auto& chunk : chunks) {
+            num_vertices += chunk.vertices.size();
+            num_normals += chunk.normals.size();
+            num_texture_coords += chunk.texture_coords.size();
+            num_indices += chunk.indices.vertex_indices.size();
         }
-
-        // read mesh data
-        for (int i = 0; i < tokens.size(); i++) {
-            std::string token = tokens[i];
-
-            if (i==0) {
-                if (string_to_obj_element.find(token) == string_to_obj_element.end()) break;
-                switch(string_to_obj_element[token]) {
-                    case VERTEX:
-                        vertices.push_back(read_vertex(tokens));
-                        break;
-                    case TEXTURE:
-                        texture_coords.push_back(read_texture_coords(tokens));
-                        break;
-                    case NORMAL:
-                        normals.push_back(read_normal(tokens));
-                        break;
-                    case FACE:
-                        faces.push_back(read_face(tokens));
-                        break;
-                }
-            }
+        vertices.reserve(num_vertices);
+        normals.reserve(num_normals);
+        texture_coords.reserve(num_texture_coords);
+        indices.vertex_indices.reserve(num_indices);
+        indices.normal_indices.reserve(num_indices);
+        indices.texture_indices.reserve(num_indices);
+
+        for (auto& chunk : chunks) {
+            append(vertices, chunk.vertices);
+            append(normals, chunk.normals);
+            append(texture_coords, chunk.texture_coords);
+            append(indices.vertex_indices, chunk.indices.vertex_indices);
+            append(indices.normal_indices, chunk.indices.normal_indices);
+            append(indices.texture_indices, chunk.indices.texture_indices);
         }
     }
 
-    auto mesh = std::make_shared<triangle_mesh>(vertices, normals, texture_coords, faces, mat);
+    auto mesh = std::make_shared<triangle_mesh>(std::move(vertices), std::move(normals), std::move(texture_coords), indices, mat);
     return mesh;
-}
\ No newline at end of file
+}
@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -5,117 +9,457 @@
 
 #include "renderer.h"
 
-color renderer::ray_color(const ray& r, const hittable_list& world, const int depth) {
+// Tiles left to render in each row of tiles, so output can follow the render down
+// the image; with a window, also holds back tiles more than that many rows below
+// the first row not yet written out
+struct band_progress {
+    band_progress(const unsigned int width, const unsigned int height, const unsigned int tile_size, const unsigned int window)
+        : tile_size(std::max(1u, tile_size)), window(window),
+          remaining((height + this->tile_size - 1) / this->tile_size, (width + this->tile_size - 1) / this->tile_size) {}
 
-    if (depth <= 0) {
-        return color(0,0,0);
+    void tile_done(const tile& t) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (--remaining[t.y0 / tile_size] == 0) {
+            changed.notify_all();
+        }
     }
 
-    hit_record rec;
-    if (world.hit(r, 0.001, INF, rec)) {
-        ray scattered;
-        color attenuation;
-        if (rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
-            return attenuation * ray_color(scattered, world, depth - 1);
+    void wait(const unsigned int band) {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [&]() { return remaining[band] == 0; });
+    }
+
+    /* block until the framebuffer has room for the row of tiles t is in */
+    void wait_for_room(const tile& t) {
+        if (window == 0) {
+            return;
         }
-        return color(0,0,0);
+        const size_t rows_above = remaining.size() - 1 - t.y0 / tile_size;
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [&]() { return written + window > rows_above; });
+    }
+
+    /* the writer is done with the next row of tiles from the top */
+    void band_written() {
+        std::lock_guard<std::mutex> guard(lock);
+        written++;
+        changed.notify_all();
     }
 
+    const unsigned int tile_size;
+    const unsigned int window;              // rows of tiles in memory, 0 for all
+    std::vector<unsigned int> remaining;    // by row of tiles, counted from the bottom like framebuffer rows
+    size_t written = 0;                     // rows of tiles written out, from the top
+    std::mutex lock;
+    std::condition_variable changed;
+};
+
+color renderer::background_color(const ray& r) const {
+    if (!_sky) {
+        return _background;
+    }
     vec3 unit_direction = unit_vector(r.direction());
     float t = 0.5*(unit_direction.y() + 1.0);
-    return (1.0-t)*color(1.0, 1.0, 1.0) + t*color(0.5, 0.7, 1.0);   
-
+    return (1.0-t)*color(1.0, 1.0, 1.0) + t*color(0.5, 0.7, 1.0);
 }
 
-void renderer::thread_compute_pixel_colors(
-    const std::vector<std::pair<int, int>>& perThreadPixelPos,
-    std::vector<std::vector<color>>& frameBuffer) {
+color renderer::ray_color(const ray& r_in, const hittable_list& world, const unsigned int max_depth, path_stats& stats) {
+
+    color radiance(0,0,0);
+    color throughput(1,1,1);
+    ray r = r_in;
+    const light_list& lights = world.lights();
+
+    // density of the BSDF sample that produced r, and where it was taken; 0 after the
+    // camera and specular bounces, whose paths lights could not have been sampled for
+    double scatter_pdf = 0.0;
+    hit_record prev;
+
+    // ray cone for texture filtering: as wide as a pixel at the camera, then as wide as the
+    // BSDF lobe a diffuse bounce chose from (Akenine-Moller et al., "Texture Level of Detail
+    // Strategies for Real-Time Ray Tracing", 2019)
+    double cone_width = 0.0, cone_spread = _pixel_spread;
+
+    stats.paths++;
+    for (unsigned int bounce = 0; bounce < max_depth; bounce++) {
+
+        // each bounce draws from its own stream so path prefixes stay reproducible
+        counter_rng& rng = thread_rng();
+        rng.start_bounce(bounce + 1);
+        stats.segments++;
+
+        hit_record rec;
+        if (!world.hit(r, 0.001, INF, rec)) {
+            // path escaped, collect light from the environment (weighed like emission below) or the background
+            const light* env = lights.get(lights.environment());
+            if (env) {
+                const vec3 w = unit_vector(r.direction());
+                double weight = 1.0;
+                if (scatter_pdf > 0.0) {
+                    const double light_pdf = lights.pmf(prev.p, prev.n, lights.environment()) * env->pdf(prev.p, prev.p + w, w);
+                    weight = power_heuristic(scatter_pdf, light_pdf);
+                }
+                radiance += weight * throughput * env->environment(w);
+            } else {
+                radiance += throughput * background_color(r);
+            }
+            break;
+        }
+
+        const material* mat = world.materials().get(rec.mat_id);
+        if (!mat) {
+            break;
+        }
+
+        // seen at a grazing angle the footprint stretches along the surface
+        cone_width += cone_spread * rec.t;
+        rec.footprint = cone_width / std::fmax(std::fabs(dot(r.direction(), rec.n)), 0.1);
+
+        // emission found by the BSDF sample, weighed against the shadow ray that could have found it
+        if (rec.front_face) {
+            const color emitted = mat->emission();
+            if (emitted.x() > 0 || emitted.y() > 0 || emitted.z() > 0) {
+                const light* l = lights.get(rec.emitter);
+                double weight = 1.0;
+                if (scatter_pdf > 0.0 && l) {
+                    const double light_pdf = lights.pmf(prev.p, prev.n, rec.emitter) * l->pdf(prev.p, rec.p, rec.n);
+                    weight = power_heuristic(scatter_pdf, light_pdf);
+                }
+                radiance += weight * throughput * emitted;
+            }
+        }
+
+        ray scattered;
+        color attenuation;
+        double pdf;
+        const bool scatters = mat->scatter(r, rec, attenuation, scattered, pdf);
+
+        // next-event estimation: one shadow ray towards a light chosen by the light BVH
+        if (!lights.empty()) {
+            rng.skip_to_dimension(SAMPLER_LIGHT_OFFSET);
+            const double u = random_double(), v = random_double();
+            const double choice = random_double();
 
-    for (auto& pixelPos : perThreadPixelPos) {
-        color pixel_color(0,0,0);
-        int j = pixelPos.first;
-        int i = pixelPos.second;
+            double pmf;
+            light_sample ls;
+            const light* l = lights.sample(rec.p, rec.n, choice, pmf);
+            if (l && pmf > 0.0 && l->sample(rec.p, u, v, ls)) {
+                const color f = mat->eval(r, rec, ls.wi);
+                if (f.x() > 0 || f.y() > 0 || f.z() > 0) {
+                    // stop short of the sampled point, which is on the light's own surface
+                    stats.shadow_rays++;
+                    const ray shadow(rec.p, ls.wi, r.time(), ray::unit_tag());
+                    if (!world.occluded(shadow, 0.001, ls.distance * (1.0 - 1e-6) - 0.001)) {
+                        const double light_pdf = pmf * ls.pdf;
+                        const double weight = l->is_delta() ? 1.0 : power_heuristic(light_pdf, mat->pdf(r, rec, ls.wi));
+                        radiance += (weight / light_pdf) * throughput * f * ls.radiance;
+                    }
+                }
+            }
+        }
 
-        for (int s = 0; s < _samples_per_pixel; s++) {
-            auto u = double(i + random_double()) / (_image_width - 1);
-            auto v = double(j + random_double()) / (_image_height - 1);
+        if (!scatters) {
+            break;
+        }
+        throughput *= attenuation;
+        r = scattered;
+        scatter_pdf = pdf;
+        prev = rec;
+        if (pdf > 0.0) {
+            // a sample stands for about 1 / pdf steradians around it
+            cone_spread = std::fmax(cone_spread, std::fmin(1.0 / std::sqrt(pdf), 1.0));
+        }
 
-            ray r = _cam.ray_at(u, v);
-            pixel_color += ray_color(r, _scene, _max_depth);
+        // russian roulette: terminate dim paths with probability 1 - q and
+        // boost survivors by 1/q, which keeps the estimate unbiased
+        if (bounce + 1 >= _rr_depth) {
+            double q = std::fmin(std::fmax(throughput.x(), std::fmax(throughput.y(), throughput.z())), 1.0);
+            rng.skip_to_dimension(SAMPLER_ROULETTE_OFFSET);
+            if (random_double() >= q) {
+                stats.roulette_terminations++;
+                break;
+            }
+            throughput /= q;
         }
-        frameBuffer[j][i] = pixel_color;
-    }  
+    }
 
+    return radiance;
 }
 
-void renderer::write_color(const std::string& outputFile, const std::vector<std::vector<color>>& frameBuffer) const {
+void renderer::compute_tile(const tile& t, path_stats& stats) {
 
-    std::cerr << "Writing data to disk" << std::endl;
-    const int num_channels = 3;
-    const float scale = 1.0f / _samples_per_pixel;
+    counter_rng& rng = thread_rng();
 
-    uint8_t* data = new uint8_t[_image_width * _image_height * num_channels];
-    // std::cerr << "Data size: " << _image_width * _image_height * num_channels;
+    const bool adaptive = _adaptive_threshold > 0.0;
+    const unsigned int min_samples = adaptive ? _min_spp : _samples_per_pixel;
+    const unsigned int max_samples = adaptive ? _max_spp : _samples_per_pixel;
 
-    int index = 0;
-    for (int j = _image_height - 1; j >= 0; --j) {
-        for (int i = 0; i < _image_width; ++i) {
+    // tiles are in framebuffer coordinates, pixels (i, j) in image coordinates
+    for (unsigned int y = t.y0; y < t.y1; y++) {
+        for (unsigned int x = t.x0; x < t.x1; x++) {
+            const unsigned int i = _origin_x + x;
+            const unsigned int j = _origin_y + y;
+            color pixel_color(0,0,0);
+            rng.use_sampler(_sampler.get(), i, j);
+            const uint64_t pixel_index = uint64_t(j) * _image_width + i;
+
+            // running mean and sum of squared deviations of the sample luminance (Welford)
+            double mean = 0.0, m2 = 0.0;
 
-            auto pixelColor = frameBuffer[j][i];
-            float r = pixelColor.x();
-            float g = pixelColor.y();
-            float b = pixelColor.z();
+            unsigned int s = 0;
+            while (s < max_samples) {
+                rng.start_pixel_sample(_seed, pixel_index, s);
 
-            r = std::sqrt(r * scale);
-            g = std::sqrt(g * scale);
-            b = std::sqrt(b * scale);
+                auto u = double(i + random_double()) / (_image_width - 1);
+                auto v = double(j + random_double()) / (_image_height - 1);
 
-            int ir = int(255.99 * clamp(r, 0.0f, 0.999f));
-            int ig = int(255.99 * clamp(g, 0.0f, 0.999f));
-            int ib = int(255.99 * clamp(b, 0.0f, 0.999f));
+                ray r = _cam.ray_at(u, v);
+                color sample = ray_color(r, _scene, _max_depth, stats);
+                pixel_color += sample;
+                s++;
 
-            //std::cerr << index << ", " << data[index];
-            data[index++] = ir;
-            data[index++] = ig;
-            data[index++] = ib;
+                if (adaptive) {
+                    const double y = luminance(sample);
+                    const double delta = y - mean;
+                    mean += delta / s;
+                    m2 += delta * (y - mean);
+
+                    // standard error of the mean, carried through the sqrt gamma of the output
+                    // (d sqrt(x) = dx / 2 sqrt(x)), so dark pixels are not held to a stricter bound
+                    if (s >= min_samples) {
+                        const double std_error = std::sqrt(m2 / (double(s - 1) * s));
+                        if (std_error < 2.0 * std::sqrt(std::max(mean, 1e-3)) * _adaptive_threshold) {
+                            break;
+                        }
+                    }
+                }
+            }
+            framebuffer_pixel& pixel = _frame.at(x, y);
+            pixel.rgb[0] = pixel_color.x() / s;
+            pixel.rgb[1] = pixel_color.y() / s;
+            pixel.rgb[2] = pixel_color.z() / s;
+            pixel.samples = s;
+            stats.min_pixel_samples = std::min(stats.min_pixel_samples, s);
+            stats.max_pixel_samples = std::max(stats.max_pixel_samples, s);
         }
     }
+    rng.use_sampler(nullptr, 0, 0);
+}
+
+void renderer::thread_compute_pixel_colors(const unsigned int thread_id, tile_scheduler& scheduler, band_progress* progress) {
 
-    try {
-        stbi_write_png(outputFile.c_str(), _image_width, _image_height, num_channels, data, _image_width * num_channels);
-    } catch (std::exception& e) {
-        std::cerr << e.what() << std::endl;
+    using clock = std::chrono::steady_clock;
+    thread_stats& stats = _thread_stats[thread_id];
+    path_stats& paths = _thread_path_stats[thread_id];
+
+    tile t;
+    bool stolen;
+    while (true) {
+        auto fetch_start = clock::now();
+        bool found = scheduler.next_tile(thread_id, t, stolen);
+        if (found && progress) {
+            progress->wait_for_room(t);
+        }
+        auto fetch_end = clock::now();
+        stats.idle_seconds += std::chrono::duration<double>(fetch_end - fetch_start).count();
+
+        if (!found) {
+            break;
+        }
+
+        compute_tile(t, paths);
+        if (progress) {
+            progress->tile_done(t);
+        }
+        stats.busy_seconds += std::chrono::duration<double>(clock::now() - fetch_end).count();
+        stats.tiles_rendered++;
+        stats.tiles_stolen += stolen;
     }
+}
+
+void renderer::write_png(const std::string& outputFile) const {
+
+    std::cerr << "Writing data to disk" << std::endl;
+    const unsigned int width = _frame.width(), height = _frame.height();
+    float_image image;
+    image.width = width;
+    image.height = height;
+    image.rgb.resize(size_t(width) * height * 3);
+    _frame.copy_to(image.rgb.data(), size_t(width) * 3, 3);
 
-    delete[] data;
+    std::unique_ptr<image_writer> writer = open_image_writer(outputFile, image_format::png, width, height, _tone);
+    if (!writer || !writer->write_rows(image.rgb.data(), height) || !writer->finish()) {
+        std::cerr << "Could not write " << outputFile << std::endl;
+    }
 }
 
-void renderer::render_scene() {
-    
-    std::vector<std::vector<color>> frameBuffer(_image_height, std::vector<color>(_image_width));
-    std::vector<std::vector<std::pair<int,int>>> pixelBuffer(_nthreads);
+bool renderer::write_image(const std::string& outputFile) const {
+    float_image image;
+    image.width = _frame.width();
+    image.height = _frame.height();
+    image.rgb.resize(size_t(image.width) * image.height * 3);
+    _frame.copy_to(image.rgb.data(), size_t(image.width) * 3, 3);
+    return ::write_image(outputFile, image, _tone);
+}
+
+void renderer::write_sample_counts(const std::string& outputFile) const {
+
+    const unsigned int width = _frame.width(), height = _frame.height();
+    uint32_t max_samples = 1;
+    for (unsigned int y = 0; y < height; y++) {
+        for (unsigned int x = 0; x < width; x++) {
+            max_samples = std::max(max_samples, _frame.at(x, y).samples);
+        }
+    }
 
-    // assign pixels to each thread
-    for (int j = _image_height - 1; j >= 0; --j) {
-        for (int i = 0; i < _image_width; ++i) {     
-            pixelBuffer[j % _nthreads].push_back(std::make_pair(j,i));
+    std::vector<uint8_t> data(size_t(width) * height);
+    int index = 0;
+    for (int y = height - 1; y >= 0; --y) {
+        for (unsigned int x = 0; x < width; ++x) {
+            data[index++] = uint8_t(255.0 * _frame.at(x, y).samples / max_samples);
         }
     }
 
+    stbi_write_png(outputFile.c_str(), width, height, 1, data.data(), width);
+}
+
+unsigned int renderer::output_width() const {
+    if (!_cropped) {
+        return _image_width;
+    }
+    return std::min(_crop_x1, _image_width) - std::min(_crop_x0, std::min(_crop_x1, _image_width));
+}
+
+unsigned int renderer::output_height() const {
+    if (!_cropped) {
+        return _image_height;
+    }
+    return std::min(_crop_y1, _image_height) - std::min(_crop_y0, std::min(_crop_y1, _image_height));
+}
+
+void renderer::render() {
+    render_frame(nullptr);
+}
+
+void renderer::render_frame(band_progress* progress) {
+
+    using clock = std::chrono::steady_clock;
+
+    // the crop window counts rows from the top, image rows j count from the bottom
+    const unsigned int width = output_width(), height = output_height();
+    _origin_x = _cropped ? std::min(_crop_x0, _image_width) : 0;
+    _origin_y = _cropped ? _image_height - std::min(_crop_y0, _image_height) - height : 0;
+
+    _frame = framebuffer(width, height, _tile_size, progress ? progress->window : 0);
+    _pixel_spread = _cam.pixel_spread_angle(_image_height);
+    tile_scheduler scheduler(width, height, _tile_size, _nthreads, progress ? tile_order::top_down : tile_order::z_curve);
+
+    _thread_stats.assign(_nthreads, thread_stats());
+    _thread_path_stats.assign(_nthreads, path_stats());
+    std::vector<clock::time_point> finish_times(_nthreads);
+
     // spawn threads
+    auto frame_start = clock::now();
     std::vector<std::thread> threads;
     for (int t = 0; t < _nthreads; t++) {
-        threads.push_back(std::thread([this, &pixelBuffer, &frameBuffer, t]() {
-            this->thread_compute_pixel_colors(std::as_const(pixelBuffer[t]), frameBuffer);
+        threads.push_back(std::thread([this, &scheduler, &finish_times, progress, t]() {
+            this->thread_compute_pixel_colors(t, scheduler, progress);
+            finish_times[t] = clock::now();
         } ));
     }
 
     for (int t = 0; t < _nthreads; t++) {
         threads[t].join();
     }
+    auto frame_end = clock::now();
+
+    // time between a thread running out of work and the last tile finishing counts as idle
+    for (int t = 0; t < _nthreads; t++) {
+        _thread_stats[t].idle_seconds += std::chrono::duration<double>(frame_end - finish_times[t]).count();
+    }
 
-    // write framebuffer to disk
-    write_color(std::string("render.png"), frameBuffer);
+    std::cerr << "Rendered " << scheduler.num_tiles() << " tiles in "
+              << std::chrono::duration<double>(frame_end - frame_start).count() << "s" << std::endl;
+    _path_stats = path_stats();
+    for (auto& paths : _thread_path_stats) {
+        _path_stats.paths += paths.paths;
+        _path_stats.segments += paths.segments;
+        _path_stats.roulette_terminations += paths.roulette_terminations;
+        _path_stats.shadow_rays += paths.shadow_rays;
+        _path_stats.min_pixel_samples = std::min(_path_stats.min_pixel_samples, paths.min_pixel_samples);
+        _path_stats.max_pixel_samples = std::max(_path_stats.max_pixel_samples, paths.max_pixel_samples);
+    }
+    std::cerr << "Traced " << _path_stats.paths << " paths, average length " << _path_stats.average_path_length()
+              << ", " << _path_stats.roulette_terminations << " terminated by russian roulette" << std::endl;
+    if (_path_stats.shadow_rays > 0) {
+        std::cerr << "Traced " << _path_stats.shadow_rays << " shadow rays to " << _scene.lights().size() << " lights" << std::endl;
+    }
+
+    if (_adaptive_threshold > 0.0 && width > 0 && height > 0) {
+        std::cerr << "Adaptive sampling: " << double(_path_stats.paths) / (size_t(width) * height) << " samples per pixel on average ("
+                  << _path_stats.min_pixel_samples << " to " << _path_stats.max_pixel_samples << ")" << std::endl;
+    }
+
+    for (int t = 0; t < _nthreads; t++) {
+        const thread_stats& stats = _thread_stats[t];
+        std::cerr << "  thread " << t << ": busy " << stats.busy_seconds << "s, idle " << stats.idle_seconds
+                  << "s, " << stats.tiles_rendered << " tiles (" << stats.tiles_stolen << " stolen)" << std::endl;
+    }
+}
+
+bool renderer::render_into(float* pixels, const size_t row_stride, const unsigned int channels) {
+    if (!pixels || (channels != 3 && channels != 4) || row_stride < size_t(output_width()) * channels) {
+        return false;
+    }
+
+    render();
+    return _frame.copy_to(pixels, row_stride, channels);
+}
+
+void renderer::render_scene() {
+
+    using clock = std::chrono::steady_clock;
+    const unsigned int width = output_width(), height = output_height();
+    std::unique_ptr<image_writer> writer = open_image_writer(_output_file, image_format_for(_output_file), width, height, _tone);
+    if (!writer) {
+        std::cerr << "Could not write " << _output_file << std::endl;
+        render();
+        return;
+    }
+
+    // write framebuffer to disk a row of tiles at a time, top first, as soon as each is rendered
+    band_progress progress(width, height, _tile_size, _streaming_rows);
+    bool written = true;
+    std::thread output([&]() {
+        const unsigned int size = progress.tile_size;
+        std::vector<float> rows(size_t(size) * width * 3);
+        for (unsigned int band = unsigned(progress.remaining.size()); band-- > 0; ) {
+            progress.wait(band);
+            const unsigned int y0 = band * size, y1 = std::min(y0 + size, height);
+            _frame.copy_rows(height - y1, y1 - y0, rows.data(), size_t(width) * 3, 3);
+            written &= writer->write_rows(rows.data(), y1 - y0);
+            progress.band_written();
+        }
+        written &= writer->finish();
+    });
+
+    render_frame(&progress);
+    const auto render_end = clock::now();
+    output.join();
+    if (written) {
+        std::cerr << "Wrote " << _output_file << ", " << std::chrono::duration<double>(clock::now() - render_end).count()
+                  << "s after the last tile" << std::endl;
+    } else {
+        std::cerr << "Could not write " << _output_file << std::endl;
+    }
+
+    if (!_sample_count_image.empty()) {
+        if (_streaming_rows > 0) {
+            std::cerr << "Not writing " << _sample_count_image << ", which needs the whole frame in memory" << std::endl;
+        } else {
+            write_sample_counts(_sample_count_image);
+        }
+    }
 
     std::cerr << "\nDone.\n";
-}
\ No newline at end of file
+}
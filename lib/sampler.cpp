@@ -0,0 +1,262 @@
+#include <cmath>
+#include <vector>
+
+#include "sampler.h"
+#include "rng.h"
+
+static inline double to_unit(const uint64_t bits) {
+    // top 53 bits -> double in [0,1)
+    return (bits >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* one hash of (key, a, b), for seeds that need not be combined any further */
+static inline uint64_t hash3(const uint64_t key, const uint32_t a, const uint32_t b) {
+    return mix64(key + 0x9e3779b97f4a7c15ULL * ((uint64_t(a) << 32 | b) + 1));
+}
+
+static inline uint32_t reverse_bits(uint32_t x) {
+    x = __builtin_bswap32(x);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    return ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+}
+
+/* independent_sampler */
+
+void independent_sampler::sample_pair(const uint64_t pixel_key, const uint32_t /* x */, const uint32_t /* y */,
+                                      const uint32_t sample_index, const uint32_t pair, double& u, double& v) const {
+    const uint64_t bits = hash3(pixel_key, sample_index, pair);
+    u = to_unit(bits);
+    v = to_unit(mix64(bits));
+}
+
+/* stratified_sampler */
+
+// Pseudo-random permutation of [0, n) selected by p, evaluated one element at a
+// time (Kensler, "Correlated Multi-Jittered Sampling", 2013)
+static uint32_t permute(uint32_t i, const uint32_t n, const uint32_t p) {
+    uint32_t w = n - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= p;             i *= 0xe170893d;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;        i *= 0x0929eb3f;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;  i *= 1 | p >> 27;
+                            i *= 0x6935fa69;
+        i ^= (i & w) >> 11; i *= 0x74dcb303;
+        i ^= (i & w) >> 2;  i *= 0x9e501cc3;
+        i ^= (i & w) >> 2;  i *= 0xc860a3df;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= n);
+    return (i + p) % n;
+}
+
+void stratified_sampler::sample_pair(const uint64_t pixel_key, const uint32_t /* x */, const uint32_t /* y */,
+                                     const uint32_t sample_index, const uint32_t pair, double& u, double& v) const {
+    const uint64_t jitter = hash3(pixel_key, sample_index, pair);
+    if (sample_index >= _samples) {
+        u = to_unit(jitter);
+        v = to_unit(mix64(jitter));
+        return;
+    }
+
+    // both dimensions draw their strata from independent permutations
+    const uint64_t order = hash3(pixel_key, 0xffffffffu, pair);
+    u = (permute(sample_index, _samples, uint32_t(order)) + to_unit(jitter)) / _samples;
+    v = (permute(sample_index, _samples, uint32_t(order >> 32)) + to_unit(mix64(jitter))) / _samples;
+    u = u < 1.0 ? u : 0x1.fffffffffffffp-1;
+    v = v < 1.0 ? v : 0x1.fffffffffffffp-1;
+}
+
+/* sobol_sampler */
+
+static inline uint32_t laine_karras_permutation(uint32_t x, const uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+// The first Sobol dimension is the van der Corput sequence, reverse_bits(index).
+// The second comes from the primitive polynomial x + 1 with m_1 = 1 (Joe and Kuo's
+// first entry); it is tabulated per byte as a map from the reversed index to the
+// reversed point, the form both Owen scrambles below work in.
+struct sobol_tables {
+    uint32_t bytes[4][256];
+
+    sobol_tables() {
+        uint32_t v[32];
+        uint32_t m = 1;
+        for (int i = 0; i < 32; i++) {
+            v[i] = m << (31 - i);
+            m = m ^ (m << 1);
+        }
+        for (int b = 0; b < 4; b++) {
+            for (int value = 0; value < 256; value++) {
+                bytes[b][value] = 0;
+                for (int bit = 0; bit < 8; bit++) {
+                    if (value & (1 << bit)) {
+                        bytes[b][value] ^= reverse_bits(v[31 - (8 * b + bit)]);
+                    }
+                }
+            }
+        }
+    }
+};
+
+static const sobol_tables sobol_dimension_1;
+
+/* dimensions 2 * pair and 2 * pair + 1 of sample sample_index of the Owen-scrambled sequence selected by key */
+static inline void sobol_owen(const uint64_t key, const uint32_t sample_index, const uint32_t pair, double& u, double& v) {
+
+    // nested uniform scrambling is a Laine-Karras permutation of the reversed bits
+    // (Burley 2020); each pair of dimensions shuffles the sample order on its own,
+    // which decorrelates the pairs
+    const uint64_t seed = hash3(key, 0, pair);
+    const uint32_t y = laine_karras_permutation(reverse_bits(sample_index), uint32_t(seed));
+
+    const uint32_t point_0 = reverse_bits(y);
+    const uint32_t point_1 = sobol_dimension_1.bytes[0][y & 0xff] ^ sobol_dimension_1.bytes[1][(y >> 8) & 0xff]
+                           ^ sobol_dimension_1.bytes[2][(y >> 16) & 0xff] ^ sobol_dimension_1.bytes[3][y >> 24];
+
+    u = reverse_bits(laine_karras_permutation(point_0, uint32_t(seed >> 32))) * (1.0 / 4294967296.0);
+    v = reverse_bits(laine_karras_permutation(point_1, uint32_t(seed >> 32) ^ 0x68bc21ebu)) * (1.0 / 4294967296.0);
+}
+
+void sobol_sampler::sample_pair(const uint64_t pixel_key, const uint32_t /* x */, const uint32_t /* y */,
+                                const uint32_t sample_index, const uint32_t pair, double& u, double& v) const {
+    sobol_owen(pixel_key, sample_index, pair, u, v);
+}
+
+/* blue_noise_sampler */
+
+static const int MASK_SIZE = 64;
+
+// Ulichney's void-and-cluster method on a torus: points are ranked by repeatedly
+// removing the tightest cluster and filling the largest void of a Gaussian-filtered
+// binary pattern, so every threshold of the ranks is an evenly spread point set.
+static std::vector<float> void_and_cluster() {
+
+    const int n = MASK_SIZE * MASK_SIZE;
+    const int radius = 7;
+    const double sigma = 1.5;
+
+    std::vector<double> kernel((2 * radius + 1) * (2 * radius + 1));
+    for (int dy = -radius; dy <= radius; dy++) {
+        for (int dx = -radius; dx <= radius; dx++) {
+            kernel[(dy + radius) * (2 * radius + 1) + dx + radius] = std::exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+        }
+    }
+
+    auto splat = [&](std::vector<double>& energy, const int p, const double sign) {
+        const int px = p % MASK_SIZE, py = p / MASK_SIZE;
+        for (int dy = -radius; dy <= radius; dy++) {
+            const int y = (py + dy + MASK_SIZE) % MASK_SIZE;
+            for (int dx = -radius; dx <= radius; dx++) {
+                const int x = (px + dx + MASK_SIZE) % MASK_SIZE;
+                energy[y * MASK_SIZE + x] += sign * kernel[(dy + radius) * (2 * radius + 1) + dx + radius];
+            }
+        }
+    };
+
+    // tightest cluster among set points, or largest void among empty ones
+    auto extreme = [&](const std::vector<double>& energy, const std::vector<char>& pattern, const char set) {
+        int best = -1;
+        for (int p = 0; p < n; p++) {
+            if (pattern[p] == set && (best < 0 || (set ? energy[p] > energy[best] : energy[p] < energy[best]))) {
+                best = p;
+            }
+        }
+        return best;
+    };
+
+    // initial pattern: a tenth of the pixels at hashed positions, relaxed until stable
+    std::vector<char> pattern(n, 0);
+    std::vector<double> energy(n, 0.0);
+    int ones = 0;
+    for (uint64_t k = 0; ones < n / 10; k++) {
+        const int p = int(mix64(k) % n);
+        if (!pattern[p]) {
+            pattern[p] = 1;
+            splat(energy, p, 1.0);
+            ones++;
+        }
+    }
+
+    for (int iteration = 0; iteration < n; iteration++) {
+        const int cluster = extreme(energy, pattern, 1);
+        pattern[cluster] = 0;
+        splat(energy, cluster, -1.0);
+
+        const int void_ = extreme(energy, pattern, 0);
+        pattern[void_] = 1;
+        splat(energy, void_, 1.0);
+        if (void_ == cluster) {
+            break;
+        }
+    }
+
+    std::vector<int> rank(n, 0);
+
+    // ranks below the initial pattern: remove clusters one by one
+    {
+        std::vector<char> p = pattern;
+        std::vector<double> e = energy;
+        for (int r = ones - 1; r >= 0; r--) {
+            const int cluster = extreme(e, p, 1);
+            p[cluster] = 0;
+            splat(e, cluster, -1.0);
+            rank[cluster] = r;
+        }
+    }
+
+    // ranks above it: fill voids one by one
+    for (int r = ones; r < n; r++) {
+        const int void_ = extreme(energy, pattern, 0);
+        pattern[void_] = 1;
+        splat(energy, void_, 1.0);
+        rank[void_] = r;
+    }
+
+    std::vector<float> mask(n);
+    for (int p = 0; p < n; p++) {
+        mask[p] = (rank[p] + 0.5f) / n;
+    }
+    return mask;
+}
+
+static const std::vector<float>& blue_noise_tile() {
+    static const std::vector<float> tile = void_and_cluster();
+    return tile;
+}
+
+blue_noise_sampler::blue_noise_sampler(const uint64_t seed) : _seed(seed), _mask(blue_noise_tile().data()) {}
+
+float blue_noise_sampler::mask(const uint32_t x, const uint32_t y) {
+    return blue_noise_tile()[(y % MASK_SIZE) * MASK_SIZE + x % MASK_SIZE];
+}
+
+void blue_noise_sampler::sample_pair(const uint64_t /* pixel_key */, const uint32_t x, const uint32_t y,
+                                     const uint32_t sample_index, const uint32_t pair, double& u, double& v) const {
+
+    // every dimension reads the mask at its own toroidal offset, so dimensions
+    // (and the two halves of each pair) see uncorrelated shifts
+    const uint64_t offset = hash3(_seed, 1, pair);
+    const uint32_t ox = uint32_t(offset), oy = uint32_t(offset >> 16);
+    const uint32_t px = uint32_t(offset >> 32), py = uint32_t(offset >> 48);
+
+    sobol_owen(_seed, sample_index, pair, u, v);
+    u += _mask[((y + oy) % MASK_SIZE) * MASK_SIZE + (x + ox) % MASK_SIZE];
+    v += _mask[((y + py) % MASK_SIZE) * MASK_SIZE + (x + px) % MASK_SIZE];
+    u = u < 1.0 ? u : u - 1.0;
+    v = v < 1.0 ? v : v - 1.0;
+}
@@ -1,18 +1,54 @@
 #include "sphere.h"
+#include "material.h"
+#include "light_list.h"
 
-bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    if (!box.hit(r, t_min, t_max)) {
+bool sphere::hit(const ray_query& q, double t_min, double t_max, hit_record& rec) const {
+    const ray& r = q.r;
+    if (!box.hit(q, t_min, t_max)) {
         return false;
     } 
 
-    const vec3 center_transformed = transform::apply_transforms(center, _transforms);
+    const point3 c = transform::apply_transforms(center, _transforms);
+    double root;
+    if (!intersect(r, c, t_min, t_max, root)) {
+        return false;
+    }
+
+    rec.t = root;
+    rec.p = r.at(rec.t);
+    vec3 outward_normal = (rec.p - c) / radius;
+    rec.set_face_normal(r, outward_normal);
+    rec.mat_id = _mat_id;
+    rec.emitter = _light_id;
+
+    if (_textured) {
+        // longitude around y from +x, and latitude from the south pole; 2 pi r by pi r in world units
+        const double theta = std::acos(clamp(-outward_normal.y(), -1.0, 1.0));
+        const double phi = std::atan2(-outward_normal.z(), outward_normal.x()) + PI;
+        rec.u = phi / (2.0 * PI);
+        rec.v = theta / PI;
+        rec.uv_scale = 1.0 / (PI * std::fabs(radius) * std::sqrt(2.0));
+    }
+    
+    return true;
+}
+
+bool sphere::occluded(const ray_query& q, double t_min, double t_max) const {
+    if (!box.hit(q, t_min, t_max)) {
+        return false;
+    }
 
-    const vec3 oc = r.origin() - center_transformed;
+    double root;
+    return intersect(q.r, transform::apply_transforms(center, _transforms), t_min, t_max, root);
+}
+
+bool sphere::intersect(const ray& r, const point3& c, double t_min, double t_max, double& nearest) const {
+    const vec3 oc = r.origin() - c;
     const float a = r.direction().length_squared();
     const float half_b = dot(r.direction(), oc);
-    const float c = oc.length_squared() - radius * radius;
-    const float discriminant = half_b * half_b - a * c;
-    
+    const float oc_c = oc.length_squared() - radius * radius;
+    const float discriminant = half_b * half_b - a * oc_c;
+
     if (discriminant < 0) return false;
     auto sqrtd = sqrt(discriminant);
     auto root = (-half_b - sqrtd) / a;
@@ -22,13 +58,7 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
             return false;
         }
     }
-
-    rec.t = root;
-    rec.p = r.at(rec.t);
-    vec3 outward_normal = (rec.p - this->center) / radius;
-    rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mat_ptr;
-    
+    nearest = root;
     return true;
 }
 
@@ -48,3 +78,15 @@ point3 sphere::centroid() const {
 bool sphere::commit() {
     return create_bounding_box();
 }
+
+void sphere::bind_lights(light_list& lights) {
+    _light_id = NO_LIGHT;
+    if (mat_ptr && mat_ptr->is_emissive()) {
+        _light_id = lights.add(std::make_shared<sphere_light>(transform::apply_transforms(center, _transforms), radius, mat_ptr->emission()));
+    }
+}
+
+void sphere::bind_materials(material_table& table) {
+    _mat_id = table.add(mat_ptr);
+    _textured = mat_ptr && mat_ptr->is_textured();
+}
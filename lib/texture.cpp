@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "texture.h"
+
+static const char tiled_texture_magic[8] = { 'R', 'T', 'X', 'T', 'E', 'X', '0', '1' };
+
+struct tiled_texture_header {
+    char magic[8];
+    uint32_t width;
+    uint32_t height;
+    uint32_t levels;
+    uint32_t tile_size;     // texels along each side of a tile; tiles hold RGB floats, padded past the edges
+};
+
+struct tiled_texture_level {
+    uint32_t width;
+    uint32_t height;
+    uint32_t tiles_x;
+    uint32_t tiles_y;
+    uint64_t offset;
+};
+
+/* checker_texture */
+
+color checker_texture::value(const double u, const double v, const double width) const {
+
+    // past half a square per footprint the pattern only aliases
+    if (width * _n > 0.5) {
+        return 0.5 * (_even + _odd);
+    }
+    const long iu = long(std::floor(u * _n)), iv = long(std::floor(v * _n));
+    return (iu + iv) % 2 == 0 ? _even : _odd;
+}
+
+/* image_texture */
+
+image_texture::image_texture(const std::string& tiled_file, tile_cache& cache)
+    : _cache(cache), _id(cache.new_texture_id()) {
+
+    _fd = open(tiled_file.c_str(), O_RDONLY);
+    if (_fd < 0) {
+        throw std::runtime_error("Could not open texture " + tiled_file);
+    }
+
+    tiled_texture_header header;
+    if (pread(_fd, &header, sizeof(header), 0) != ssize_t(sizeof(header)) ||
+        std::memcmp(header.magic, tiled_texture_magic, sizeof(header.magic)) != 0 ||
+        header.levels == 0 || header.levels > 32 || header.tile_size == 0) {
+        close(_fd);
+        throw std::runtime_error("Not a tiled texture: " + tiled_file);
+    }
+
+    std::vector<tiled_texture_level> levels(header.levels);
+    const ssize_t bytes = ssize_t(levels.size() * sizeof(tiled_texture_level));
+    if (pread(_fd, levels.data(), bytes, sizeof(header)) != bytes) {
+        close(_fd);
+        throw std::runtime_error("Truncated texture " + tiled_file);
+    }
+
+    _tile_size = header.tile_size;
+    for (const tiled_texture_level& l : levels) {
+        _levels.push_back(level_info{ l.width, l.height, l.tiles_x, l.tiles_y, l.offset });
+    }
+}
+
+image_texture::~image_texture() {
+    if (_fd >= 0) {
+        close(_fd);
+    }
+}
+
+void image_texture::load_tile(const uint32_t level, const uint32_t tx, const uint32_t ty, std::vector<float>& texels) const {
+    const level_info& l = _levels[level];
+    const size_t floats = size_t(_tile_size) * _tile_size * 3;
+    texels.resize(floats);
+
+    const uint64_t offset = l.offset + (uint64_t(ty) * l.tiles_x + tx) * floats * sizeof(float);
+    if (pread(_fd, texels.data(), floats * sizeof(float), offset) != ssize_t(floats * sizeof(float))) {
+        // render threads cannot recover from a file that went missing; show it as black
+        std::fill(texels.begin(), texels.end(), 0.0f);
+    }
+}
+
+color image_texture::texel(const unsigned int level, const int x, const int y) const {
+    const level_info& l = _levels[level];
+    const uint32_t wx = uint32_t((x % int(l.width) + int(l.width)) % int(l.width));
+    const uint32_t wy = uint32_t((y % int(l.height) + int(l.height)) % int(l.height));
+
+    const texture_tile* tile = _cache.get(_id, level, wx / _tile_size, wy / _tile_size, *this);
+    const float* t = &tile->texels[((wy % _tile_size) * _tile_size + wx % _tile_size) * 3];
+    return color(t[0], t[1], t[2]);
+}
+
+color image_texture::bilinear(const unsigned int level, const double u, const double v) const {
+    const level_info& l = _levels[level];
+
+    // texel centers sit at half-integers; v = 0 is the bottom row
+    const double x = (u - std::floor(u)) * l.width - 0.5;
+    const double y = (1.0 - (v - std::floor(v))) * l.height - 0.5;
+    const double fx = std::floor(x), fy = std::floor(y);
+    const int x0 = int(fx), y0 = int(fy);
+    const double dx = x - fx, dy = y - fy;
+
+    return (1 - dx) * (1 - dy) * texel(level, x0, y0) + dx * (1 - dy) * texel(level, x0 + 1, y0)
+         + (1 - dx) * dy * texel(level, x0, y0 + 1) + dx * dy * texel(level, x0 + 1, y0 + 1);
+}
+
+color image_texture::value(const double u, const double v, const double width) const {
+
+    // the level whose texels are as wide as the footprint, blended with the next
+    const double texels = width * std::max(_levels[0].width, _levels[0].height);
+    const double level = texels > 1.0 ? std::fmin(std::log2(texels), double(_levels.size() - 1)) : 0.0;
+    const unsigned int l0 = unsigned(level);
+    const double f = level - l0;
+
+    color c = bilinear(l0, u, v);
+    if (f > 0.0 && l0 + 1 < _levels.size()) {
+        c = (1.0 - f) * c + f * bilinear(l0 + 1, u, v);
+    }
+    return c;
+}
+
+/* source texels the output texels of a box filter from n down to half cover, each with the
+   fraction of it that falls inside; odd sizes spread the middle texel over both neighbours */
+static void box_weights(const unsigned int n, const unsigned int half,
+                        std::vector<unsigned int>& first, std::vector<std::vector<float>>& weights) {
+    const double scale = double(n) / half;
+    first.resize(half);
+    weights.assign(half, std::vector<float>());
+    for (unsigned int i = 0; i < half; i++) {
+        const double begin = i * scale, end = (i + 1) * scale;
+        first[i] = unsigned(begin);
+        for (unsigned int k = first[i]; k < n && k < end; k++) {
+            const double covered = std::fmin(end, k + 1.0) - std::fmax(begin, double(k));
+            weights[i].push_back(float(covered / scale));
+        }
+    }
+}
+
+/* one mip level: half the size, rounded up, each texel the area-weighted mean of the texels
+   above it, so every level keeps the image's mean */
+static float_image downsample(const float_image& image) {
+    float_image half;
+    half.width = std::max(1u, (image.width + 1) / 2);
+    half.height = std::max(1u, (image.height + 1) / 2);
+    half.rgb.assign(size_t(half.width) * half.height * 3, 0.0f);
+
+    std::vector<unsigned int> first_x, first_y;
+    std::vector<std::vector<float>> weights_x, weights_y;
+    box_weights(image.width, half.width, first_x, weights_x);
+    box_weights(image.height, half.height, first_y, weights_y);
+
+    for (unsigned int y = 0; y < half.height; y++) {
+        for (unsigned int x = 0; x < half.width; x++) {
+            float* out = &half.rgb[(size_t(y) * half.width + x) * 3];
+            for (size_t j = 0; j < weights_y[y].size(); j++) {
+                for (size_t i = 0; i < weights_x[x].size(); i++) {
+                    const float w = weights_y[y][j] * weights_x[x][i];
+                    const float* in = image.at(first_x[x] + unsigned(i), first_y[y] + unsigned(j));
+                    out[0] += w * in[0];
+                    out[1] += w * in[1];
+                    out[2] += w * in[2];
+                }
+            }
+        }
+    }
+    return half;
+}
+
+bool write_tiled_texture(const std::string& filename, const float_image& image, const unsigned int tile_size) {
+
+    if (image.width == 0 || image.height == 0 || tile_size == 0) {
+        return false;
+    }
+
+    tiled_texture_header header;
+    std::memcpy(header.magic, tiled_texture_magic, sizeof(header.magic));
+    header.width = image.width;
+    header.height = image.height;
+    header.tile_size = tile_size;
+    header.levels = 1;
+    for (unsigned int w = image.width, h = image.height; w > 1 || h > 1; header.levels++) {
+        w = std::max(1u, (w + 1) / 2);
+        h = std::max(1u, (h + 1) / 2);
+    }
+
+    std::vector<tiled_texture_level> levels(header.levels);
+    uint64_t offset = sizeof(header) + levels.size() * sizeof(tiled_texture_level);
+    const uint64_t tile_bytes = uint64_t(tile_size) * tile_size * 3 * sizeof(float);
+    for (unsigned int k = 0, w = image.width, h = image.height; k < header.levels; k++) {
+        levels[k] = tiled_texture_level{ w, h, (w + tile_size - 1) / tile_size, (h + tile_size - 1) / tile_size, offset };
+        offset += uint64_t(levels[k].tiles_x) * levels[k].tiles_y * tile_bytes;
+        w = std::max(1u, (w + 1) / 2);
+        h = std::max(1u, (h + 1) / 2);
+    }
+
+    // write to a temporary name and rename, so concurrent readers never see a partial file
+    const std::string tmp_file = filename + ".tmp";
+    {
+        std::ofstream out(tmp_file, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(levels.data()), levels.size() * sizeof(tiled_texture_level));
+
+        // one level in memory at a time, cut into tiles as it is written
+        float_image level = image;
+        std::vector<float> tile(size_t(tile_size) * tile_size * 3);
+        for (unsigned int k = 0; k < header.levels; k++) {
+            if (k > 0) {
+                level = downsample(level);
+            }
+            for (uint32_t ty = 0; ty < levels[k].tiles_y; ty++) {
+                for (uint32_t tx = 0; tx < levels[k].tiles_x; tx++) {
+                    std::fill(tile.begin(), tile.end(), 0.0f);
+                    for (unsigned int y = 0; y < tile_size && ty * tile_size + y < level.height; y++) {
+                        for (unsigned int x = 0; x < tile_size && tx * tile_size + x < level.width; x++) {
+                            std::memcpy(&tile[(size_t(y) * tile_size + x) * 3], level.at(tx * tile_size + x, ty * tile_size + y), 3 * sizeof(float));
+                        }
+                    }
+                    out.write(reinterpret_cast<const char*>(tile.data()), tile.size() * sizeof(float));
+                }
+            }
+        }
+
+        if (!out) {
+            std::remove(tmp_file.c_str());
+            return false;
+        }
+    }
+
+    if (std::rename(tmp_file.c_str(), filename.c_str()) != 0) {
+        std::remove(tmp_file.c_str());
+        return false;
+    }
+    return true;
+}
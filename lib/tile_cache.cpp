@@ -0,0 +1,113 @@
+#include <algorithm>
+
+#include "tile_cache.h"
+#include "rng.h"
+
+static std::atomic<uint64_t> next_instance{1};
+
+// tiles a thread used recently, found without locking and without touching reference counts
+struct tile_memo {
+    static const unsigned int SLOTS = 64;
+    uint64_t instance[SLOTS] = {};
+    uint64_t key[SLOTS] = {};
+    std::shared_ptr<const texture_tile> tile[SLOTS];
+};
+
+static thread_local tile_memo memo;
+
+/* texture id, level and tile coordinates packed into 24, 5, 17 and 18 bits */
+static inline uint64_t tile_key(const uint32_t texture, const uint32_t level, const uint32_t tx, const uint32_t ty) {
+    return uint64_t(texture & 0xffffff) << 40 | uint64_t(level & 0x1f) << 35 | uint64_t(tx & 0x1ffff) << 18 | (ty & 0x3ffff);
+}
+
+tile_cache::tile_cache(const size_t budget_bytes, const unsigned int num_shards)
+    : _instance(next_instance++) {
+    for (unsigned int s = 0; s < std::max(1u, num_shards); s++) {
+        _shards.push_back(std::unique_ptr<shard>(new shard()));
+    }
+    _shard_budget = budget_bytes / _shards.size();
+}
+
+tile_cache& tile_cache::shared() {
+    static tile_cache cache(size_t(256) << 20);
+    return cache;
+}
+
+const texture_tile* tile_cache::get(const uint32_t texture, const uint32_t level, const uint32_t tx, const uint32_t ty,
+                                    const tile_source& source) {
+    const uint64_t key = tile_key(texture, level, tx, ty);
+    const unsigned int slot = mix64(key) % tile_memo::SLOTS;
+    if (memo.instance[slot] == _instance && memo.key[slot] == key) {
+        return memo.tile[slot].get();
+    }
+
+    memo.tile[slot] = find_or_load(key, level, tx, ty, source);
+    memo.instance[slot] = _instance;
+    memo.key[slot] = key;
+    return memo.tile[slot].get();
+}
+
+std::shared_ptr<const texture_tile> tile_cache::find_or_load(const uint64_t key, const uint32_t level, const uint32_t tx,
+                                                             const uint32_t ty, const tile_source& source) {
+    shard& s = *_shards[mix64(key ^ 0x5bd1e995) % _shards.size()];
+    {
+        std::lock_guard<std::mutex> guard(s.lock);
+        auto found = s.index.find(key);
+        if (found != s.index.end()) {
+            s.lru.splice(s.lru.begin(), s.lru, found->second);
+            s.hits++;
+            return found->second->tile;
+        }
+        s.misses++;
+    }
+
+    // read without holding the lock; if another thread read the same tile meanwhile, keep theirs
+    auto loaded = std::make_shared<texture_tile>();
+    source.load_tile(level, tx, ty, loaded->texels);
+    const size_t bytes = loaded->texels.size() * sizeof(float) + sizeof(texture_tile);
+
+    std::lock_guard<std::mutex> guard(s.lock);
+    auto found = s.index.find(key);
+    if (found != s.index.end()) {
+        s.lru.splice(s.lru.begin(), s.lru, found->second);
+        return found->second->tile;
+    }
+
+    s.lru.push_front(entry{ key, loaded, bytes });
+    s.index.emplace(key, s.lru.begin());
+    s.bytes += bytes;
+    while (s.bytes > _shard_budget && s.lru.size() > 1) {
+        const entry& victim = s.lru.back();
+        s.bytes -= victim.bytes;
+        s.index.erase(victim.key);
+        s.lru.pop_back();
+    }
+    return loaded;
+}
+
+size_t tile_cache::resident_bytes() const {
+    size_t total = 0;
+    for (auto& s : _shards) {
+        std::lock_guard<std::mutex> guard(s->lock);
+        total += s->bytes;
+    }
+    return total;
+}
+
+uint64_t tile_cache::hits() const {
+    uint64_t total = 0;
+    for (auto& s : _shards) {
+        std::lock_guard<std::mutex> guard(s->lock);
+        total += s->hits;
+    }
+    return total;
+}
+
+uint64_t tile_cache::misses() const {
+    uint64_t total = 0;
+    for (auto& s : _shards) {
+        std::lock_guard<std::mutex> guard(s->lock);
+        total += s->misses;
+    }
+    return total;
+}
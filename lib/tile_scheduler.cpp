@@ -0,0 +1,100 @@
+#include <algorithm>
+#include <cstdint>
+
+#include "tile_scheduler.h"
+
+// spread the lower 16 bits of x so that there is a zero bit between each of them
+static inline uint32_t part_1_by_1(uint32_t x) {
+    x &= 0x0000ffff;
+    x = (x | (x << 8)) & 0x00ff00ff;
+    x = (x | (x << 4)) & 0x0f0f0f0f;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+    return x;
+}
+
+static inline uint32_t morton_code(const uint32_t x, const uint32_t y) {
+    return (part_1_by_1(y) << 1) | part_1_by_1(x);
+}
+
+tile_scheduler::tile_scheduler(const unsigned int width, const unsigned int height,
+                               const unsigned int tile_size, const unsigned int nthreads,
+                               const tile_order order) {
+
+    const unsigned int size = std::max(1u, tile_size);
+    const unsigned int ntiles_x = (width + size - 1) / size;
+    const unsigned int ntiles_y = (height + size - 1) / size;
+
+    // order tiles along a Z-curve so that neighbouring tiles (and the geometry
+    // they see) are rendered close together in time, or in rows from the top
+    // (rows count from the bottom) for output that streams out behind them
+    std::vector<std::pair<uint32_t, tile>> ordered;
+    ordered.reserve(ntiles_x * ntiles_y);
+    for (unsigned int ty = 0; ty < ntiles_y; ty++) {
+        for (unsigned int tx = 0; tx < ntiles_x; tx++) {
+            tile t;
+            t.x0 = tx * size;
+            t.y0 = ty * size;
+            t.x1 = std::min(t.x0 + size, width);
+            t.y1 = std::min(t.y0 + size, height);
+            const uint32_t key = order == tile_order::z_curve ? morton_code(tx, ty) : (ntiles_y - 1 - ty) * ntiles_x + tx;
+            ordered.push_back(std::make_pair(key, t));
+        }
+    }
+
+    std::sort(ordered.begin(), ordered.end(), [] (const auto& a, const auto& b) {
+        return a.first < b.first;
+    });
+
+    // hand each thread a contiguous run of the curve; the rest is balanced by stealing
+    const unsigned int nqueues = std::max(1u, nthreads);
+    for (unsigned int t = 0; t < nqueues; t++) {
+        _queues.push_back(std::make_unique<work_queue>());
+    }
+
+    // top down, threads take turns instead, so they all work their way down the same rows
+    _num_tiles = ordered.size();
+    for (size_t k = 0; k < _num_tiles; k++) {
+        size_t owner = order == tile_order::z_curve ? (k * nqueues) / _num_tiles : k % nqueues;
+        _queues[owner]->tiles.push_back(ordered[k].second);
+    }
+}
+
+bool tile_scheduler::pop_front(work_queue& q, tile& out) {
+    std::lock_guard<std::mutex> guard(q.lock);
+    if (q.tiles.empty()) {
+        return false;
+    }
+    out = q.tiles.front();
+    q.tiles.pop_front();
+    return true;
+}
+
+bool tile_scheduler::pop_back(work_queue& q, tile& out) {
+    std::lock_guard<std::mutex> guard(q.lock);
+    if (q.tiles.empty()) {
+        return false;
+    }
+    out = q.tiles.back();
+    q.tiles.pop_back();
+    return true;
+}
+
+bool tile_scheduler::next_tile(const unsigned int t, tile& out, bool& stolen) {
+
+    // owner works from the front of its run, thieves take from the back so the
+    // two ends of a queue rarely contend for the same lock at the same time
+    stolen = false;
+    if (pop_front(*_queues[t], out)) {
+        return true;
+    }
+
+    const size_t nqueues = _queues.size();
+    for (size_t k = 1; k < nqueues; k++) {
+        if (pop_back(*_queues[(t + k) % nqueues], out)) {
+            stolen = true;
+            return true;
+        }
+    }
+    return false;
+}
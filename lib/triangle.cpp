@@ -3,72 +3,91 @@
 
 triangle::triangle(const triangle_mesh* mesh, 
                    const std::vector<uint32_t>& vertex_indices, 
-                   const std::vector<uint32_t>& normal_indices) 
-        : parent_mesh(mesh), _vi0(vertex_indices[0]), _vi1(vertex_indices[1]),
-          _vi2(vertex_indices[2]), _ni0(normal_indices[0]), _ni1(normal_indices[1]), _ni2(normal_indices[2]) {}
+                   const std::vector<uint32_t>& normal_indices,
+                   const std::vector<uint32_t>& texture_indices)
+        : parent_mesh(mesh), _vi0(vertex_indices[0]), _vi1(vertex_indices[1]), _vi2(vertex_indices[2]) {
+
+    // faces without per-vertex normals fall back to the geometric normal
+    _has_normals = normal_indices.size() >= 3;
+    _ni0 = _has_normals ? normal_indices[0] : 0;
+    _ni1 = _has_normals ? normal_indices[1] : 0;
+    _ni2 = _has_normals ? normal_indices[2] : 0;
+
+    if (texture_indices.size() >= 3) {
+        _ti0 = texture_indices[0];
+        _ti1 = texture_indices[1];
+        _ti2 = texture_indices[2];
+    }
+}
+
+triangle::triangle(const triangle_mesh* mesh,
+                   const uint32_t* vertex_indices,
+                   const uint32_t* normal_indices,
+                   const uint32_t* texture_indices)
+        : parent_mesh(mesh), _vi0(vertex_indices[0]), _vi1(vertex_indices[1]), _vi2(vertex_indices[2]) {
+
+    _has_normals = normal_indices[0] != NO_INDEX;
+    _ni0 = _has_normals ? normal_indices[0] : 0;
+    _ni1 = _has_normals ? normal_indices[1] : 0;
+    _ni2 = _has_normals ? normal_indices[2] : 0;
+
+    if (texture_indices && texture_indices[0] != NO_INDEX) {
+        _ti0 = texture_indices[0];
+        _ti1 = texture_indices[1];
+        _ti2 = texture_indices[2];
+    }
+}
 
 point3 triangle::centroid() const {
     return _centroid;
 }
 
 bool triangle::commit() {
-    vec3 _v0 = parent_mesh->_vertices[_vi0];
-    vec3 _v1 = parent_mesh->_vertices[_vi1];
-    vec3 _v2 = parent_mesh->_vertices[_vi2];
-
-    _v0 = transform::apply_transforms(_v0, parent_mesh->_transforms);
-    _v1 = transform::apply_transforms(_v1, parent_mesh->_transforms);
-    _v2 = transform::apply_transforms(_v2, parent_mesh->_transforms);
+    const point3& _v0 = parent_mesh->_world_vertices[_vi0];
+    const point3& _v1 = parent_mesh->_world_vertices[_vi1];
+    const point3& _v2 = parent_mesh->_world_vertices[_vi2];
 
     this->_centroid = (_v0 + _v1 + _v2) / 3;
     return create_bounding_box();
 }
 
-bool triangle::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-
-    // bounding box test
-    if (!box.hit(r, t_min, t_max)) {
+bool triangle::hit(const ray_query& q, double t_min, double t_max, hit_record& rec) const {
+    double t, b0, b1, b2;
+    if (!intersect(q, t_min, t_max, t, b0, b1, b2)) {
         return false;
     }
 
-    vec3 _v0 = parent_mesh->_vertices[_vi0];
-    vec3 _v1 = parent_mesh->_vertices[_vi1];
-    vec3 _v2 = parent_mesh->_vertices[_vi2];
-
-    _v0 = transform::apply_transforms(_v0, parent_mesh->_transforms);
-    _v1 = transform::apply_transforms(_v1, parent_mesh->_transforms);
-    _v2 = transform::apply_transforms(_v2, parent_mesh->_transforms);
-
-    // translation vertices based on ray origin
-    point3 v0 = _v0, v1 = _v1, v2 = _v2;
-    v0 -= r.origin();
-    v1 -= r.origin();
-    v2 -= r.origin();
+    set_hit_record(q.r, t, b0, b1, b2, rec);
+    return true;
+}
 
-    // permute axes so that ray's largest element is the z-element
-    int maxDim = 0;
-    maxDim = std::fabs(r.direction()[1]) > std::fabs(r.direction()[0]) ? 1 : 0;
-    maxDim = std::fabs(r.direction()[2]) > std::fabs(r.direction()[maxDim]) ? 2 : maxDim;
-    int kZ = maxDim, kX = (maxDim + 1) % 3, kY = (kX + 1) % 3;
+bool triangle::occluded(const ray_query& q, double t_min, double t_max) const {
+    double t, b0, b1, b2;
+    return intersect(q, t_min, t_max, t, b0, b1, b2);
+}
 
-    ray r_permuted(r.origin(), r.direction().permute(kX, kY, kZ));
-    v0 = v0.permute(kX, kY, kZ);
-    v1 = v1.permute(kX, kY, kZ);
-    v2 = v2.permute(kX, kY, kZ);
+bool triangle::intersect(const ray_query& q, double t_min, double t_max,
+                         double& t_hit, double& b0, double& b1, double& b2) const {
 
-    // apply a shear that aligns ray direction with x axis
-    double sx = -r_permuted.direction()[0] / r_permuted.direction()[2];
-    double sy = -r_permuted.direction()[1] / r_permuted.direction()[2];
-    double sz = 1.0 / r_permuted.direction()[2];
+    // bounding box test
+    if (!box.hit(q, t_min, t_max)) {
+        return false;
+    }
 
-    v0 += vec3(sx * v0[2], sy * v0[2], 0);
-    v0 *= vec3(1, 1, sz);
+    // vertices were moved to world space when the mesh was committed
+    const point3& _v0 = parent_mesh->_world_vertices[_vi0];
+    const point3& _v1 = parent_mesh->_world_vertices[_vi1];
+    const point3& _v2 = parent_mesh->_world_vertices[_vi2];
 
-    v1 += vec3(sx * v1[2], sy * v1[2], 0);
-    v1 *= vec3(1, 1, sz);
+    // translate vertices based on ray origin
+    const point3 o = q.r.origin();
+    point3 v0 = _v0 - o, v1 = _v1 - o, v2 = _v2 - o;
 
-    v2 += vec3(sx * v2[2], sy * v2[2], 0);
-    v2 *= vec3(1, 1, sz);
+    // permute axes so that ray's largest element is the z-element, then apply
+    // the shear that aligns the ray direction with the z axis; both come with the query
+    v0 = vec3(v0[q.kx] + q.sx * v0[q.kz], v0[q.ky] + q.sy * v0[q.kz], q.sz * v0[q.kz]);
+    v1 = vec3(v1[q.kx] + q.sx * v1[q.kz], v1[q.ky] + q.sy * v1[q.kz], q.sz * v1[q.kz]);
+    v2 = vec3(v2[q.kx] + q.sx * v2[q.kz], v2[q.ky] + q.sy * v2[q.kz], q.sz * v2[q.kz]);
     
     // determine if intersection occurs by checking if transformed triangle contains (0,0)
     double e0 = v1.x() * v2.y() - v1.y() * v2.x();
@@ -93,37 +112,71 @@ bool triangle::hit(const ray& r, double t_min, double t_max, hit_record& rec) co
     }
 
     double oneOverDet = 1.0 / det;
-    double b0 = e0 * oneOverDet;
-    double b1 = e1 * oneOverDet; 
-    double b2 = e2 * oneOverDet;
+    b0 = e0 * oneOverDet;
+    b1 = e1 * oneOverDet; 
+    b2 = e2 * oneOverDet;
 
     float t = tScaled * oneOverDet;
-    
-    // fill in intersection statistics
-    vec3 _n0 = parent_mesh->_vertices[_ni0];
-    vec3 _n1 = parent_mesh->_vertices[_ni1];
-    vec3 _n2 = parent_mesh->_vertices[_ni2];
+    if (t <= t_min) {
+        return false;
+    }
+
+    t_hit = t;
+    return true;
+}
+
+void triangle::set_hit_record(const ray& r, const double t, const double b0, const double b1, const double b2,
+                              hit_record& rec) const {
 
-    _n0 = transform::apply_transforms(_n0, parent_mesh->_transforms);
-    _n1 = transform::apply_transforms(_n1, parent_mesh->_transforms);
-    _n2 = transform::apply_transforms(_n2, parent_mesh->_transforms);   
+    const point3& _v0 = parent_mesh->_world_vertices[_vi0];
+    const point3& _v1 = parent_mesh->_world_vertices[_vi1];
+    const point3& _v2 = parent_mesh->_world_vertices[_vi2];
+
+    // fill in intersection statistics
+    vec3 normal;
+    if (_has_normals) {
+        const vec3& _n0 = parent_mesh->_world_normals[_ni0];
+        const vec3& _n1 = parent_mesh->_world_normals[_ni1];
+        const vec3& _n2 = parent_mesh->_world_normals[_ni2];
+        normal = b0 * _n0 + b1 * _n1 + b2 * _n2;
+    } else {
+        normal = cross(_v1 - _v0, _v2 - _v0);
+    }
 
     rec.t = t; 
     rec.p = b0 * _v0 + b1 * _v1 + b2 * _v2;
-    rec.n = b0 * _n0 + b1 * _n1 + b2 * _n2;  
-    rec.mat_ptr = parent_mesh->_mat;
-    return true;
+    rec.set_face_normal(r, unit_vector(normal));
+    rec.mat_id = parent_mesh->_mat_id;
+    rec.emitter = _light_id;
+
+    if (_ti0 != NO_INDEX) {
+        const vec3& _t0 = parent_mesh->_texture_coords[_ti0];
+        const vec3& _t1 = parent_mesh->_texture_coords[_ti1];
+        const vec3& _t2 = parent_mesh->_texture_coords[_ti2];
+        rec.u = b0 * _t0.x() + b1 * _t1.x() + b2 * _t2.x();
+        rec.v = b0 * _t0.y() + b1 * _t1.y() + b2 * _t2.y();
+
+        // ratio of the triangle's areas in texture and world space
+        const double uv_area = std::fabs((_t1.x() - _t0.x()) * (_t2.y() - _t0.y()) - (_t2.x() - _t0.x()) * (_t1.y() - _t0.y()));
+        const double area = cross(_v1 - _v0, _v2 - _v0).length();
+        rec.uv_scale = area > 0.0 ? std::sqrt(uv_area / area) : 0.0;
+    } else {
+        rec.u = b1;
+        rec.v = b2;
+        rec.uv_scale = 0.0;
+    }
+}
+
+const point3& triangle::vertex(const int k) const {
+    const uint32_t index = k == 0 ? _vi0 : (k == 1 ? _vi1 : _vi2);
+    return parent_mesh->_world_vertices[index];
 }
 
 bool triangle::create_bounding_box() {
 
-    vec3 _v0 = parent_mesh->_vertices[_vi0];
-    vec3 _v1 = parent_mesh->_vertices[_vi1];
-    vec3 _v2 = parent_mesh->_vertices[_vi2];
-    
-    _v0 = transform::apply_transforms(_v0, parent_mesh->_transforms);
-    _v1 = transform::apply_transforms(_v1, parent_mesh->_transforms);
-    _v2 = transform::apply_transforms(_v2, parent_mesh->_transforms);
+    const point3& _v0 = parent_mesh->_world_vertices[_vi0];
+    const point3& _v1 = parent_mesh->_world_vertices[_vi1];
+    const point3& _v2 = parent_mesh->_world_vertices[_vi2];
 
     double minX = std::fmin(_v0.x(), std::fmin(_v1.x(), _v2.x()));
     double minY = std::fmin(_v0.y(), std::fmin(_v1.y(), _v2.y()));
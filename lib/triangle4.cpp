@@ -0,0 +1,217 @@
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "triangle4.h"
+
+// Intersects the four lanes of p using the permutation and shear of q. Returns the
+// nearest lane hit in (t_min, t_max) or -1; e0..e2 and det receive the lane's edge
+// functions for the barycentrics.
+#if defined(__SSE2__)
+
+static inline int intersect4(const triangle4& p, const ray_query& q, const float t_min, const float t_max,
+                             float& t, float& e0_out, float& e1_out, float& e2_out, float& det_out) {
+
+    const __m128 ox = _mm_set1_ps(q.origin_f[q.kx]);
+    const __m128 oy = _mm_set1_ps(q.origin_f[q.ky]);
+    const __m128 oz = _mm_set1_ps(q.origin_f[q.kz]);
+    const __m128 sx = _mm_set1_ps(q.sx_f);
+    const __m128 sy = _mm_set1_ps(q.sy_f);
+    const __m128 sz = _mm_set1_ps(q.sz_f);
+
+    // translate and permute
+    const __m128 az = _mm_sub_ps(_mm_load_ps(p.v0[q.kz]), oz);
+    const __m128 bz = _mm_sub_ps(_mm_load_ps(p.v1[q.kz]), oz);
+    const __m128 cz = _mm_sub_ps(_mm_load_ps(p.v2[q.kz]), oz);
+
+    // shear
+    const __m128 ax = _mm_add_ps(_mm_sub_ps(_mm_load_ps(p.v0[q.kx]), ox), _mm_mul_ps(sx, az));
+    const __m128 ay = _mm_add_ps(_mm_sub_ps(_mm_load_ps(p.v0[q.ky]), oy), _mm_mul_ps(sy, az));
+    const __m128 bx = _mm_add_ps(_mm_sub_ps(_mm_load_ps(p.v1[q.kx]), ox), _mm_mul_ps(sx, bz));
+    const __m128 by = _mm_add_ps(_mm_sub_ps(_mm_load_ps(p.v1[q.ky]), oy), _mm_mul_ps(sy, bz));
+    const __m128 cx = _mm_add_ps(_mm_sub_ps(_mm_load_ps(p.v2[q.kx]), ox), _mm_mul_ps(sx, cz));
+    const __m128 cy = _mm_add_ps(_mm_sub_ps(_mm_load_ps(p.v2[q.ky]), oy), _mm_mul_ps(sy, cz));
+
+    // edge functions; the origin must lie on the same side of all three edges
+    const __m128 e0 = _mm_sub_ps(_mm_mul_ps(bx, cy), _mm_mul_ps(by, cx));
+    const __m128 e1 = _mm_sub_ps(_mm_mul_ps(cx, ay), _mm_mul_ps(cy, ax));
+    const __m128 e2 = _mm_sub_ps(_mm_mul_ps(ax, by), _mm_mul_ps(ay, bx));
+
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 any_negative = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(e0, zero), _mm_cmplt_ps(e1, zero)), _mm_cmplt_ps(e2, zero));
+    const __m128 any_positive = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(e0, zero), _mm_cmpgt_ps(e1, zero)), _mm_cmpgt_ps(e2, zero));
+
+    const __m128 det = _mm_add_ps(_mm_add_ps(e0, e1), e2);
+    const __m128 t_scaled = _mm_mul_ps(sz, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e0, az), _mm_mul_ps(e1, bz)), _mm_mul_ps(e2, cz)));
+    const __m128 t4 = _mm_div_ps(t_scaled, det);
+
+    // degenerate lanes (det == 0) produce inf / nan distances that fail the range test
+    __m128 valid = _mm_andnot_ps(_mm_and_ps(any_negative, any_positive), _mm_cmpneq_ps(det, zero));
+    valid = _mm_and_ps(valid, _mm_cmpgt_ps(t4, _mm_set1_ps(t_min)));
+    valid = _mm_and_ps(valid, _mm_cmplt_ps(t4, _mm_set1_ps(t_max)));
+
+    const int valid_mask = _mm_movemask_ps(valid);
+    if (valid_mask == 0) {
+        return -1;
+    }
+
+    // nearest valid lane
+    const __m128 inf = _mm_set1_ps(std::numeric_limits<float>::infinity());
+    __m128 t_min4 = _mm_or_ps(_mm_and_ps(valid, t4), _mm_andnot_ps(valid, inf));
+    t_min4 = _mm_min_ps(t_min4, _mm_shuffle_ps(t_min4, t_min4, _MM_SHUFFLE(2, 3, 0, 1)));
+    t_min4 = _mm_min_ps(t_min4, _mm_shuffle_ps(t_min4, t_min4, _MM_SHUFFLE(1, 0, 3, 2)));
+    const int lane = __builtin_ctz(valid_mask & _mm_movemask_ps(_mm_cmpeq_ps(t4, t_min4)));
+
+    alignas(16) float lanes[4];
+    _mm_store_ps(lanes, t4);    t = lanes[lane];
+    _mm_store_ps(lanes, e0);    e0_out = lanes[lane];
+    _mm_store_ps(lanes, e1);    e1_out = lanes[lane];
+    _mm_store_ps(lanes, e2);    e2_out = lanes[lane];
+    _mm_store_ps(lanes, det);   det_out = lanes[lane];
+    return lane;
+}
+
+#else
+
+static inline int intersect4(const triangle4& p, const ray_query& q, const float t_min, const float t_max,
+                             float& t, float& e0_out, float& e1_out, float& e2_out, float& det_out) {
+    int nearest = -1;
+    t = t_max;
+
+    for (int lane = 0; lane < 4; lane++) {
+        const float az = p.v0[q.kz][lane] - q.origin_f[q.kz];
+        const float bz = p.v1[q.kz][lane] - q.origin_f[q.kz];
+        const float cz = p.v2[q.kz][lane] - q.origin_f[q.kz];
+        const float ax = p.v0[q.kx][lane] - q.origin_f[q.kx] + q.sx_f * az;
+        const float ay = p.v0[q.ky][lane] - q.origin_f[q.ky] + q.sy_f * az;
+        const float bx = p.v1[q.kx][lane] - q.origin_f[q.kx] + q.sx_f * bz;
+        const float by = p.v1[q.ky][lane] - q.origin_f[q.ky] + q.sy_f * bz;
+        const float cx = p.v2[q.kx][lane] - q.origin_f[q.kx] + q.sx_f * cz;
+        const float cy = p.v2[q.ky][lane] - q.origin_f[q.ky] + q.sy_f * cz;
+
+        const float e0 = bx * cy - by * cx;
+        const float e1 = cx * ay - cy * ax;
+        const float e2 = ax * by - ay * bx;
+        if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0)) {
+            continue;
+        }
+
+        const float det = e0 + e1 + e2;
+        if (det == 0) {
+            continue;
+        }
+
+        const float t_lane = q.sz_f * (e0 * az + e1 * bz + e2 * cz) / det;
+        if (t_lane > t_min && t_lane < t) {
+            nearest = lane;
+            t = t_lane;
+            e0_out = e0;
+            e1_out = e1;
+            e2_out = e2;
+            det_out = det;
+        }
+    }
+    return nearest;
+}
+
+#endif
+
+triangle4_leaves::triangle4_leaves(const linear_bvh& tree) {
+
+    const std::vector<linear_bvh_node>& nodes = tree.nodes();
+    const std::vector<std::shared_ptr<hittable>>& primitives = tree.primitives();
+
+    _triangles.reserve(primitives.size());
+    for (auto& primitive : primitives) {
+        _triangles.push_back(static_cast<const triangle*>(primitive.get()));
+    }
+
+    _first_packet.assign(primitives.size(), 0);
+    _packets.reserve((primitives.size() + 3) / 4);
+
+    for (size_t n = 0; n < nodes.size(); n++) {
+        const linear_bvh_node& node = nodes[n];
+        if (node.num_primitives == 0) {
+            continue;
+        }
+
+        _first_packet[node.offset] = _packets.size();
+
+        for (uint32_t first = 0; first < node.num_primitives; first += 4) {
+            // unused lanes keep an all-zero triangle, which has no area and never hits
+            triangle4 packet = {};
+            for (int lane = 0; lane < 4; lane++) {
+                packet.primitive[lane] = NO_INDEX;
+                if (first + lane >= node.num_primitives) {
+                    continue;
+                }
+
+                const uint32_t index = node.offset + first + lane;
+                const triangle* tri = _triangles[index];
+                for (int a = 0; a < 3; a++) {
+                    packet.v0[a][lane] = static_cast<float>(tri->vertex(0)[a]);
+                    packet.v1[a][lane] = static_cast<float>(tri->vertex(1)[a]);
+                    packet.v2[a][lane] = static_cast<float>(tri->vertex(2)[a]);
+                }
+                packet.primitive[lane] = index;
+            }
+            _packets.push_back(packet);
+        }
+    }
+}
+
+bool triangle4_leaves::hit_leaf(const uint32_t first_primitive, const uint32_t num_primitives,
+                                const ray_query& q, double t_min, double t_max, hit_record& rec) const {
+
+    const float t_lo = static_cast<float>(t_min);
+    float t_hi = static_cast<float>(t_max);
+
+    const triangle* nearest = nullptr;
+    float e0 = 0, e1 = 0, e2 = 0, det = 1;
+
+    const uint32_t first = _first_packet[first_primitive];
+    const uint32_t last = first + (num_primitives + 3) / 4;
+    for (uint32_t k = first; k < last; k++) {
+        float t, lane_e0, lane_e1, lane_e2, lane_det;
+        int lane = intersect4(_packets[k], q, t_lo, t_hi, t, lane_e0, lane_e1, lane_e2, lane_det);
+        if (lane >= 0) {
+            nearest = _triangles[_packets[k].primitive[lane]];
+            t_hi = t;
+            e0 = lane_e0;
+            e1 = lane_e1;
+            e2 = lane_e2;
+            det = lane_det;
+        }
+    }
+
+    if (!nearest) {
+        return false;
+    }
+
+    const double one_over_det = 1.0 / det;
+    nearest->set_hit_record(q.r, t_hi, e0 * one_over_det, e1 * one_over_det, e2 * one_over_det, rec);
+    return true;
+}
+
+bool triangle4_leaves::occluded_leaf(const uint32_t first_primitive, const uint32_t num_primitives,
+                                     const ray_query& q, double t_min, double t_max) const {
+
+    const uint32_t first = _first_packet[first_primitive];
+    const uint32_t last = first + (num_primitives + 3) / 4;
+    for (uint32_t k = first; k < last; k++) {
+        float t, e0, e1, e2, det;
+        if (intersect4(_packets[k], q, static_cast<float>(t_min), static_cast<float>(t_max), t, e0, e1, e2, det) >= 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t triangle4_leaves::memory_bytes() const {
+    return sizeof(triangle4_leaves) + _packets.capacity() * sizeof(triangle4)
+         + _first_packet.capacity() * sizeof(uint32_t)
+         + _triangles.capacity() * sizeof(const triangle*);
+}
@@ -1,4 +1,11 @@
+#include <chrono>
+
 #include "triangle_mesh.h"
+#include "parallel.h"
+#include "light_list.h"
+
+// vertices / triangles per thread when baking and committing large meshes
+static const size_t min_chunk_size = 1 << 16;
 
 triangle_mesh::triangle_mesh(const std::vector<point3>& vertices, 
     const std::vector<vec3>& normals, 
@@ -20,7 +27,7 @@ triangle_mesh::triangle_mesh(const std::vector<point3>& vertices,
     : _vertices(vertices), _normals(normals), _texture_coords(texture_coords), _mat(m) {
 
     for (auto& face : faces) {
-        _triangles.push_back(std::make_shared<triangle>(this, face.vertex_indices, face.normal_indices));
+        _triangles.push_back(std::make_shared<triangle>(this, face.vertex_indices, face.normal_indices, face.texture_indices));
     } 
 }
 
@@ -36,13 +43,37 @@ triangle_mesh::triangle_mesh(const std::vector<point3>& vertices,
     } 
 } 
 
-bool triangle_mesh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    if (!box.hit(r, t_min, t_max)) {
+triangle_mesh::triangle_mesh(std::vector<point3>&& vertices,
+    std::vector<vec3>&& normals,
+    std::vector<vec3>&& texture_coords,
+    const triangle_indices& indices,
+    std::shared_ptr<material> m)
+    : _vertices(std::move(vertices)), _normals(std::move(normals)), _texture_coords(std::move(texture_coords)), _mat(m) {
+
+    const size_t num_triangles = indices.vertex_indices.size() / 3;
+    const bool has_texture_indices = indices.texture_indices.size() == indices.vertex_indices.size();
+    _triangles.reserve(num_triangles);
+    for (size_t k = 0; k < num_triangles; k++) {
+        _triangles.push_back(std::make_shared<triangle>(this, &indices.vertex_indices[3*k], &indices.normal_indices[3*k],
+                                                        has_texture_indices ? &indices.texture_indices[3*k] : nullptr));
+    }
+}
+
+bool triangle_mesh::hit(const ray_query& q, double t_min, double t_max, hit_record& rec) const {
+    if (!_wide || !box.hit(q, t_min, t_max)) {
         return false;
     }
 
     // use BVH to determine ray-triangle intersection
-    return node->hit(r, t_min, t_max, rec);
+    return _wide->hit(q, t_min, t_max, rec);
+}
+
+bool triangle_mesh::occluded(const ray_query& q, double t_min, double t_max) const {
+    if (!_wide || !box.hit(q, t_min, t_max)) {
+        return false;
+    }
+
+    return _wide->occluded(q, t_min, t_max);
 }
 
 point3 triangle_mesh::centroid() const {
@@ -50,12 +81,14 @@ point3 triangle_mesh::centroid() const {
 }
 
 bool triangle_mesh::create_bounding_box() {
+    if (_transforms_dirty) {
+        bake_transforms();
+    }
+
     double maxX = -INF, maxY = -INF, maxZ = -INF;
     double minX = INF, minY = INF, minZ = INF; 
     
-    for (auto v : _vertices) {
-        v = transform::apply_transforms(v, _transforms);
-
+    for (auto& v : _world_vertices) {
         maxX = std::fmax(v[0], maxX);
         maxY = std::fmax(v[1], maxY);
         maxZ = std::fmax(v[2], maxZ);
@@ -69,11 +102,92 @@ bool triangle_mesh::create_bounding_box() {
     return true;
 }
 
+void triangle_mesh::bake_transforms() {
+    _world_vertices.resize(_vertices.size());
+    parallel_for(_vertices.size(), parallel_chunks(_vertices.size(), min_chunk_size), [this](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            _world_vertices[i] = transform::apply_transforms(_vertices[i], _transforms);
+        }
+    });
+
+    _world_normals.resize(_normals.size());
+    parallel_for(_normals.size(), parallel_chunks(_normals.size(), min_chunk_size), [this](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            _world_normals[i] = unit_vector(transform::apply_normal_transforms(_normals[i], _transforms));
+        }
+    });
+
+    _transforms_dirty = false;
+    reset_bvh();    // BVH was built over the old positions
+}
+
 bool triangle_mesh::commit() {
-    for (auto& tri : _triangles) {
-        if (!tri->commit())
+    std::lock_guard<std::mutex> lock(_commit_mutex);
+
+    // e.g. the empty mesh the OBJ loader returns for a missing file; there is nothing to build or trace
+    if (_triangles.empty()) {
+        return false;
+    }
+
+    if (_transforms_dirty) {
+        bake_transforms();
+    }
+
+    // nothing moved since the last commit
+    if (this->node) {
+        return true;
+    }
+
+    std::vector<char> committed(parallel_chunks(_triangles.size(), min_chunk_size), 1);
+    parallel_for(_triangles.size(), committed.size(), [&](size_t chunk, size_t begin, size_t end) {
+        for (size_t i = begin; i < end && committed[chunk]; i++) {
+            committed[chunk] = _triangles[i]->commit();
+        }
+    });
+    for (char ok : committed) {
+        if (!ok)
             return false;
     }
-    this->node = std::make_shared<bvh_node>(_triangles, 0, _triangles.size());
+
+    if (_cached_bvh && _transforms.empty()) {
+        // a BVH loaded from a mesh cache is in object space, which is world space here
+        this->node = _cached_bvh;
+        _build_seconds = 0.0;
+    } else {
+        // packed leaves test four triangles for about the price of one, so fuller leaves pay off
+        bvh_build_options options = _bvh_options;
+        if (_packet_intersection) {
+            options.leaf_batch_size = 4;
+        }
+        auto start = std::chrono::steady_clock::now();
+        bvh_node tree(_triangles, 0, _triangles.size(), options);
+        this->node = std::make_shared<linear_bvh>(tree);
+        _build_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    _wide = std::make_shared<bvh4>(*this->node);
+    _leaves = std::make_shared<triangle4_leaves>(*this->node);
+    this->node->set_leaf_intersector(_packet_intersection ? _leaves.get() : nullptr);
+    _wide->set_leaf_intersector(_packet_intersection ? _leaves.get() : nullptr);
     return create_bounding_box() && (this->node != nullptr);
-}
\ No newline at end of file
+}
+
+void triangle_mesh::bind_lights(light_list& lights) {
+    const bool emissive = _mat && _mat->is_emissive();
+    const color radiance = emissive ? _mat->emission() : color(0,0,0);
+
+    for (auto& object : _triangles) {
+        triangle* tri = static_cast<triangle*>(object.get());
+        tri->_light_id = NO_LIGHT;
+        if (!emissive) {
+            continue;
+        }
+
+        // the emitting side follows the vertex normals when there are any, like the front face of a hit
+        vec3 n(0, 0, 0);
+        if (tri->_has_normals) {
+            n = _world_normals[tri->_ni0] + _world_normals[tri->_ni1] + _world_normals[tri->_ni2];
+        }
+        tri->_light_id = lights.add(std::make_shared<triangle_light>(tri->vertex(0), tri->vertex(1), tri->vertex(2), radiance, n));
+    }
+}
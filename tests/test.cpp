@@ -2,8 +2,16 @@
 #include <utility>
 #include <random>
 #include <functional>
+#include <chrono>
+#include <set>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <cstring>
 
-#include "../src/rtcore.h"
+#include "../include/rtcore.h"
+#include "../include/tile_scheduler.h"
+#include "../include/renderer.h"
 
 /* ------------- Test cases ------------- */
 
@@ -42,6 +50,9 @@ bool test_simple_triangle_mesh() {
     std::shared_ptr<material> mat = std::make_shared<lambertian>(color(0.5, 0.5, 0.5));
 
     triangle_mesh mesh(vertices, normals, faces, mat);
+    if (!mesh.commit()) {
+        return false;
+    }
 
     // generate ray that will intersect the mesh
     bool passed = true;
@@ -85,10 +96,55 @@ bool test_simple_triangle_mesh() {
     return passed;
 }
 
+bool test_mesh_transforms() {
+
+    // transforms pushed after a commit must move the mesh on the next commit
+    auto mesh = get_triangle_mesh_from_file("../objs/tetrahedron.obj");
+    bool passed = mesh->commit();
+    passed &= std::fabs(mesh->get_bounding_box().min().x() + 1) < EPS;
+
+    hit_record rec;
+    mesh->push_transform(std::make_shared<translation>(vec3(10, 0, 0)));
+    passed &= mesh->commit();
+    passed &= std::fabs(mesh->get_bounding_box().min().x() - 9) < EPS;
+    passed &= mesh->hit(ray(point3(10, 5, 0), vec3(0, -1, 0)), 0.001, INF, rec);
+    passed &= !mesh->hit(ray(point3(0, 5, 0), vec3(0, -1, 0)), 0.001, INF, rec);
+
+    mesh->push_transform(std::make_shared<translation>(vec3(10, 0, 0)));
+    passed &= mesh->commit();
+    passed &= std::fabs(mesh->get_bounding_box().min().x() - 19) < EPS;
+
+    mesh->pop_transform();
+    passed &= mesh->commit();
+    passed &= std::fabs(mesh->get_bounding_box().min().x() - 9) < EPS;
+
+    // centred on its bounding box: x and z span [-1, 1], y spans [-0.5, 0.5]
+    mesh->to_origin();
+    passed &= mesh->commit();
+    aabb box = mesh->get_bounding_box();
+    passed &= (box.min() - point3(-1, -0.5, -1)).length() < EPS;
+    passed &= (box.max() - point3(1, 0.5, 1)).length() < EPS;
+    passed &= mesh->hit(ray(point3(0, 5, 0), vec3(0, -1, 0)), 0.001, INF, rec);
+    passed &= std::fabs(rec.p.y() - 0.5) < EPS;
+
+    return passed;
+}
+
+/* triangles belong to a mesh, so each one under test gets a committed mesh of its own,
+   traced with the scalar triangle::hit rather than the packed leaves */
+std::shared_ptr<triangle_mesh> single_triangle(const std::vector<point3>& vertices) {
+    face f;
+    f.vertex_indices = {0, 1, 2};
+    auto mesh = std::make_shared<triangle_mesh>(vertices, std::vector<vec3>(), std::vector<face>{f}, nullptr);
+    mesh->set_packet_intersection(false);
+    mesh->commit();
+    return mesh;
+}
+
 bool test_triangle_intersection_simple() {
 
     // very simple collision test
-    triangle tri_simple_hit(std::vector<point3>{point3(0, 1, -5), point3(-1, -1, -5), point3(1, -1, -5)});
+    auto tri_simple_hit = single_triangle({point3(0, 1, -5), point3(-1, -1, -5), point3(1, -1, -5)});
 
     ray r_simple_hit(point3(0,0,-1), vec3(0,0,-1));
     double t_min = 0.001, t_max = 100;
@@ -96,7 +152,7 @@ bool test_triangle_intersection_simple() {
 
     bool expected = true;
     int t_expected = 4;
-    bool result = (expected == tri_simple_hit.hit(r_simple_hit, t_min, t_max, rec));
+    bool result = (expected == tri_simple_hit->hit(r_simple_hit, t_min, t_max, rec));
     result &= (rec.t == t_expected);
 
     return result;
@@ -112,7 +168,8 @@ bool test_triangle_intersection_random() {
         vertices.push_back(vertex);
     }
 
-    triangle tri(vertices);
+    auto tri = single_triangle(vertices);
+    point3 tri_centroid = (vertices[0] + vertices[1] + vertices[2]) / 3;
 
     // generate random ray
     point3 ray_origin;
@@ -143,9 +200,9 @@ bool test_triangle_intersection_random() {
         point3 point_on_tri_edge = v0 + t * (v1 - v0);
 
         // dither from edge by amount delta
-        vec3 centroid_to_edge = point_on_tri_edge - tri.centroid();
+        vec3 centroid_to_edge = point_on_tri_edge - tri_centroid;
         double delta = random_double(1,2);
-        point3 point_outside_tri = tri.centroid() + delta * centroid_to_edge;
+        point3 point_outside_tri = tri_centroid + delta * centroid_to_edge;
 
         ray_direction = unit_vector(point_outside_tri - ray_origin);        
     }
@@ -154,7 +211,7 @@ bool test_triangle_intersection_random() {
     ray r(ray_origin, ray_direction);
     hit_record rec;
     double t_min = 0.001, t_max = 100;
-    bool result = (ray_should_hit_triangle == tri.hit(r, t_min, t_max, rec));
+    bool result = (ray_should_hit_triangle == tri->hit(r, t_min, t_max, rec));
 
     // check results
     if (!result) {
@@ -190,24 +247,30 @@ bool test_triangle_intersection_watertightness() {
     vec3 tri_normal = unit_vector(cross(vertices[2] - vertices[0], vertices[1] - vertices[0]));
     vertices.push_back(vert4 + (random_double() - 0.5) * 2 * tri_normal);
 
-    triangle tri1({vertices[0], vertices[1], vertices[2]});
-    triangle tri2({vertices[2], vertices[1], vertices[3]});
-
-    // generate random ray origin
-    point3 ray_origin(random_double(min_pos, max_pos), random_double(min_pos, max_pos), random_double(min_pos, max_pos));
-    vec3 ray_direction;
+    auto tri1 = single_triangle({vertices[0], vertices[1], vertices[2]});
+    auto tri2 = single_triangle({vertices[2], vertices[1], vertices[3]});
 
     // get random point on shared triangle edge
     float t = random_double();
     point3 point_on_tri_edge = vertices[1] + t * (vertices[2] - vertices[1]);
 
+    // generate random ray origin; the shared edge must not be a silhouette from there, since a ray
+    // rounded onto the empty side of a silhouette rightly misses both triangles
+    vec3 normal1 = cross(vertices[1] - vertices[0], vertices[2] - vertices[0]);
+    vec3 normal2 = cross(vertices[1] - vertices[2], vertices[3] - vertices[2]);
+    point3 ray_origin;
+    vec3 ray_direction;
+    do {
+        ray_origin = point3(random_double(min_pos, max_pos), random_double(min_pos, max_pos), random_double(min_pos, max_pos));
+        ray_direction = unit_vector(point_on_tri_edge - ray_origin);
+    } while ((dot(ray_direction, normal1) < 0) != (dot(ray_direction, normal2) < 0));
+
     // generate ray
-    ray_direction = unit_vector(point_on_tri_edge - ray_origin);
     ray r(ray_origin, ray_direction);
 
     hit_record rec;
     float t_min = 0.001, t_max = 100, t_expected = (point_on_tri_edge - ray_origin).length();
-    bool result = (tri1.hit(r, t_min, t_max, rec) || tri2.hit(r, t_min, t_max, rec));
+    bool result = (tri1->hit(r, t_min, t_max, rec) || tri2->hit(r, t_min, t_max, rec));
 
     return result;
 
@@ -257,6 +320,1322 @@ bool test_bvh() {
     return true;
 }
 
+bool test_tile_scheduler() {
+
+    // every pixel must be handed out exactly once, however the threads interleave
+    const unsigned int width = 123, height = 77, tile_size = 16, nthreads = 4;
+    tile_scheduler scheduler(width, height, tile_size, nthreads);
+    std::vector<int> coverage(width * height, 0);
+
+    tile t;
+    bool stolen;
+    int tiles_stolen = 0;
+    for (unsigned int i = 0; scheduler.next_tile(i % 2, t, stolen); i++) {
+        tiles_stolen += stolen;
+        for (unsigned int y = t.y0; y < t.y1; y++) {
+            for (unsigned int x = t.x0; x < t.x1; x++) {
+                coverage[y * width + x]++;
+            }
+        }
+    }
+
+    for (auto count : coverage) {
+        if (count != 1) {
+            std::cerr << "test_tile_scheduler() failed: pixel covered " << count << " times" << std::endl;
+            return false;
+        }
+    }
+
+    // only threads 0 and 1 asked for work, so threads 2 and 3 must have been robbed
+    return tiles_stolen > 0;
+}
+
+bool test_rng_streams() {
+
+    // identical keys must reproduce identical streams, different keys must not
+    counter_rng a, b, c;
+    a.start_pixel_sample(41, 1234, 7);
+    b.start_pixel_sample(41, 1234, 7);
+    c.start_pixel_sample(41, 1235, 7);
+
+    bool passed = true;
+    int num_equal_to_neighbour = 0;
+    for (int i = 0; i < 64; i++) {
+        double x = a.next_double();
+        passed &= (x == b.next_double());
+        passed &= (x >= 0.0 && x < 1.0);
+        num_equal_to_neighbour += (x == c.next_double());
+    }
+
+    // restarting a bounce rewinds its stream
+    a.start_bounce(3);
+    double first = a.next_double();
+    a.start_bounce(3);
+    passed &= (first == a.next_double());
+
+    return passed && num_equal_to_neighbour == 0;
+}
+
+template<class Tree>
+double average_nodes_visited(const Tree& bvh, const std::vector<ray>& rays) {
+    size_t visited = 0;
+    for (auto& r : rays) {
+        visited += bvh.nodes_visited(r, 0.001, INF);
+    }
+    return double(visited) / rays.size();
+}
+
+std::vector<ray> rays_towards(const aabb& box, const int num_rays) {
+    // rays from a sphere around the box aimed at random points inside it
+    std::vector<ray> rays;
+    point3 center = (box.min() + box.max()) / 2;
+    double radius = (box.max() - box.min()).length() * 2;
+    for (int i = 0; i < num_rays; i++) {
+        point3 origin = center + radius * unit_vector(vec3::random(-1, 1));
+        point3 target(random_double(box.min().x(), box.max().x()),
+                      random_double(box.min().y(), box.max().y()),
+                      random_double(box.min().z(), box.max().z()));
+        rays.push_back(ray(origin, target - origin));
+    }
+    return rays;
+}
+
+bool test_bvh_quality() {
+
+    // compares SAH and median trees on a mesh and on a field of small spheres
+    bool passed = true;
+    const int num_rays = 10000;
+
+    std::vector<std::shared_ptr<hittable>> spheres;
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+            spheres.push_back(std::make_shared<sphere>(center, 0.2));
+        }
+    }
+    spheres.push_back(std::make_shared<sphere>(point3(0,-1000,0), 1000));
+
+    auto mesh = get_triangle_mesh_from_file("../objs/teapot.obj");
+
+    for (int scene = 0; scene < 2; scene++) {
+        const char* name = (scene == 0) ? "spheres" : "teapot";
+        std::vector<std::shared_ptr<linear_bvh>> trees;
+        std::vector<ray> rays;
+
+        for (auto method : {SPLIT_MEDIAN, SPLIT_SAH}) {
+            bvh_build_options options;
+            options.method = method;
+            if (scene == 0) {
+                trees.push_back(std::make_shared<linear_bvh>(bvh_node(spheres, 0, spheres.size(), options)));
+            } else {
+                mesh->set_bvh_options(options);
+                if (!mesh->commit()) {
+                    return false;
+                }
+                trees.push_back(mesh->bvh());
+            }
+        }
+
+        // aim at the interesting part of the scene, not at the ground sphere
+        rays = rays_towards(scene == 0 ? aabb(point3(-11, 0, -11), point3(11, 0.4, 11)) : mesh->get_bounding_box(), num_rays);
+
+        for (size_t k = 0; k < trees.size(); k++) {
+            std::cout << name << (k == 0 ? " median" : " sah") << ": sah cost " << trees[k]->sah_cost()
+                      << ", " << trees[k]->node_count() << " nodes, "
+                      << average_nodes_visited(*trees[k], rays) << " nodes visited per ray" << std::endl;
+        }
+        // the two builds must really be different trees, and SAH the cheaper one
+        passed &= trees[0] != trees[1] && trees[1]->sah_cost() < trees[0]->sah_cost();
+    }
+
+    return passed;
+}
+
+template<class Tree>
+double seconds_to_trace(const Tree& bvh, const std::vector<ray>& rays, int& num_hits) {
+    auto start = std::chrono::steady_clock::now();
+    num_hits = 0;
+    for (auto& r : rays) {
+        hit_record rec;
+        num_hits += bvh.hit(r, 0.001, INF, rec);
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool test_bvh_layout() {
+
+    // pointer tree vs flattened array over the same primitives, same rays
+    auto mesh = get_triangle_mesh_from_file("../objs/teapot.obj");
+    if (!mesh->commit()) {
+        return false;
+    }
+
+    std::vector<std::shared_ptr<hittable>> triangles = mesh->bvh()->primitives();
+    bvh_node tree(triangles, 0, triangles.size());
+    linear_bvh flat(tree);
+    std::vector<ray> rays = rays_towards(mesh->get_bounding_box(), 200000);
+
+    int tree_hits, flat_hits;
+    double tree_seconds = seconds_to_trace(tree, rays, tree_hits);
+    double flat_seconds = seconds_to_trace(flat, rays, flat_hits);
+
+    std::cout << "tree: " << tree.node_count() << " nodes, " << tree.memory_bytes() << " bytes, "
+              << rays.size() / tree_seconds << " rays/s" << std::endl;
+    std::cout << "flat: " << flat.node_count() << " nodes, " << flat.memory_bytes() << " bytes, "
+              << rays.size() / flat_seconds << " rays/s" << std::endl;
+
+    return tree_hits == flat_hits;
+}
+
+bool test_bvh_wide() {
+
+    // binary flat tree vs the four-wide tree collapsed from it, same leaves and rays
+    auto mesh = get_triangle_mesh_from_file("../objs/teapot.obj");
+    if (!mesh->commit()) {
+        return false;
+    }
+
+    std::shared_ptr<linear_bvh> binary = mesh->bvh();
+    std::shared_ptr<bvh4> wide = mesh->wide_bvh();
+    std::vector<ray> rays = rays_towards(mesh->get_bounding_box(), 200000);
+
+    int binary_hits, wide_hits;
+    double binary_seconds = seconds_to_trace(*binary, rays, binary_hits);
+    double wide_seconds = seconds_to_trace(*wide, rays, wide_hits);
+
+    std::cout << "bvh2: " << binary->node_count() << " nodes, " << binary->memory_bytes() << " bytes, "
+              << average_nodes_visited(*binary, rays) << " nodes/ray, " << rays.size() / binary_seconds << " rays/s" << std::endl;
+    std::cout << "bvh4: " << wide->node_count() << " nodes, " << wide->memory_bytes() << " bytes, "
+              << average_nodes_visited(*wide, rays) << " nodes/ray, " << rays.size() / wide_seconds << " rays/s" << std::endl;
+
+    return binary_hits == wide_hits;
+}
+
+bool test_bvh_degenerate() {
+
+    // geometrically spaced spheres build trees deeper than the usual fixed traversal stacks
+    std::vector<std::shared_ptr<hittable>> spheres;
+    for (int k = 0; k < 3000; k++) {
+        spheres.push_back(std::make_shared<sphere>(point3(std::pow(1.2, k), 0, 0), 0.25));
+    }
+    bvh_node tree(spheres, 0, spheres.size());
+    linear_bvh flat(tree);
+    bvh4 wide(flat);
+    bool passed = flat.depth() > 64 && 3 * wide.depth() + 4 > 256;
+
+    const ray along_x(point3(-1, 0, 0), vec3(1, 0, 0));
+    hit_record tree_rec, flat_rec, wide_rec;
+    passed &= tree.hit(along_x, 0.001, INF, tree_rec) && flat.hit(along_x, 0.001, INF, flat_rec);
+    passed &= wide.hit(along_x, 0.001, INF, wide_rec);
+    passed &= (tree_rec.t == flat_rec.t) && (tree_rec.t == wide_rec.t);
+    passed &= flat.occluded(along_x, 0.001, INF) && wide.occluded(along_x, 0.001, INF);
+
+    // positions overflowing to inf leave no axis to bin on, which is left to the median split
+    std::vector<std::shared_ptr<hittable>> overflowing;
+    for (int k = 0; k < 3000; k++) {
+        overflowing.push_back(std::make_shared<sphere>(point3(std::pow(1.3, k), 0, 0), 0.25));
+    }
+    linear_bvh overflowed(bvh_node(overflowing, 0, overflowing.size()));
+    passed &= overflowed.hit(along_x, 0.001, INF, flat_rec) && flat_rec.t == tree_rec.t;
+
+    // a build over nothing flattens to no nodes, not to one empty leaf
+    std::vector<std::shared_ptr<hittable>> none;
+    linear_bvh empty(bvh_node(none, 0, 0));
+    passed &= empty.node_count() == 0 && !empty.hit(along_x, 0.001, INF, flat_rec) && !empty.occluded(along_x, 0.001, INF);
+    bvh4 empty_wide(empty);
+    passed &= empty_wide.node_count() == 0 && !empty_wide.hit(along_x, 0.001, INF, wide_rec);
+
+    // so is a mesh without triangles, e.g. from a missing OBJ; it refuses to commit and is never hit
+    triangle_mesh no_triangles(std::vector<point3>(), std::vector<vec3>(), std::vector<face>(), nullptr);
+    passed &= !no_triangles.commit() && !no_triangles.hit(along_x, 0.001, INF, flat_rec);
+
+    // leaves larger than a flattened node can count are split instead of truncated
+    std::vector<std::shared_ptr<hittable>> crowd;
+    for (int k = 0; k < 70000; k++) {
+        crowd.push_back(std::make_shared<sphere>(point3(k, 0, 0), 0.25));
+    }
+    bvh_build_options options;
+    options.method = SPLIT_MEDIAN;
+    options.max_leaf_size = 100000;
+    linear_bvh crowded(bvh_node(crowd, 0, crowd.size(), options));
+    size_t leaf_primitives = 0;
+    for (auto& node : crowded.nodes()) {
+        leaf_primitives += node.num_primitives;
+    }
+    passed &= leaf_primitives == crowd.size();
+
+    return passed;
+}
+
+bool test_bvh_parallel() {
+
+    // a parallel build splits the same bins as a serial one, so the trees must match
+    std::vector<std::shared_ptr<hittable>> spheres;
+    for (int i = 0; i < 50000; i++) {
+        point3 center(100 * random_double(), 100 * random_double(), 100 * random_double());
+        spheres.push_back(std::make_shared<sphere>(center, 0.1 + 0.4 * random_double()));
+    }
+
+    std::vector<std::shared_ptr<linear_bvh>> trees;
+    for (unsigned int threads : {1u, 4u}) {
+        bvh_build_options options;
+        options.num_threads = threads;
+        options.parallel_min_primitives = 1024;
+
+        std::vector<std::shared_ptr<hittable>> objects = spheres;
+        auto start = std::chrono::steady_clock::now();
+        bvh_node tree(objects, 0, objects.size(), options);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        trees.push_back(std::make_shared<linear_bvh>(tree));
+
+        std::cout << threads << " thread(s): " << trees.back()->node_count() << " nodes, sah cost "
+                  << trees.back()->sah_cost() << ", built in " << seconds << "s" << std::endl;
+    }
+
+    std::vector<ray> rays = rays_towards(trees[0]->get_bounding_box(), 10000);
+    int serial_hits, parallel_hits;
+    seconds_to_trace(*trees[0], rays, serial_hits);
+    seconds_to_trace(*trees[1], rays, parallel_hits);
+
+    return trees[0]->node_count() == trees[1]->node_count()
+        && trees[0]->sah_cost() == trees[1]->sah_cost()
+        && serial_hits == parallel_hits;
+}
+
+bool test_occlusion() {
+
+    // any-hit queries must agree with closest-hit ones on every interval
+    auto mesh = get_triangle_mesh_from_file("../objs/teapot.obj");
+    hittable_list world;
+    world.add(mesh);
+    world.add(std::make_shared<mesh_instance>(mesh,
+              std::vector<std::shared_ptr<transform>>{ std::make_shared<translation>(vec3(8, 0, 0)) }));
+    for (int i = 0; i < 200; i++) {
+        point3 center(-10 + 30 * random_double(), -5 + 10 * random_double(), -10 + 20 * random_double());
+        world.add(std::make_shared<sphere>(center, 0.2 + 0.5 * random_double()));
+    }
+    world.add(std::make_shared<moving_sphere>(point3(4, 0, 0), point3(4, 1, 0), 1.0, nullptr, 0.0, 1.0));
+    world.commit();
+
+    std::vector<ray> rays = rays_towards(world.get_bounding_box(), 20000);
+    std::vector<const hittable*> trees = { &world, world.bvh().get(), mesh.get(), mesh->bvh().get() };
+
+    int mismatches = 0, num_occluded = 0;
+    for (auto& r : rays) {
+        // a segment of the ray, as a shadow ray towards a light would be; rays start about 80 units out
+        double t_min = random_double(0.001, 100.0);
+        double t_max = t_min + random_double(0.0, 20.0);
+        ray_query q(r);
+
+        for (auto tree : trees) {
+            hit_record rec;
+            bool hit = tree->hit(q, t_min, t_max, rec);
+            bool occluded = tree->occluded(q, t_min, t_max);
+            mismatches += hit != occluded || (hit && (rec.t < t_min || rec.t > t_max));
+            num_occluded += occluded;
+        }
+    }
+
+    std::cout << num_occluded << " of " << rays.size() * trees.size() << " segments occluded, "
+              << mismatches << " mismatches" << std::endl;
+    return mismatches == 0;
+}
+
+bool test_render_crop() {
+
+    // a crop window, rendered into a padded RGBA buffer, must match the same pixels of a full render
+    hittable_list world;
+    world.add(std::make_shared<sphere>(point3(0, -100.5, -1), 100, std::make_shared<lambertian>(color(0.8, 0.8, 0.0))));
+    world.add(std::make_shared<sphere>(point3(0, 0, -1), 0.5, std::make_shared<metal>(color(0.8, 0.6, 0.2), 0.3)));
+    world.commit();
+
+    const unsigned int width = 40, height = 30;
+    camera cam(point3(0, 0, 1), point3(0, 0, -1), vec3(0, 1, 0), 60, double(width) / height, 0.0, 2.0, 0.0, 1.0);
+
+    renderer r;
+    r.set_scene(world);
+    r.set_cam(cam);
+    r.samples_per_pixel(4);
+    r.max_depth(5);
+    r.image_dims(width, height);
+    r.tile_size(8);
+    r.seed(3);
+
+    std::vector<float> full(width * height * 3);
+    if (!r.render_into(full.data(), width * 3, 3)) {
+        return false;
+    }
+
+    const unsigned int x0 = 5, y0 = 7, x1 = 27, y1 = 20;
+    const size_t stride = (x1 - x0) * 4 + 6;
+    std::vector<float> crop(stride * (y1 - y0), -1.0f);
+    r.crop_window(x0, y0, x1, y1);
+    r.tile_size(16);
+    if (r.output_width() != x1 - x0 || r.output_height() != y1 - y0 || !r.render_into(crop.data(), stride, 4)) {
+        return false;
+    }
+
+    int mismatches = 0;
+    for (unsigned int y = y0; y < y1; y++) {
+        for (unsigned int x = x0; x < x1; x++) {
+            const float* a = &full[(y * width + x) * 3];
+            const float* b = &crop[(y - y0) * stride + (x - x0) * 4];
+            mismatches += a[0] != b[0] || a[1] != b[1] || a[2] != b[2] || b[3] != 1.0f;
+        }
+        // padding at the end of each row is left alone
+        mismatches += crop[(y - y0) * stride + stride - 1] != -1.0f;
+    }
+    return mismatches == 0;
+}
+
+bool test_samplers() {
+
+    // the first 2^k Owen-scrambled Sobol samples of each dimension pair form a (0, k, 2)-net:
+    // every 2^a x 2^(k-a) grid has exactly one point per cell
+    bool passed = true;
+    const uint32_t k = 8, n = 1u << k;
+    sobol_sampler sobol;
+    for (uint64_t pixel = 0; pixel < 4; pixel++) {
+        for (uint32_t dim : {0u, 2u, 6u, 14u}) {
+            for (uint32_t a = 0; a <= k; a++) {
+                std::vector<int> cells(n, 0);
+                for (uint32_t s = 0; s < n; s++) {
+                    uint32_t cx = uint32_t(sobol.value(pixel, 0, 0, s, dim) * (1u << a));
+                    uint32_t cy = uint32_t(sobol.value(pixel, 0, 0, s, dim + 1) * (1u << (k - a)));
+                    cells[(cy << a) | cx]++;
+                }
+                passed &= std::count(cells.begin(), cells.end(), 1) == int(n);
+            }
+        }
+    }
+
+    // stratified samples put one sample in each of the n strata of every dimension
+    stratified_sampler stratified(100);
+    for (uint32_t dim = 0; dim < 10; dim++) {
+        std::vector<int> strata(100, 0);
+        for (uint32_t s = 0; s < 100; s++) {
+            strata[int(stratified.value(17, 0, 0, s, dim) * 100)]++;
+        }
+        passed &= std::count(strata.begin(), strata.end(), 1) == 100;
+    }
+
+    // the blue-noise mask holds every threshold once, and neighbours differ far more
+    // than in white noise, where the expected difference is 1/3
+    std::set<float> levels;
+    double neighbour_difference = 0.0;
+    for (uint32_t y = 0; y < 64; y++) {
+        for (uint32_t x = 0; x < 64; x++) {
+            levels.insert(blue_noise_sampler::mask(x, y));
+            neighbour_difference += std::fabs(blue_noise_sampler::mask(x, y) - blue_noise_sampler::mask(x + 1, y));
+        }
+    }
+    neighbour_difference /= 64 * 64;
+    std::cout << "blue-noise mask: " << levels.size() << " levels, mean neighbour difference " << neighbour_difference << std::endl;
+    passed &= levels.size() == 64 * 64 && neighbour_difference > 0.38;
+
+    // every sampler stays in [0, 1)
+    independent_sampler independent;
+    blue_noise_sampler blue_noise;
+    const sampler* samplers[] = { &independent, &stratified, &sobol, &blue_noise };
+    for (auto smp : samplers) {
+        for (uint32_t s = 0; s < 1000; s++) {
+            double v = smp->value(s * 7919, s % 13, s % 17, s, s % 23);
+            passed &= v >= 0.0 && v < 1.0;
+        }
+    }
+
+    return passed;
+}
+bool test_sample_warps() {
+
+    // closed-form warps against the rejection samplers they replaced: the same
+    // distributions (checked through their moments), at a fixed number of draws
+    const int n = 2000000;
+    const vec3 normal = unit_vector(vec3(0.3, -0.5, 0.8));
+    bool passed = true;
+
+    auto time = [&](const char* name, auto&& sample) {
+        double sink = 0.0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; i++) {
+            sink += sample();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << name << ": " << n / seconds / 1e6 << " M samples/s" << std::endl;
+        return sink / n;
+    };
+
+    // E[cos theta] of a cosine-weighted direction is 2/3
+    double rejection = time("cosine hemisphere, rejection", [&]() { return dot(unit_vector(normal + unit_vector(vec3::random_in_unit_sphere_rejection())), normal); });
+    double direct = time("cosine hemisphere, direct   ", [&]() { return dot(random_cosine_direction(normal), normal); });
+    passed &= std::fabs(rejection - 2.0 / 3) < 2e-3 && std::fabs(direct - 2.0 / 3) < 2e-3;
+
+    // E[r^2] is 1/2 over the unit disk
+    rejection = time("unit disk, rejection        ", []() { return vec3::random_in_unit_disk_rejection().length_squared(); });
+    direct = time("unit disk, concentric       ", []() { return vec3::random_in_unit_disk().length_squared(); });
+    passed &= std::fabs(rejection - 0.5) < 2e-3 && std::fabs(direct - 0.5) < 2e-3;
+
+    // E[r^2] is 3/5 inside the unit sphere
+    rejection = time("unit ball, rejection        ", []() { return vec3::random_in_unit_sphere_rejection().length_squared(); });
+    direct = time("unit ball, direct           ", []() { return vec3::random_in_unit_sphere().length_squared(); });
+    passed &= std::fabs(rejection - 0.6) < 2e-3 && std::fabs(direct - 0.6) < 2e-3;
+
+    // E[z^2] is 1/3 on the unit sphere
+    direct = time("unit sphere, direct         ", []() { vec3 v = vec3::random_unit_vector(); return v.z() * v.z(); });
+    passed &= std::fabs(direct - 1.0 / 3) < 2e-3;
+
+    // directions stay unit length and above the surface
+    for (int i = 0; i < 10000; i++) {
+        vec3 d = random_cosine_direction(i % 2 ? normal : vec3(0, 0, -1));
+        passed &= std::fabs(d.length() - 1.0) < 1e-9 && dot(d, i % 2 ? normal : vec3(0, 0, -1)) >= 0.0;
+        passed &= std::fabs(vec3::random_unit_vector().length() - 1.0) < 1e-9;
+    }
+
+    return passed;
+}
+
+bool test_lights() {
+
+    bool passed = true;
+
+    // 1/pdf of a light's samples averages to the solid angle it covers, and pdf() agrees
+    // with the density sample() reports for the same point
+    const point3 p(0.3, -0.2, 0.1);
+    const point3 center(1, 2, -3);
+    const double radius = 0.7;
+    sphere_light ball(center, radius, color(1, 1, 1));
+
+    const point3 a(-1, 2, -2), b(2, 2.5, -2.5), c(0, 3, -1);
+    triangle_light tri(a, b, c, color(1, 1, 1), p - (a + b + c) / 3);
+
+    const int n = 400000;
+    double ball_solid_angle = 0.0, tri_solid_angle = 0.0;
+    int mismatches = 0;
+    for (int i = 0; i < n; i++) {
+        const double u = random_double(), v = random_double();
+        light_sample s;
+        if (ball.sample(p, u, v, s)) {
+            ball_solid_angle += 1.0 / s.pdf;
+            const point3 y = p + s.distance * s.wi;
+            mismatches += std::fabs((y - center).length() - radius) > 1e-6 || dot(y - center, s.wi) > 0.0 ||
+                          std::fabs(ball.pdf(p, y, unit_vector(y - center)) - s.pdf) > 1e-9 * s.pdf;
+        }
+        if (tri.sample(p, u, v, s)) {
+            tri_solid_angle += 1.0 / s.pdf;
+            const point3 y = p + s.distance * s.wi;
+            mismatches += std::fabs(tri.pdf(p, y, vec3(0, 0, 1)) - s.pdf) > 1e-6 * s.pdf;
+        }
+    }
+    ball_solid_angle /= n;
+    tri_solid_angle /= n;
+
+    // closed forms: the cone around the sphere, and Van Oosterom and Strackee's formula for the triangle
+    const double expected_ball = 2.0 * PI * (1.0 - std::sqrt(1.0 - radius * radius / (center - p).length_squared()));
+    const vec3 ra = a - p, rb = b - p, rc = c - p;
+    const double la = ra.length(), lb = rb.length(), lc = rc.length();
+    const double expected_tri = 2.0 * std::atan2(std::fabs(dot(ra, cross(rb, rc))),
+                                                 la * lb * lc + dot(ra, rb) * lc + dot(ra, rc) * lb + dot(rb, rc) * la);
+    std::cout << "sphere light: " << ball_solid_angle << " sr, expected " << expected_ball << std::endl;
+    std::cout << "triangle light: " << tri_solid_angle << " sr, expected " << expected_tri << std::endl;
+    passed &= mismatches == 0;
+    passed &= std::fabs(ball_solid_angle - expected_ball) < 1e-9 * expected_ball;
+    passed &= std::fabs(tri_solid_angle - expected_tri) < 5e-3 * expected_tri;
+
+    // lights are chosen as often as pmf() says, the nearer one more often despite its lower power
+    light_list lights;
+    lights.add(std::make_shared<point_light>(point3(0, 1, 0), color(1, 1, 1)));
+    lights.add(std::make_shared<point_light>(point3(0, 4, 0), color(3, 3, 3)));
+    lights.add(std::make_shared<directional_light>(vec3(0, -1, 0), color(1, 1, 1)));
+    lights.commit(aabb(point3(-1, -1, -1), point3(1, 1, 1)));
+    int chosen[3] = {};
+    for (int i = 0; i < 10000; i++) {
+        double pmf;
+        const light* l = lights.sample(p, vec3(0, 1, 0), (i + 0.5) / 10000, pmf);
+        for (light_id id = 0; id < 3; id++) {
+            chosen[id] += l == lights.get(id);
+        }
+    }
+    double pmf_sum = 0.0;
+    for (light_id id = 0; id < 3; id++) {
+        const double pmf = lights.pmf(p, vec3(0, 1, 0), id);
+        pmf_sum += pmf;
+        passed &= std::fabs(chosen[id] - 10000 * pmf) <= 1.0;
+    }
+    passed &= std::fabs(pmf_sum - 1.0) < 1e-12 && chosen[0] > chosen[1] && chosen[2] == 5000;
+
+    // a diffuse floor under a delta light has a closed-form radiance of albedo / pi * irradiance
+    const double albedo = 0.5;
+    auto floor_under = [&](std::shared_ptr<light> l, const unsigned int spp, const double vfov,
+                           std::shared_ptr<hittable> emitter) {
+        hittable_list world;
+        world.add(std::make_shared<sphere>(point3(0, -1000, 0), 1000, std::make_shared<lambertian>(color(albedo, albedo, albedo))));
+        if (l) {
+            world.add_light(l);
+        }
+        if (emitter) {
+            world.add(emitter);
+        }
+        world.commit();
+
+        const unsigned int size = 8;
+        camera cam(point3(0, 1.5, 0), point3(0, 0, 0), vec3(0, 0, -1), vfov, 1.0, 0.0, 1.5, 0.0, 1.0);
+        renderer r;
+        r.set_scene(world);
+        r.set_cam(cam);
+        r.samples_per_pixel(spp);
+        r.max_depth(5);
+        r.image_dims(size, size);
+        r.background(color(0, 0, 0));
+        r.seed(5);
+
+        std::vector<float> pixels(size * size * 3);
+        r.render_into(pixels.data(), size * 3, 3);
+        double sum = 0.0;
+        for (float value : pixels) {
+            sum += value;
+        }
+        return sum / pixels.size();
+    };
+
+    const double point_radiance = floor_under(std::make_shared<point_light>(point3(0, 2, 0), color(4, 4, 4)), 4, 0.5, nullptr);
+    const double sun_radiance = floor_under(std::make_shared<directional_light>(vec3(0, -1, 0), color(1, 1, 1)), 4, 0.5, nullptr);
+    std::cout << "point light: " << point_radiance << ", expected " << albedo / PI * 4 / 4 << std::endl;
+    std::cout << "directional light: " << sun_radiance << ", expected " << albedo / PI << std::endl;
+    passed &= std::fabs(point_radiance - albedo / PI) < 1e-3 * albedo / PI;
+    passed &= std::fabs(sun_radiance - albedo / PI) < 1e-3 * albedo / PI;
+
+    // next-event estimation with MIS converges to the same image as finding the emitter by
+    // BSDF sampling alone; a moving sphere is never registered as a light
+    auto glow = std::make_shared<diffuse_light>(color(8, 8, 8));
+    const double with_nee = floor_under(nullptr, 512, 90, std::make_shared<sphere>(point3(0.5, 1, 0), 0.4, glow));
+    const double without_nee = floor_under(nullptr, 512, 90,
+                                           std::make_shared<moving_sphere>(point3(0.5, 1, 0), point3(0.5, 1, 0), 0.4, glow, 0.0, 1.0));
+    std::cout << "sphere light with NEE: " << with_nee << ", BSDF sampling only: " << without_nee << std::endl;
+    passed &= std::fabs(with_nee - without_nee) < 0.03 * without_nee;
+
+    return passed;
+}
+
+bool test_light_bvh() {
+
+    bool passed = true;
+
+    // a few hundred small triangle lights facing every way around the origin
+    std::mt19937 gen(21);
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    auto random_point = [&](const double scale) {
+        return point3(scale * uniform(gen), scale * uniform(gen), scale * uniform(gen));
+    };
+
+    light_list lights;
+    const int num_lights = 300;
+    for (int i = 0; i < num_lights; i++) {
+        const point3 a = random_point(4.0);
+        lights.add(std::make_shared<triangle_light>(a, a + random_point(0.2), a + random_point(0.2),
+                                                    color(1, 1, 1) * (1.0 + uniform(gen))));
+    }
+    lights.commit(aabb(point3(-5, -5, -5), point3(5, 5, 5)));
+    std::cout << "light bvh: " << lights.bvh().node_count() << " nodes" << std::endl;
+    passed &= lights.bvh().node_count() == 2 * num_lights - 1;
+
+    int bad_sums = 0, bad_counts = 0, missed = 0;
+    for (int trial = 0; trial < 50; trial++) {
+        const point3 p = random_point(5.0);
+        const vec3 n = vec3::random_unit_vector();
+
+        // pmf() matches how often sample() picks each light; stratified u gives every light a run of exactly
+        // pmf * count samples, up to the ends. It sums to at most one: the descent gives up where the bounds
+        // of a node admit light that none of its children can deliver
+        const int count = 20000;
+        std::vector<int> chosen(num_lights, 0);
+        for (int i = 0; i < count; i++) {
+            double pmf;
+            const light* l = lights.sample(p, n, (i + 0.5) / count, pmf);
+            for (light_id id = 0; l && id < num_lights; id++) {
+                if (lights.get(id) == l) {
+                    chosen[id]++;
+                    bad_counts += std::fabs(pmf - lights.pmf(p, n, id)) > 1e-12;
+                    break;
+                }
+            }
+        }
+
+        double sum = 0.0;
+        for (light_id id = 0; id < num_lights; id++) {
+            const double pmf = lights.pmf(p, n, id);
+            sum += pmf;
+            bad_counts += std::fabs(chosen[id] - count * pmf) > 1.0;
+
+            // a light never chosen must not be able to light p
+            if (pmf == 0.0) {
+                for (int k = 0; k < 16; k++) {
+                    light_sample ls;
+                    missed += lights.get(id)->sample(p, random_double(), random_double(), ls) && dot(ls.wi, n) > 0.0;
+                }
+            }
+        }
+        bad_sums += sum > 1.0 + 1e-9;
+    }
+
+    // under a ceiling of lights that all face it, nothing is lost
+    light_list ceiling;
+    for (int i = 0; i < 16; i++) {
+        for (int j = 0; j < 16; j++) {
+            const point3 corner(i - 8.0, 3.0, j - 8.0);
+            ceiling.add(std::make_shared<triangle_light>(corner, corner + vec3(0.5, 0, 0), corner + vec3(0, 0, 0.5),
+                                                         color(1, 1, 1), vec3(0, -1, 0)));
+        }
+    }
+    ceiling.commit(aabb(point3(-8, 0, -8), point3(8, 3, 8)));
+    for (int trial = 0; trial < 50; trial++) {
+        const point3 p(8.0 * uniform(gen), 0.0, 8.0 * uniform(gen));
+        double sum = 0.0;
+        for (light_id id = 0; id < ceiling.size(); id++) {
+            sum += ceiling.pmf(p, vec3(0, 1, 0), id);
+        }
+        bad_sums += std::fabs(sum - 1.0) > 1e-9;
+    }
+    std::cout << "light bvh: " << bad_sums << " bad sums, " << bad_counts << " bad counts, "
+              << missed << " reachable lights never chosen" << std::endl;
+    passed &= bad_sums == 0 && bad_counts == 0 && missed == 0;
+
+    return passed;
+}
+
+bool test_environment_light() {
+
+    bool passed = true;
+
+    // alias tables pick each outcome exactly as often as its pmf, given stratified u
+    const std::vector<double> weights = { 1.0, 0.0, 5.0, 2.5, 0.5, 1.0 };
+    alias_table table(weights);
+    std::vector<int> picked(weights.size(), 0);
+    const int count = 120000;
+    for (int i = 0; i < count; i++) {
+        double pmf, remapped;
+        picked[table.sample((i + 0.5) / count, pmf, remapped)]++;
+    }
+    for (uint32_t i = 0; i < weights.size(); i++) {
+        passed &= std::fabs(table.pmf(i) - weights[i] / 10.0) < 1e-12 && std::fabs(picked[i] - count * table.pmf(i)) <= 2.0;
+    }
+
+    // a dim sky, darker below the horizon, with a small sun, written as a little-endian PFM and read back
+    const unsigned int width = 64, height = 32;
+    float_image sky;
+    sky.width = width;
+    sky.height = height;
+    sky.rgb.resize(width * height * 3);
+    for (unsigned int y = 0; y < height; y++) {
+        for (unsigned int x = 0; x < width; x++) {
+            const float level = y < height / 2 ? 0.5f : 0.1f;
+            float* texel = &sky.rgb[(y * width + x) * 3];
+            texel[0] = level;
+            texel[1] = level;
+            texel[2] = 2.0f * level;
+        }
+    }
+    sky.rgb[(5 * width + 10) * 3 + 0] = sky.rgb[(5 * width + 10) * 3 + 1] = sky.rgb[(5 * width + 10) * 3 + 2] = 2000.0f;
+
+    const std::string pfm_file = "environment_test.pfm";
+    {
+        std::ofstream out(pfm_file, std::ios::binary);
+        out << "PF\n" << width << " " << height << "\n-1.0\n";
+        for (int y = height - 1; y >= 0; y--) {
+            out.write(reinterpret_cast<const char*>(&sky.rgb[y * width * 3]), width * 3 * sizeof(float));
+        }
+    }
+    const float_image loaded = read_pfm(pfm_file);
+    std::remove(pfm_file.c_str());
+    passed &= loaded.width == width && loaded.height == height && loaded.rgb == sky.rgb;
+
+    // samples agree with pdf(), and radiance / pdf averages to the integral over the sphere
+    environment_light env(loaded);
+    double integral = 0.0;
+    for (unsigned int y = 0; y < height; y++) {
+        const double solid_angle = 2.0 * PI / width * (std::cos(PI * y / height) - std::cos(PI * (y + 1) / height));
+        for (unsigned int x = 0; x < width; x++) {
+            integral += luminance(color(loaded.at(x, y)[0], loaded.at(x, y)[1], loaded.at(x, y)[2])) * solid_angle;
+        }
+    }
+    const point3 origin(0, 0, 0);
+    const int n = 200000;
+    double estimate = 0.0;
+    int mismatches = 0;
+    for (int i = 0; i < n; i++) {
+        light_sample ls;
+        if (env.sample(origin, random_double(), random_double(), ls)) {
+            estimate += luminance(ls.radiance) / ls.pdf / n;
+            mismatches += std::fabs(env.pdf(origin, origin + ls.wi, ls.wi) - ls.pdf) > 1e-6 * ls.pdf ||
+                          (env.environment(ls.wi) - ls.radiance).length_squared() > 0.0;
+        }
+    }
+    std::cout << "environment: " << estimate << ", expected " << integral << ", " << mismatches << " mismatches" << std::endl;
+    passed &= mismatches == 0 && std::fabs(estimate - integral) < 1e-3 * integral;
+
+    // a diffuse floor under it has radiance albedo / pi times the irradiance from the upper half
+    double irradiance = 0.0;
+    for (unsigned int y = 0; y < height / 2; y++) {
+        // integral of cos(theta) sin(theta) over the row
+        const double projected = PI / width * (std::pow(std::sin(PI * (y + 1) / height), 2) - std::pow(std::sin(PI * y / height), 2));
+        for (unsigned int x = 0; x < width; x++) {
+            irradiance += luminance(color(loaded.at(x, y)[0], loaded.at(x, y)[1], loaded.at(x, y)[2])) * projected;
+        }
+    }
+    const double albedo = 0.5;
+    hittable_list world;
+    world.add(std::make_shared<sphere>(point3(0, -1000, 0), 1000, std::make_shared<lambertian>(color(albedo, albedo, albedo))));
+    world.add_light(std::make_shared<environment_light>(loaded));
+    world.commit();
+
+    const unsigned int size = 8;
+    camera cam(point3(0, 1.5, 0), point3(0, 0, 0), vec3(0, 0, -1), 0.5, 1.0, 0.0, 1.5, 0.0, 1.0);
+    renderer r;
+    r.set_scene(world);
+    r.set_cam(cam);
+    r.samples_per_pixel(256);
+    r.max_depth(5);
+    r.image_dims(size, size);
+    r.seed(5);
+    std::vector<float> pixels(size * size * 3);
+    r.render_into(pixels.data(), size * 3, 3);
+    double floor_radiance = 0.0;
+    for (size_t i = 0; i < pixels.size(); i += 3) {
+        floor_radiance += luminance(color(pixels[i], pixels[i + 1], pixels[i + 2])) / (size * size);
+    }
+    std::cout << "floor under environment: " << floor_radiance << ", expected " << albedo / PI * irradiance << std::endl;
+    passed &= std::fabs(floor_radiance - albedo / PI * irradiance) < 0.02 * albedo / PI * irradiance;
+
+    return passed;
+}
+
+bool test_textures() {
+
+    bool passed = true;
+
+    // an image that is no multiple of the tile size, written as a tiled mip pyramid
+    float_image image;
+    image.width = 200;
+    image.height = 120;
+    image.rgb.resize(image.width * image.height * 3);
+    for (unsigned int y = 0; y < image.height; y++) {
+        for (unsigned int x = 0; x < image.width; x++) {
+            float* texel = &image.rgb[(y * image.width + x) * 3];
+            texel[0] = x / 200.0f;
+            texel[1] = y / 120.0f;
+            texel[2] = ((x / 8 + y / 8) % 2) ? 1.0f : 0.0f;
+        }
+    }
+    const std::string texture_file = "texture_test.rtxtex";
+    passed &= write_tiled_texture(texture_file, image, 32);
+
+    // a cache that holds only a few tiles at a time
+    const size_t budget = 64 << 10;
+    tile_cache cache(budget, 4);
+    auto tex = std::make_shared<image_texture>(texture_file, cache);
+    passed &= tex->width() == 200 && tex->height() == 120 && tex->levels() == 9;
+
+    // every texel comes back, through constant eviction, and each level averages the one above
+    int wrong = 0;
+    for (unsigned int y = 0; y < image.height; y++) {
+        for (unsigned int x = 0; x < image.width; x++) {
+            const color c = tex->texel(0, x, y);
+            wrong += c.x() != image.at(x, y)[0] || c.y() != image.at(x, y)[1] || c.z() != image.at(x, y)[2];
+        }
+    }
+    for (unsigned int y = 0; y < 60; y++) {
+        for (unsigned int x = 0; x < 100; x++) {
+            const color mean = 0.25 * (tex->texel(0, 2 * x, 2 * y) + tex->texel(0, 2 * x + 1, 2 * y) +
+                                       tex->texel(0, 2 * x, 2 * y + 1) + tex->texel(0, 2 * x + 1, 2 * y + 1));
+            wrong += (tex->texel(1, x, y) - mean).length() > 1e-6;
+        }
+    }
+    std::cout << "texture: " << wrong << " wrong texels, " << cache.resident_bytes() << " bytes resident of "
+              << budget << ", " << cache.misses() << " tiles read" << std::endl;
+    passed &= wrong == 0 && cache.resident_bytes() <= budget;
+
+    // a point lookup at a texel center returns it; a footprint covering the image returns its mean
+    const color center = tex->value((10 + 0.5) / 200.0, 1.0 - (20 + 0.5) / 120.0, 0.0);
+    passed &= (center - tex->texel(0, 10, 20)).length() < 1e-6;
+    color mean(0, 0, 0);
+    for (unsigned int y = 0; y < image.height; y++) {
+        for (unsigned int x = 0; x < image.width; x++) {
+            mean += color(image.at(x, y)[0], image.at(x, y)[1], image.at(x, y)[2]);
+        }
+    }
+    mean /= double(image.width * image.height);
+    const color blurred = tex->value(0.3, 0.7, 10.0);
+    std::cout << "texture mean: " << blurred << ", image mean " << mean << std::endl;
+    passed &= (blurred - mean).length() < 1e-5;
+
+    // threads reading at once see the same texels
+    std::atomic<int> thread_wrong(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.push_back(std::thread([&, t]() {
+            std::mt19937 gen(t);
+            for (int i = 0; i < 20000; i++) {
+                const unsigned int x = gen() % image.width, y = gen() % image.height;
+                const color c = tex->texel(0, x, y);
+                thread_wrong += c.x() != image.at(x, y)[0] || c.y() != image.at(x, y)[1] || c.z() != image.at(x, y)[2];
+            }
+        }));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    passed &= thread_wrong == 0 && cache.resident_bytes() <= budget;
+    std::remove(texture_file.c_str());
+
+    // texture coordinates interpolate across a mesh's faces
+    std::vector<point3> vertices = { point3(0, 0, 0), point3(2, 0, 0), point3(2, 2, 0), point3(0, 2, 0) };
+    std::vector<vec3> texture_coords = { vec3(0, 0, 0), vec3(1, 0, 0), vec3(1, 1, 0), vec3(0, 1, 0) };
+    std::vector<face> faces(2);
+    faces[0].vertex_indices = faces[0].texture_indices = { 0, 1, 2 };
+    faces[1].vertex_indices = faces[1].texture_indices = { 0, 2, 3 };
+    auto checker = std::make_shared<lambertian>(std::make_shared<checker_texture>(color(1, 1, 1), color(0, 0, 0), 4.0));
+    triangle_mesh quad(vertices, std::vector<vec3>(), texture_coords, faces, checker);
+    quad.commit();
+    hit_record rec;
+    passed &= quad.hit(ray(point3(0.5, 1.5, 1), vec3(0, 0, -1)), 0.001, INF, rec);
+    std::cout << "texture coordinates: " << rec.u << ", " << rec.v << ", " << rec.uv_scale << " per unit" << std::endl;
+    passed &= std::fabs(rec.u - 0.25) < 1e-9 && std::fabs(rec.v - 0.75) < 1e-9 && std::fabs(rec.uv_scale - 0.5) < 1e-9;
+
+    return passed;
+}
+
+/* decompress a zlib stream of fixed Huffman blocks, all the PNG writer produces; false on anything else */
+static bool inflate_fixed(const std::vector<uint8_t>& in, std::vector<uint8_t>& out) {
+    size_t bit = 16;    // past the zlib header
+    bool ok = in.size() > 6;
+    auto bits = [&](const int count) {
+        uint32_t v = 0;
+        for (int k = 0; k < count; k++, bit++) {
+            ok &= bit / 8 < in.size();
+            v |= ok ? uint32_t((in[bit / 8] >> (bit % 8)) & 1) << k : 0;
+        }
+        return v;
+    };
+    // Huffman codes arrive most significant bit first
+    auto code = [&](const int count, uint32_t v) {
+        for (int k = 0; k < count; k++) {
+            v = v << 1 | bits(1);
+        }
+        return v;
+    };
+
+    static const int length_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const int length_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+
+    bool last = false;
+    while (ok && !last) {
+        last = bits(1);
+        if (bits(2) != 1) {
+            return false;
+        }
+        while (ok) {
+            uint32_t c = code(7, 0);
+            int sym;
+            if (c <= 0x17) {
+                sym = 256 + c;
+            } else if ((c = code(1, c)) >= 0x30 && c <= 0xbf) {
+                sym = c - 0x30;
+            } else if (c >= 0xc0 && c <= 0xc7) {
+                sym = 280 + c - 0xc0;
+            } else {
+                sym = 144 + code(1, c) - 0x190;
+            }
+
+            if (sym < 256) {
+                out.push_back(uint8_t(sym));
+            } else if (sym == 256) {
+                break;
+            } else if (sym <= 285) {
+                const int length = length_base[sym - 257] + bits(length_extra[sym - 257]);
+                const int d = code(5, 0);
+                const int extra = d < 4 ? 0 : d / 2 - 1;
+                const int distance = (d < 4 ? d + 1 : ((2 + d % 2) << extra) + 1) + bits(extra);
+                if (d > 29 || size_t(distance) > out.size()) {
+                    return false;
+                }
+                for (int k = 0; k < length; k++) {
+                    out.push_back(out[out.size() - distance]);
+                }
+            } else {
+                return false;
+            }
+        }
+    }
+
+    // Adler-32 of the data, most significant byte first, after the last block
+    const size_t end = (bit + 7) / 8;
+    uint32_t a = 1, b = 0;
+    for (const uint8_t byte : out) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    return ok && end + 4 == in.size() &&
+           (uint32_t(in[end]) << 24 | uint32_t(in[end + 1]) << 16 | uint32_t(in[end + 2]) << 8 | in[end + 3]) == (b << 16 | a);
+}
+
+static uint32_t read_be32(const uint8_t* p) {
+    return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+}
+
+bool test_image_output() {
+
+    bool passed = true;
+
+    // the vectorized conversion matches one value at a time, and the default matches the old output exactly
+    std::vector<float> values;
+    for (int k = -200; k < 4000; k++) {
+        values.push_back(k / 997.0f);
+    }
+    values.push_back(INF);
+    values.push_back(std::nanf(""));
+    values.push_back(-INF);
+    while (values.size() % 4 != 0) {
+        values.push_back(0.5f);
+    }
+
+    int wrong = 0;
+    for (const tone_operator op : { tone_operator::clamp, tone_operator::reinhard, tone_operator::aces }) {
+        tone_mapping tone;
+        tone.op = op;
+        tone.exposure = op == tone_operator::clamp ? 1.0f : 2.0f;
+        std::vector<uint8_t> batch(values.size());
+        encode_8bit(values.data(), batch.data(), values.size(), tone);
+        for (size_t k = 0; k < values.size(); k++) {
+            uint8_t single;
+            encode_8bit(&values[k], &single, 1, tone);
+            wrong += single != batch[k];
+            if (op == tone_operator::clamp && values[k] == values[k]) {
+                wrong += batch[k] != uint8_t(int(255.99 * clamp(std::sqrt(values[k]), 0.0f, 0.999f)));
+            }
+            // every curve rises
+            wrong += k > 0 && k < 4200 && batch[k] < batch[k - 1];
+        }
+        wrong += batch[4200] != 255 || batch[4201] != 0 || batch[4202] != 0;
+    }
+    std::cout << "8-bit conversion: " << wrong << " wrong values" << std::endl;
+    passed &= wrong == 0;
+
+    // an image whose size fits no tile or SIMD width
+    float_image image;
+    image.width = 37;
+    image.height = 23;
+    std::mt19937 gen(5);
+    for (unsigned int k = 0; k < image.width * image.height * 3; k++) {
+        image.rgb.push_back((k / 3) % 7 == 0 ? 0.5f : std::uniform_real_distribution<float>(0.0f, 1.5f)(gen));
+    }
+
+    // PNG: chunks, checksums and the pixels once inflated and unfiltered
+    const std::string png_file = "image_output_test.png";
+    passed &= write_image(png_file, image);
+    std::ifstream png_in(png_file, std::ios::binary);
+    const std::vector<uint8_t> png((std::istreambuf_iterator<char>(png_in)), std::istreambuf_iterator<char>());
+    std::vector<uint8_t> compressed;
+    bool chunks_ok = png.size() > 8 && png[1] == 'P' && png[2] == 'N' && png[3] == 'G';
+    for (size_t pos = 8; chunks_ok && pos + 12 <= png.size(); ) {
+        const uint32_t length = read_be32(&png[pos]);
+        chunks_ok &= pos + 12 + length <= png.size();
+        if (!chunks_ok) {
+            break;
+        }
+        uint32_t crc = 0xffffffffu;
+        for (size_t k = pos + 4; k < pos + 8 + length; k++) {
+            crc ^= png[k];
+            for (int b = 0; b < 8; b++) {
+                crc = crc & 1 ? 0xedb88320u ^ (crc >> 1) : crc >> 1;
+            }
+        }
+        chunks_ok &= ~crc == read_be32(&png[pos + 8 + length]);
+        const std::string type(png.begin() + pos + 4, png.begin() + pos + 8);
+        if (type == "IHDR") {
+            chunks_ok &= read_be32(&png[pos + 8]) == image.width && read_be32(&png[pos + 12]) == image.height;
+        } else if (type == "IDAT") {
+            compressed.insert(compressed.end(), png.begin() + pos + 8, png.begin() + pos + 8 + length);
+        }
+        pos += 12 + length;
+    }
+    std::vector<uint8_t> filtered;
+    chunks_ok &= inflate_fixed(compressed, filtered);
+
+    const size_t stride = image.width * 3;
+    std::vector<uint8_t> expected(image.rgb.size());
+    encode_8bit(image.rgb.data(), expected.data(), expected.size(), tone_mapping());
+    int png_wrong = 0;
+    if (chunks_ok && filtered.size() == image.height * (stride + 1)) {
+        std::vector<uint8_t> previous(stride, 0), row(stride);
+        for (unsigned int y = 0; y < image.height; y++) {
+            const uint8_t filter = filtered[y * (stride + 1)];
+            const uint8_t* in = &filtered[y * (stride + 1) + 1];
+            for (size_t k = 0; k < stride; k++) {
+                const int a = k >= 3 ? row[k - 3] : 0, b = previous[k], c = k >= 3 ? previous[k - 3] : 0;
+                const int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+                const int predicted = filter == 0 ? 0 : filter == 1 ? a : filter == 2 ? b : filter == 3 ? (a + b) / 2
+                                    : pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+                row[k] = uint8_t(in[k] + predicted);
+                png_wrong += row[k] != expected[y * stride + k] || filter > 4;
+            }
+            previous = row;
+        }
+    } else {
+        png_wrong = -1;
+    }
+    std::cout << "PNG: " << png.size() << " bytes, " << png_wrong << " wrong values" << std::endl;
+    passed &= png_wrong == 0;
+    std::remove(png_file.c_str());
+
+    // PFM comes back exactly
+    const std::string pfm_file = "image_output_test.pfm";
+    passed &= write_image(pfm_file, image);
+    passed &= read_pfm(pfm_file).rgb == image.rgb;
+    std::remove(pfm_file.c_str());
+
+    // EXR: header, then the offset table, then each line's y, size and B, G, R floats
+    const std::string exr_file = "image_output_test.exr";
+    passed &= write_image(exr_file, image);
+    std::ifstream exr_in(exr_file, std::ios::binary);
+    const std::vector<uint8_t> exr((std::istreambuf_iterator<char>(exr_in)), std::istreambuf_iterator<char>());
+    int exr_wrong = exr.size() < 8 || exr[0] != 0x76 || exr[1] != 0x2f || exr[2] != 0x31 || exr[3] != 0x01 || exr[4] != 2;
+    size_t pos = 8;
+    while (!exr_wrong && pos < exr.size() && exr[pos] != 0) {
+        // attribute name and type, then the size of the value
+        for (int strings = 0; strings < 2; strings++) {
+            pos = std::find(exr.begin() + pos, exr.end(), 0) - exr.begin() + 1;
+        }
+        uint32_t size;
+        std::memcpy(&size, &exr[std::min(pos, exr.size() - 4)], 4);
+        pos += 4 + size;
+    }
+    pos++;
+    for (unsigned int y = 0; !exr_wrong && y < image.height; y++) {
+        uint64_t offset;
+        std::memcpy(&offset, &exr[pos + y * 8], 8);
+        int32_t line[2];
+        std::memcpy(line, &exr[offset], 8);
+        exr_wrong += line[0] != int32_t(y) || line[1] != int32_t(stride * 4) || offset + 8 + stride * 4 > exr.size();
+        for (unsigned int x = 0; !exr_wrong && x < image.width; x++) {
+            for (int c = 0; c < 3; c++) {
+                float value;
+                std::memcpy(&value, &exr[offset + 8 + ((2 - c) * image.width + x) * 4], 4);
+                exr_wrong += value != image.at(x, y)[c];
+            }
+        }
+    }
+    std::cout << "EXR: " << exr.size() << " bytes, " << exr_wrong << " wrong values" << std::endl;
+    passed &= exr_wrong == 0;
+    std::remove(exr_file.c_str());
+
+    // render_scene streams rows of tiles out as they finish; the file must hold the same image
+    hittable_list world;
+    world.add(std::make_shared<sphere>(point3(0, -100.5, -1), 100, std::make_shared<lambertian>(color(0.8, 0.8, 0.0))));
+    world.add(std::make_shared<sphere>(point3(0, 0, -1), 0.5, std::make_shared<metal>(color(0.8, 0.6, 0.2), 0.3)));
+    world.commit();
+
+    const unsigned int width = 40, height = 30;
+    camera cam(point3(0, 0, 1), point3(0, 0, -1), vec3(0, 1, 0), 60, double(width) / height, 0.0, 2.0, 0.0, 1.0);
+    renderer r;
+    r.set_scene(world);
+    r.set_cam(cam);
+    r.samples_per_pixel(4);
+    r.max_depth(5);
+    r.image_dims(width, height);
+    r.tile_size(8);
+    r.num_threads(2);
+    r.seed(3);
+
+    std::vector<float> full(width * height * 3);
+    passed &= r.render_into(full.data(), width * 3, 3);
+    const std::string render_file = "image_output_render.pfm";
+    r.output_file(render_file);
+    r.render_scene();
+    passed &= read_pfm(render_file).rgb == full;
+    std::remove(render_file.c_str());
+
+    return passed;
+}
+
+bool test_streaming_render() {
+
+    // renders that keep only a few rows of tiles in memory must write the same image
+    hittable_list world;
+    world.add(std::make_shared<sphere>(point3(0, -100.5, -1), 100, std::make_shared<lambertian>(color(0.8, 0.8, 0.0))));
+    world.add(std::make_shared<sphere>(point3(0, 0, -1), 0.5, std::make_shared<metal>(color(0.8, 0.6, 0.2), 0.3)));
+    world.add(std::make_shared<sphere>(point3(1, 0, -1.5), 0.5, std::make_shared<dielectric>(1.5)));
+    world.commit();
+
+    const unsigned int width = 45, height = 70;
+    camera cam(point3(0, 0.5, 1.5), point3(0, 0, -1), vec3(0, 1, 0), 60, double(width) / height, 0.0, 2.0, 0.0, 1.0);
+    renderer r;
+    r.set_scene(world);
+    r.set_cam(cam);
+    r.samples_per_pixel(2);
+    r.max_depth(5);
+    r.image_dims(width, height);
+    r.tile_size(8);
+    r.num_threads(4);
+    r.seed(11);
+
+    std::vector<float> full(width * height * 3);
+    if (!r.render_into(full.data(), width * 3, 3)) {
+        return false;
+    }
+
+    bool passed = true;
+    const std::string file = "streaming_render_test.pfm";
+    r.output_file(file);
+    for (const unsigned int rows : { 1u, 3u, 100u }) {
+        r.streaming_window(rows);
+        r.render_scene();
+        const bool same = read_pfm(file).rgb == full;
+        std::cout << "streaming " << rows << " rows of tiles: " << (same ? "same image" : "different image") << std::endl;
+        passed &= same;
+    }
+    std::remove(file.c_str());
+
+    // a window in the middle of a crop matches too
+    r.crop_window(3, 10, 40, 61);
+    r.streaming_window(2);
+    std::vector<float> crop(37 * 51 * 3);
+    passed &= r.render_into(crop.data(), 37 * 3, 3);
+    r.render_scene();
+    passed &= read_pfm(file).rgb == crop;
+    std::remove(file.c_str());
+
+    return passed;
+}
+
+bool test_triangle_simd() {
+
+    // scalar triangle::hit against four-wide triangle4 packets over the same leaves
+    auto mesh = get_triangle_mesh_from_file("../objs/teapot.obj");
+    if (!mesh->commit()) {
+        return false;
+    }
+
+    std::shared_ptr<linear_bvh> bvh = mesh->bvh();
+    triangle4_leaves leaves(*bvh);
+    const std::vector<linear_bvh_node>& nodes = bvh->nodes();
+    const std::vector<std::shared_ptr<hittable>>& triangles = bvh->primitives();
+
+    // raw intersection throughput, every ray against every triangle
+    std::vector<ray> rays = rays_towards(mesh->get_bounding_box(), 500);
+    int scalar_hits = 0, simd_hits = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (auto& r : rays) {
+        for (auto& tri : triangles) {
+            hit_record rec;
+            scalar_hits += tri->hit(r, 0.001, INF, rec);
+        }
+    }
+    double scalar_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (auto& r : rays) {
+        for (uint32_t n = 0; n < nodes.size(); n++) {
+            hit_record rec;
+            if (nodes[n].num_primitives > 0) {
+                simd_hits += leaves.hit_leaf(nodes[n].offset, nodes[n].num_primitives, r, 0.001, INF, rec);
+            }
+        }
+    }
+    double simd_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const double num_tests = double(rays.size()) * triangles.size();
+    std::cout << "scalar: " << num_tests / scalar_seconds << " triangle tests/s" << std::endl;
+    std::cout << "simd:   " << num_tests / simd_seconds << " triangle tests/s" << std::endl;
+
+    // whole traversals; the single precision test may disagree on rays grazing an edge
+    rays = rays_towards(mesh->get_bounding_box(), 200000);
+    int scalar_traced, simd_traced;
+    mesh->set_packet_intersection(false);
+    scalar_seconds = seconds_to_trace(*mesh, rays, scalar_traced);
+    mesh->set_packet_intersection(true);
+    simd_seconds = seconds_to_trace(*mesh, rays, simd_traced);
+
+    std::cout << "scalar: " << rays.size() / scalar_seconds << " rays/s" << std::endl;
+    std::cout << "simd:   " << rays.size() / simd_seconds << " rays/s" << std::endl;
+
+    return simd_hits <= scalar_hits && std::abs(scalar_traced - simd_traced) <= int(rays.size() / 1000);
+}
+
+bool test_mesh_cache() {
+
+    // a mesh read back from its cache must trace exactly like the parsed OBJ
+    const std::string obj_file = "../objs/teapot.obj";
+    const std::string cache_file = "mesh_cache_test.rtxmesh";
+
+    auto parsed = get_triangle_mesh_from_file(obj_file);
+    if (!write_mesh_cache(cache_file, obj_file, *parsed)) {
+        return false;
+    }
+    auto cached = load_mesh_cache(cache_file, obj_file);
+    bool passed = cached && cached->commit();
+
+    // a cache is never accepted for a different source
+    passed &= (load_mesh_cache(cache_file, "../objs/tetrahedron.obj") == nullptr);
+
+    // nor one whose indices point past its arrays: claim a single vertex (num_vertices is at byte 40 of the header)
+    {
+        std::fstream corrupt(cache_file, std::ios::in | std::ios::out | std::ios::binary);
+        const uint64_t one_vertex = 1;
+        corrupt.seekp(40);
+        corrupt.write(reinterpret_cast<const char*>(&one_vertex), sizeof(one_vertex));
+    }
+    passed &= (load_mesh_cache(cache_file, obj_file) == nullptr);
+    std::remove(cache_file.c_str());
+    if (!passed) {
+        return false;
+    }
+
+    passed &= (cached->bvh()->node_count() == parsed->bvh()->node_count());
+    for (auto& r : rays_towards(parsed->get_bounding_box(), 10000)) {
+        hit_record parsed_rec, cached_rec;
+        bool parsed_hit = parsed->hit(r, 0.001, INF, parsed_rec);
+        bool cached_hit = cached->hit(r, 0.001, INF, cached_rec);
+        passed &= (parsed_hit == cached_hit);
+        if (parsed_hit && cached_hit) {
+            passed &= (parsed_rec.t == cached_rec.t);
+        }
+    }
+
+    // new build options replace the cached tree with a fresh build
+    bvh_build_options median;
+    median.method = SPLIT_MEDIAN;
+    cached->set_bvh_options(median);
+    passed &= cached->commit() && cached->build_seconds() > 0;
+    passed &= cached->bvh()->sah_cost() > parsed->bvh()->sah_cost();
+    return passed;
+}
+
+bool test_material_table() {
+
+    // shared materials get one entry, instances report their override
+    auto red = std::make_shared<lambertian>(color(1, 0, 0));
+    auto blue = std::make_shared<lambertian>(color(0, 0, 1));
+
+    hittable_list world;
+    world.add(std::make_shared<sphere>(point3(-2, 0, 0), 0.5, red));
+    world.add(std::make_shared<sphere>(point3(0, 0, 0), 0.5, red));
+    world.add(std::make_shared<mesh_instance>(std::make_shared<sphere>(point3(0, 0, 0), 0.5, red),
+              std::vector<std::shared_ptr<transform>>{ std::make_shared<translation>(vec3(2, 0, 0)) }, blue));
+    if (!world.commit()) {
+        return false;
+    }
+
+    bool passed = world.materials().size() == 2;
+    const double xs[] = { -2, 0, 2 };
+    const material* expected[] = { red.get(), red.get(), blue.get() };
+    for (int k = 0; k < 3; k++) {
+        hit_record rec;
+        passed &= world.hit(ray(point3(xs[k], 0, 5), vec3(0, 0, -1)), 0.001, INF, rec);
+        passed &= (world.materials().get(rec.mat_id) == expected[k]);
+    }
+    return passed;
+}
+
 /* ---------------- Command Line Parsing --------------- */
 
 struct Test {
@@ -282,7 +1661,10 @@ void print_usage() {
               << std::endl;
 
     std::cout << "Valid test_name: all, triangle_intersection_simple, triangle_intersection_random\n" 
-              << " triangle_intersection_watertightness, simple_triangle_mesh, bvh\n" 
+              << " triangle_intersection_watertightness, simple_triangle_mesh, mesh_transforms, bvh, tile_scheduler\n"
+              << " rng_streams, bvh_quality, bvh_layout, mesh_cache, material_table, triangle_simd\n"
+              << " bvh_wide, bvh_parallel, bvh_degenerate, occlusion, render_crop, samplers, sample_warps\n"
+              << " lights, light_bvh, environment_light, textures, image_output, streaming_render\n" 
               << std::endl;
 
     std::cout << "-h --help       This message" << std::endl;
@@ -296,7 +1678,23 @@ std::vector<Test> parse_args(int argc, char* argv[]) {
         tests.push_back(Test("triangle_intersection_random", test_triangle_intersection_random));
         tests.push_back(Test("triangle_intersection_watertightness", test_triangle_intersection_watertightness));
         tests.push_back(Test("simple_triangle_mesh", test_simple_triangle_mesh));
+        tests.push_back(Test("mesh_transforms", test_mesh_transforms));
         tests.push_back(Test("bvh", test_bvh));
+        tests.push_back(Test("tile_scheduler", test_tile_scheduler));
+        tests.push_back(Test("rng_streams", test_rng_streams));
+        tests.push_back(Test("mesh_cache", test_mesh_cache));
+        tests.push_back(Test("material_table", test_material_table));
+        tests.push_back(Test("bvh_parallel", test_bvh_parallel));
+        tests.push_back(Test("bvh_degenerate", test_bvh_degenerate));
+        tests.push_back(Test("occlusion", test_occlusion));
+        tests.push_back(Test("render_crop", test_render_crop));
+        tests.push_back(Test("samplers", test_samplers));
+        tests.push_back(Test("lights", test_lights));
+        tests.push_back(Test("light_bvh", test_light_bvh));
+        tests.push_back(Test("environment_light", test_environment_light));
+        tests.push_back(Test("textures", test_textures));
+        tests.push_back(Test("image_output", test_image_output));
+        tests.push_back(Test("streaming_render", test_streaming_render));
         return tests;
     }
 
@@ -319,8 +1717,50 @@ std::vector<Test> parse_args(int argc, char* argv[]) {
             tests.push_back(Test("triangle_intersection_watertightness", test_triangle_intersection_watertightness));
         } else if (cmd_line_str == "simple_triangle_mesh") {
             tests.push_back(Test("simple_triangle_mesh", test_simple_triangle_mesh));
+        } else if (cmd_line_str == "mesh_transforms") {
+            tests.push_back(Test("mesh_transforms", test_mesh_transforms));
         } else if (cmd_line_str == "bvh") {
             tests.push_back(Test("bvh", test_bvh));
+        } else if (cmd_line_str == "tile_scheduler") {
+            tests.push_back(Test("tile_scheduler", test_tile_scheduler));
+        } else if (cmd_line_str == "rng_streams") {
+            tests.push_back(Test("rng_streams", test_rng_streams));
+        } else if (cmd_line_str == "bvh_quality") {
+            tests.push_back(Test("bvh_quality", test_bvh_quality));
+        } else if (cmd_line_str == "bvh_layout") {
+            tests.push_back(Test("bvh_layout", test_bvh_layout));
+        } else if (cmd_line_str == "mesh_cache") {
+            tests.push_back(Test("mesh_cache", test_mesh_cache));
+        } else if (cmd_line_str == "material_table") {
+            tests.push_back(Test("material_table", test_material_table));
+        } else if (cmd_line_str == "triangle_simd") {
+            tests.push_back(Test("triangle_simd", test_triangle_simd));
+        } else if (cmd_line_str == "bvh_wide") {
+            tests.push_back(Test("bvh_wide", test_bvh_wide));
+        } else if (cmd_line_str == "bvh_parallel") {
+            tests.push_back(Test("bvh_parallel", test_bvh_parallel));
+        } else if (cmd_line_str == "bvh_degenerate") {
+            tests.push_back(Test("bvh_degenerate", test_bvh_degenerate));
+        } else if (cmd_line_str == "occlusion") {
+            tests.push_back(Test("occlusion", test_occlusion));
+        } else if (cmd_line_str == "render_crop") {
+            tests.push_back(Test("render_crop", test_render_crop));
+        } else if (cmd_line_str == "samplers") {
+            tests.push_back(Test("samplers", test_samplers));
+        } else if (cmd_line_str == "sample_warps") {
+            tests.push_back(Test("sample_warps", test_sample_warps));
+        } else if (cmd_line_str == "lights") {
+            tests.push_back(Test("lights", test_lights));
+        } else if (cmd_line_str == "light_bvh") {
+            tests.push_back(Test("light_bvh", test_light_bvh));
+        } else if (cmd_line_str == "environment_light") {
+            tests.push_back(Test("environment_light", test_environment_light));
+        } else if (cmd_line_str == "textures") {
+            tests.push_back(Test("textures", test_textures));
+        } else if (cmd_line_str == "image_output") {
+            tests.push_back(Test("image_output", test_image_output));
+        } else if (cmd_line_str == "streaming_render") {
+            tests.push_back(Test("streaming_render", test_streaming_render));
         } else {
             std::cout << "Unknown argument: " << cmd_line_str << std::endl;
             std::vector<Test> empty_vec;